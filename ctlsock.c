@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "ctlsock.h"
+
+/* Connect to the server socket. Returns the socket or a negative errno */
+int ctl_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		int rc = -errno;
+
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
+int ctl_send(int fd, uint8_t op, uint8_t protocol, int32_t status,
+					const void *payload, uint16_t len)
+{
+	struct ctl_hdr hdr;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t rc;
+
+	if (len > CTL_PAYLOAD_MAX)
+		return -EMSGSIZE;
+
+	hdr.op = op;
+	hdr.protocol = protocol;
+	hdr.len = len;
+	hdr.status = status;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) payload;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len ? 2 : 1;
+
+	do {
+		rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Receive one packet. Returns the payload length, 0 with hdr->op set to
+ * CTL_OP_UNSPEC when the peer closed the connection, or a negative errno.
+ */
+int ctl_recv(int fd, struct ctl_hdr *hdr, void *payload, uint16_t len_max)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t rc;
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = len_max;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	do {
+		rc = recvmsg(fd, &msg, 0);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1)
+		return -errno;
+
+	if (rc == 0) {
+		hdr->op = CTL_OP_UNSPEC;
+		return 0;
+	}
+
+	if (msg.msg_flags & MSG_TRUNC)
+		return -EMSGSIZE;
+
+	if (rc < sizeof(*hdr) || hdr->len != rc - sizeof(*hdr) ||
+					hdr->op > CTL_OP_MAX)
+		return -EPROTO;
+
+	return hdr->len;
+}
+
+/*
+ * Drop the next packet if it is not a reply to op. Returns 1 when a packet
+ * was dropped, 0 when the reply is next, or a negative errno.
+ */
+static int ctl_skip_other(int fd, uint8_t op)
+{
+	struct ctl_hdr hdr;
+	ssize_t rc;
+
+	do {
+		rc = recv(fd, &hdr, sizeof(hdr), MSG_PEEK);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1)
+		return -errno;
+
+	if (rc == 0)
+		return -ECONNRESET;
+
+	if (rc < sizeof(hdr))
+		return -EPROTO;
+
+	if (hdr.op == op)
+		return 0;
+
+	/* A short read of a SOCK_SEQPACKET packet discards the rest */
+	do {
+		rc = recv(fd, &hdr, sizeof(hdr), 0);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1)
+		return -errno;
+
+	return 1;
+}
+
+/*
+ * Send a request and wait for its reply. Returns the reply payload length
+ * or a negative errno, including the status reported by the server.
+ */
+int ctl_request(int fd, uint8_t op, uint8_t protocol, const void *data,
+			uint16_t len, void *reply, uint16_t reply_max)
+{
+	struct ctl_hdr hdr;
+	int rc;
+
+	rc = ctl_send(fd, op, protocol, 0, data, len);
+	if (rc)
+		return rc;
+
+	/*
+	 * Skip events of an earlier subscription. Only the header is peeked
+	 * at, so an event larger than reply_max does not fail the request.
+	 */
+	for (;;) {
+		rc = ctl_skip_other(fd, op);
+		if (rc < 0)
+			return rc;
+
+		if (!rc)
+			break;
+	}
+
+	rc = ctl_recv(fd, &hdr, reply, reply_max);
+	if (rc < 0)
+		return rc;
+
+	if (hdr.op == CTL_OP_UNSPEC)
+		return -ECONNRESET;
+
+	if (hdr.status)
+		return hdr.status;
+
+	return rc;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _CTLSOCK_H_
+#define _CTLSOCK_H_
+
+#include <stdint.h>
+
+#include <linux/nfc.h>
+
+/*
+ * Binary protocol spoken over the nfcex server's UNIX-domain socket.
+ *
+ * The socket is SOCK_SEQPACKET: every request, reply and event is exactly
+ * one packet made of a struct ctl_hdr followed by len bytes of payload.
+ * Replies carry the request's op and status 0 or a negative errno.
+ */
+#define CTL_SOCK_PATH "/var/run/nfcex.sock"
+
+/* Large enough for a whole tag, see TAG_DATA_MAX */
+#define CTL_PAYLOAD_MAX 8192
+
+enum {
+	CTL_OP_UNSPEC,
+	CTL_OP_READ,		/* reply payload: tag data */
+	CTL_OP_WRITE,		/* request payload: data to write */
+	CTL_OP_LIST,		/* reply payload: array of struct ctl_dev */
+	CTL_OP_SUBSCRIBE,	/* then one CTL_OP_EVENT per found target;
+				 * optional payload: struct ctl_subscribe */
+	CTL_OP_EVENT,		/* payload: struct ctl_target_event */
+	__CTL_OP_AFTER_LAST
+};
+#define CTL_OP_MAX (__CTL_OP_AFTER_LAST - 1)
+
+struct ctl_hdr {
+	uint8_t op;
+	uint8_t protocol;	/* NFC_PROTO_* for READ and WRITE */
+	uint16_t len;
+	int32_t status;
+} __attribute__((packed));
+
+struct ctl_dev {
+	uint32_t idx;
+	uint32_t protocols;
+	char name[NFC_DEVICE_NAME_MAXSIZE + 1];
+} __attribute__((packed));
+
+/* Readers only poll while some client wants their events */
+#define CTL_DEV_ANY 0xffffffff
+
+struct ctl_subscribe {
+	uint32_t dev_idx;	/* CTL_DEV_ANY for every device */
+} __attribute__((packed));
+
+struct ctl_target_event {
+	uint32_t dev_idx;
+	uint32_t tgt_idx;
+	uint32_t protocols;
+} __attribute__((packed));
+
+int ctl_connect(const char *path);
+int ctl_send(int fd, uint8_t op, uint8_t protocol, int32_t status,
+					const void *payload, uint16_t len);
+int ctl_recv(int fd, struct ctl_hdr *hdr, void *payload, uint16_t len_max);
+int ctl_request(int fd, uint8_t op, uint8_t protocol, const void *data,
+			uint16_t len, void *reply, uint16_t reply_max);
+
+#endif /* _CTLSOCK_H_ */
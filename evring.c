@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evring.h"
+
+static size_t evring_size(uint32_t nslots)
+{
+	return sizeof(struct evring_hdr) +
+				(size_t) nslots * sizeof(struct evring_slot);
+}
+
+static int evring_valid(const struct evring_hdr *hdr, size_t map_size)
+{
+	return hdr->magic == EVRING_MAGIC && hdr->version == EVRING_VERSION &&
+		hdr->slot_size == sizeof(struct evring_slot) &&
+		hdr->nslots && !(hdr->nslots & (hdr->nslots - 1)) &&
+		evring_size(hdr->nslots) == map_size;
+}
+
+/*
+ * Create (or take over) the ring named name for publishing. An existing
+ * ring with the same geometry keeps its head, so consumers survive a
+ * restart of the publisher.
+ */
+int evring_create(struct evring *r, const char *name, uint32_t nslots)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	int rc;
+
+	if (!nslots || (nslots & (nslots - 1)))
+		return -EINVAL;
+
+	fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	r->map_size = evring_size(nslots);
+
+	if (st.st_size != r->map_size && ftruncate(fd, r->map_size)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+									0);
+	if (map == MAP_FAILED) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	r->hdr = map;
+	r->slots = (struct evring_slot *) (r->hdr + 1);
+
+	if (!evring_valid(r->hdr, r->map_size)) {
+		memset(map, 0, r->map_size);
+		r->hdr->version = EVRING_VERSION;
+		r->hdr->nslots = nslots;
+		r->hdr->slot_size = sizeof(struct evring_slot);
+		atomic_store_explicit(&r->hdr->head, 0, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		r->hdr->magic = EVRING_MAGIC;
+	}
+
+	close(fd);
+	return 0;
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+/* Map an existing ring read-only, for consumers */
+int evring_open(struct evring *r, const char *name)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	int rc;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	if (st.st_size < sizeof(struct evring_hdr)) {
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	r->map_size = st.st_size;
+
+	map = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	r->hdr = map;
+	r->slots = (struct evring_slot *) (r->hdr + 1);
+
+	if (!evring_valid(r->hdr, r->map_size)) {
+		munmap(map, r->map_size);
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	close(fd);
+	return 0;
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+void evring_close(struct evring *r)
+{
+	if (r->hdr)
+		munmap(r->hdr, r->map_size);
+
+	r->hdr = NULL;
+	r->slots = NULL;
+}
+
+/* Single writer. Never blocks, whatever the consumers are doing */
+void evring_publish(struct evring *r, const struct evring_event *ev)
+{
+	uint64_t n = atomic_load_explicit(&r->hdr->head, memory_order_relaxed);
+	struct evring_slot *slot = &r->slots[n & (r->hdr->nslots - 1)];
+
+	atomic_store_explicit(&slot->seq, 2 * n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(&slot->ev, ev, sizeof(*ev));
+
+	atomic_store_explicit(&slot->seq, 2 * n + 2, memory_order_release);
+	atomic_store_explicit(&r->hdr->head, n + 1, memory_order_release);
+}
+
+/* Cursor of the next event to be published, to start consuming "now" */
+uint64_t evring_head(const struct evring *r)
+{
+	return atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+}
+
+/*
+ * Copy the event at *cursor into ev and advance the cursor. Returns -EAGAIN
+ * when the consumer is up to date. Events overwritten before they could be
+ * read are skipped and added to *lost.
+ */
+int evring_consume(const struct evring *r, uint64_t *cursor,
+			struct evring_event *ev, uint64_t *lost)
+{
+	uint32_t nslots = r->hdr->nslots;
+	struct evring_slot *slot;
+	uint64_t head, s1, s2;
+
+	for (;;) {
+		head = atomic_load_explicit(&r->hdr->head,
+							memory_order_acquire);
+
+		/* The publisher restarted with a fresh ring */
+		if (*cursor > head)
+			*cursor = head;
+
+		if (*cursor == head)
+			return -EAGAIN;
+
+		if (head - *cursor > nslots) {
+			*lost += head - nslots - *cursor;
+			*cursor = head - nslots;
+		}
+
+		slot = &r->slots[*cursor & (nslots - 1)];
+
+		s1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (s1 == 2 * *cursor + 2) {
+			memcpy(ev, &slot->ev, sizeof(*ev));
+
+			atomic_thread_fence(memory_order_acquire);
+			s2 = atomic_load_explicit(&slot->seq,
+							memory_order_relaxed);
+			if (s1 == s2) {
+				(*cursor)++;
+				return 0;
+			}
+		}
+
+		/* Overwritten while we were looking at it */
+		(*lost)++;
+		(*cursor)++;
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _EVRING_H_
+#define _EVRING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Tag event ring in POSIX shared memory.
+ *
+ * One process (the nfcex server) publishes every event; any number of local
+ * consumers map the ring read-only and follow it at their own cursor. The
+ * writer never waits for consumers: a consumer that falls more than the
+ * ring size behind loses the oldest events and is told how many. Each slot
+ * is protected by a sequence counter, so reading needs no syscall and no
+ * lock.
+ */
+#define EVRING_MAGIC 0x4e464352	/* "NFCR" */
+#define EVRING_VERSION 1
+#define EVRING_SLOTS 1024
+#define EVRING_DATA_MAX 64
+
+enum {
+	EVRING_UNSPEC,
+	EVRING_TARGET_FOUND,
+	EVRING_TAG_READ,
+	EVRING_TAG_WRITE,
+};
+
+struct evring_event {
+	uint64_t time_ns;		/* CLOCK_REALTIME */
+	uint32_t type;
+	uint32_t dev_idx;
+	uint32_t tgt_idx;
+	uint32_t protocols;
+	int32_t status;			/* 0 or negative errno */
+	uint16_t len;
+	uint8_t data[EVRING_DATA_MAX];
+};
+
+struct evring_slot {
+	_Atomic uint64_t seq;		/* odd while being written */
+	struct evring_event ev;
+} __attribute__((aligned(64)));
+
+struct evring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+	_Atomic uint64_t head __attribute__((aligned(64)));
+};
+
+struct evring {
+	struct evring_hdr *hdr;
+	struct evring_slot *slots;
+	size_t map_size;
+};
+
+int evring_create(struct evring *r, const char *name, uint32_t nslots);
+int evring_open(struct evring *r, const char *name);
+void evring_close(struct evring *r);
+
+void evring_publish(struct evring *r, const struct evring_event *ev);
+
+uint64_t evring_head(const struct evring *r);
+int evring_consume(const struct evring *r, uint64_t *cursor,
+			struct evring_event *ev, uint64_t *lost);
+
+#endif /* _EVRING_H_ */
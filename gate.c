@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "taglist.h"
+#include "gate.h"
+#include "nfclog.h"
+
+#define GATE_TARGETS_MAX 32
+
+#define GATE_PROTOCOLS (NFC_PROTO_JEWEL_MASK | NFC_PROTO_MIFARE_MASK | \
+			NFC_PROTO_FELICA_MASK | NFC_PROTO_ISO14443_MASK | \
+			NFC_PROTO_NFC_DEP_MASK)
+
+struct gate {
+	struct nfcctl ctx;
+	struct taglist allow;
+	struct taglist deny;
+	int has_allow;
+	int has_deny;
+	uint32_t protocols;
+	struct nfcctl_arm_set arm;
+};
+
+static uint64_t elapsed_us(const struct timespec *since)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec - since->tv_sec) * 1000000ULL +
+				(ts.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/*
+ * A tag passes unless it is denied, or there is an allow list it is not
+ * on. Any doubt, such as a list which cannot be checked, keeps it out.
+ */
+static int gate_decide(struct gate *g, const uint8_t *uid, size_t len)
+{
+	int rc;
+
+	if (g->has_deny) {
+		rc = taglist_check(&g->deny, uid, len);
+		if (rc != TAGLIST_ABSENT)
+			return 0;
+	}
+
+	if (g->has_allow) {
+		rc = taglist_check(&g->allow, uid, len);
+		if (rc != TAGLIST_PRESENT)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Connect just long enough to read the UID, and decide */
+static void gate_target(struct gate *g, uint32_t dev_idx,
+			uint32_t tgt_idx, uint32_t protocols,
+			const struct timespec *found)
+{
+	uint8_t uid[TAG_UID_MAX];
+	struct nfc_session *sess;
+	int len = -1;
+	int pass = 0;
+	int i;
+
+	if (!tag_connect(&g->ctx, dev_idx, tgt_idx, protocols, &sess)) {
+		len = tag_uid(sess, uid, sizeof(uid));
+		nfcctl_target_deinit(sess);
+	}
+
+	if (len > 0)
+		pass = gate_decide(g, uid, len);
+
+	printf("%u\t%u\t", dev_idx, tgt_idx);
+	for (i = 0; i < len; i++)
+		printf("%02x", uid[i]);
+	if (len <= 0)
+		printf("-");
+	printf("\t%s\t%llu\n", pass ? "ACCEPT" : "REJECT",
+				(unsigned long long) elapsed_us(found));
+	fflush(stdout);
+}
+
+/* A list which cannot be reloaded keeps serving its previous contents */
+static void gate_refresh(struct taglist *list)
+{
+	int rc;
+
+	rc = taglist_refresh(list);
+	if (rc)
+		printerr("%s: %s", list->path, strerror(-rc));
+}
+
+static int gate_loop(struct gate *g)
+{
+	struct nfcctl *ctx = &g->ctx;
+	uint32_t idx[GATE_TARGETS_MAX];
+	uint32_t protocolsv[GATE_TARGETS_MAX];
+	struct nfc_target_batch batch = {
+		.max = GATE_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	struct timespec found;
+	unsigned i;
+	int rc;
+
+	for (;;) {
+		rc = nfcctl_sync_devices(ctx);
+		if (rc < 0)
+			return rc;
+
+		nfcctl_arm_pending(ctx, &g->arm, g->protocols);
+
+		rc = nfcctl_targets_found_batch(ctx, &batch);
+		if (rc == -ENOBUFS) {
+			/* Any reader may have stopped unnoticed */
+			for (i = 0; i < ctx->devs_count; i++)
+				nfcctl_arm_add(&g->arm, ctx->devs[i].idx);
+			continue;
+		}
+		if (rc)
+			return rc;
+
+		if (!batch.count)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &found);
+
+		/* Pick up lists rebuilt since the last tag */
+		if (g->has_allow)
+			gate_refresh(&g->allow);
+		if (g->has_deny)
+			gate_refresh(&g->deny);
+
+		for (i = 0; i < batch.count; i++)
+			gate_target(g, batch.dev_idx, batch.idx[i],
+				batch.protocols[i] & g->protocols, &found);
+
+		printdbg(ctx, "Filter false positives: allow %lu/%lu, "
+				"deny %lu/%lu", g->allow.false_hits,
+				g->allow.filter_hits, g->deny.false_hits,
+				g->deny.filter_hits);
+
+		nfcctl_arm_add(&g->arm, batch.dev_idx);
+	}
+}
+
+/*
+ * Decide on every tag presented, printing one line per tag: device,
+ * target, UID, ACCEPT or REJECT, and the microseconds since discovery.
+ */
+int gate_run(const struct gate_opts *opts)
+{
+	struct gate *g;
+	int rc;
+
+	g = calloc(1, sizeof(*g));
+	if (!g)
+		return -ENOMEM;
+
+	if (opts->protocol >= 0)
+		g->protocols = 1 << opts->protocol;
+	else
+		g->protocols = GATE_PROTOCOLS;
+
+	if (opts->allow_path) {
+		rc = taglist_open(&g->allow, opts->allow_path);
+		if (rc) {
+			printerr("%s: %s", opts->allow_path, strerror(-rc));
+			goto close_lists;
+		}
+		g->has_allow = 1;
+	}
+
+	if (opts->deny_path) {
+		rc = taglist_open(&g->deny, opts->deny_path);
+		if (rc) {
+			printerr("%s: %s", opts->deny_path, strerror(-rc));
+			goto close_lists;
+		}
+		g->has_deny = 1;
+	}
+
+	g->ctx.verbose = opts->verbose;
+	g->ctx.dev_handler = nfcctl_arm_handler;
+	g->ctx.dev_param = &g->arm;
+
+	rc = nfcctl_init(&g->ctx);
+	if (rc) {
+		printerr("%s", strerror(abs(rc)));
+		goto deinit;
+	}
+
+	rc = nfcctl_sync_devices(&g->ctx);
+	if (rc < 0) {
+		printerr("%s", strerror(-rc));
+		goto deinit;
+	}
+
+	rc = gate_loop(g);
+	if (rc)
+		printerr("%s", strerror(abs(rc)));
+
+deinit:
+	nfcctl_deinit(&g->ctx);
+close_lists:
+	taglist_close(&g->deny);
+	taglist_close(&g->allow);
+	free(g);
+	return rc;
+}
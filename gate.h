@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _GATE_H_
+#define _GATE_H_
+
+struct gate_opts {
+	const char *allow_path;	/* only these UIDs pass, or NULL for all */
+	const char *deny_path;	/* these UIDs never pass, or NULL */
+	int protocol;		/* NFC_PROTO_*, or -1 for all */
+	int verbose;
+};
+
+int gate_run(const struct gate_opts *opts);
+
+#endif /* _GATE_H_ */
@@ -44,6 +44,11 @@
  *	%NFC_ATTR_DEVICE_INDEX)
  * @NFC_EVENT_TARGETS_FOUND: event emitted when a new target is found
  *	(it sends %NFC_ATTR_DEVICE_INDEX and %NFC_ATTR_TARGETS)
+ * @NFC_EVENT_DEVICE_ADDED: event emitted when a new device is registred
+ *	(it sends %NFC_ATTR_DEVICE_NAME, %NFC_ATTR_DEVICE_INDEX and
+ *	%NFC_ATTR_PROTOCOLS)
+ * @NFC_EVENT_DEVICE_REMOVED: event emitted when a device is removed
+ *	(it sends %NFC_ATTR_DEVICE_INDEX)
  */
 enum nfc_commands {
 	NFC_CMD_UNSPEC,
@@ -51,6 +56,8 @@ enum nfc_commands {
 	NFC_CMD_START_POLL,
 	NFC_CMD_STOP_POLL,
 	NFC_EVENT_TARGETS_FOUND,
+	NFC_EVENT_DEVICE_ADDED,
+	NFC_EVENT_DEVICE_REMOVED,
 /* private: internal use only */
 	__NFC_CMD_AFTER_LAST
 };
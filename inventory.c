@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "scanlog.h"
+#include "tagdb.h"
+#include "inventory.h"
+#include "nfclog.h"
+
+#define INVENTORY_TARGETS_MAX 32
+
+#define INVENTORY_PROTOCOLS (NFC_PROTO_JEWEL_MASK | NFC_PROTO_MIFARE_MASK | \
+			NFC_PROTO_FELICA_MASK | NFC_PROTO_ISO14443_MASK | \
+			NFC_PROTO_NFC_DEP_MASK)
+
+/*
+ * Fill in what needs a connection: the UID, and the payload hash when
+ * asked for. A target no driver handles, or which fails, is still logged
+ * with whatever could be learned. Tags with a UID are also accounted for
+ * in db, if there is one.
+ */
+static void inspect_target(struct nfcctl *ctx,
+				const struct inventory_opts *opts,
+				struct tagdb *db, struct scanlog_rec *rec)
+{
+	static uint8_t buf[TAG_DATA_MAX];
+	struct nfc_session *sess;
+	int rc;
+
+	if (tag_connect(ctx, rec->dev_idx, rec->tgt_idx, rec->protocols,
+								&sess))
+		return;
+
+	rc = tag_uid(sess, rec->uid, SCANLOG_UID_MAX);
+	if (rc > 0)
+		rec->uid_len = rc;
+
+	if (opts->hash) {
+		rc = tag_read(sess, buf, sess->tag_size);
+		if (rc == sess->tag_size) {
+			rec->payload_len = rc;
+			rec->hash = scanlog_hash(buf, rc);
+			rec->flags |= SCANLOG_REC_HASH;
+		}
+	}
+
+	nfcctl_target_deinit(sess);
+
+	if (!db || !rec->uid_len)
+		return;
+
+	if (rec->flags & SCANLOG_REC_HASH)
+		rc = tagdb_seen(db, rec->uid, rec->uid_len, rec->dev_idx,
+					TAGDB_READ, buf, rec->payload_len);
+	else
+		rc = tagdb_seen(db, rec->uid, rec->uid_len, rec->dev_idx,
+					TAGDB_SEEN, NULL, 0);
+	if (rc)
+		printdbg(ctx, "Tag database: %s", strerror(-rc));
+}
+
+static int inventory_loop(struct nfcctl *ctx, struct nfcctl_arm_set *arm,
+				struct scanlog *log, struct tagdb *db,
+				const struct inventory_opts *opts,
+				uint32_t protocols)
+{
+	uint32_t idx[INVENTORY_TARGETS_MAX];
+	uint32_t protocolsv[INVENTORY_TARGETS_MAX];
+	struct nfc_target_batch batch = {
+		.max = INVENTORY_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	struct scanlog_rec rec;
+	struct timespec ts;
+	unsigned i;
+	int rc;
+
+	for (;;) {
+		rc = nfcctl_sync_devices(ctx);
+		if (rc < 0)
+			return rc;
+
+		nfcctl_arm_pending(ctx, arm, protocols);
+
+		rc = nfcctl_targets_found_batch(ctx, &batch);
+		if (rc == -ENOBUFS) {
+			/* Any reader may have stopped unnoticed */
+			for (i = 0; i < ctx->devs_count; i++)
+				nfcctl_arm_add(arm, ctx->devs[i].idx);
+			continue;
+		}
+		if (rc)
+			return rc;
+
+		if (!batch.count)
+			continue;
+
+		/* One timestamp for every target of the event */
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		for (i = 0; i < batch.count; i++) {
+			memset(&rec, 0, sizeof(rec));
+			rec.time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			rec.dev_idx = batch.dev_idx;
+			rec.tgt_idx = batch.idx[i];
+			rec.protocols = batch.protocols[i] & protocols;
+
+			inspect_target(ctx, opts, db, &rec);
+
+			rc = scanlog_append(log, &rec);
+			if (rc)
+				return rc;
+		}
+
+		printdbg(ctx, "%u targets on device %u", batch.count,
+							batch.dev_idx);
+
+		nfcctl_arm_add(arm, batch.dev_idx);
+	}
+}
+
+/*
+ * Scan for targets forever, appending one record per target to the scan
+ * log. Every record is complete in the shared mapping as soon as it is
+ * counted, so killing the scanner loses nothing already logged.
+ */
+int inventory_run(const struct inventory_opts *opts)
+{
+	struct nfcctl ctx;
+	struct nfcctl_arm_set arm;
+	struct scanlog log;
+	struct tagdb db;
+	uint32_t protocols;
+	int rc;
+
+	if (opts->protocol >= 0)
+		protocols = 1 << opts->protocol;
+	else
+		protocols = INVENTORY_PROTOCOLS;
+
+	rc = scanlog_create(&log, opts->path, opts->log_size);
+	if (rc) {
+		printerr("%s: %s", opts->path, strerror(-rc));
+		return rc;
+	}
+
+	memset(&db, 0, sizeof(db));
+	if (opts->tagdb_path) {
+		rc = tagdb_create(&db, opts->tagdb_path,
+						TAGDB_ENTRIES_DEFAULT);
+		if (rc) {
+			printerr("%s: %s", opts->tagdb_path, strerror(-rc));
+			scanlog_close(&log);
+			return rc;
+		}
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.verbose = opts->verbose;
+
+	/* Readers are armed as they show up, those present at once too */
+	arm.count = 0;
+	ctx.dev_handler = nfcctl_arm_handler;
+	ctx.dev_param = &arm;
+
+	rc = nfcctl_init(&ctx);
+	if (rc) {
+		printerr("%s", strerror(abs(rc)));
+		goto deinit;
+	}
+
+	rc = nfcctl_sync_devices(&ctx);
+	if (rc < 0) {
+		printerr("%s", strerror(-rc));
+		goto deinit;
+	}
+
+	rc = inventory_loop(&ctx, &arm, &log, opts->tagdb_path ? &db : NULL,
+							opts, protocols);
+	if (rc)
+		printerr("%s", strerror(abs(rc)));
+
+deinit:
+	nfcctl_deinit(&ctx);
+	tagdb_close(&db);
+	scanlog_close(&log);
+	return rc;
+}
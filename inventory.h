@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _INVENTORY_H_
+#define _INVENTORY_H_
+
+#include <stddef.h>
+
+struct inventory_opts {
+	const char *path;	/* scan log, see scanlog.h */
+	size_t log_size;	/* bytes per log file before rotating */
+	int protocol;		/* NFC_PROTO_*, or -1 for all */
+	int hash;		/* read every tag and hash its payload */
+	const char *tagdb_path;	/* tag database to update, or NULL */
+	int verbose;
+};
+
+int inventory_run(const struct inventory_opts *opts);
+
+#endif /* _INVENTORY_H_ */
@@ -26,24 +26,39 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <ctype.h>
-
-#include <gst/gst.h>
-#include <glib.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <poll.h>
 
 #include "nfcctl.h"
-#include "tag_mifare.h"
+#include "tag.h"
 #include "linux/nfc.h"
 #include "misc.h"
+#include "workers.h"
+#include "ctlsock.h"
+#include "server.h"
+#include "evring.h"
+#include "provision.h"
+#include "inventory.h"
+#include "gate.h"
+#include "scanlog.h"
+#include "polladapt.h"
+#include "tagdb.h"
 
 #define NFC_DEV_MAX 4
+#define NFC_TARGETS_MAX 32
+
+/* Events between two latency reports of adaptive polling */
+#define ADAPT_REPORT_EVENTS 32
 
-extern int verbose;
+static int verbose;
 
 #define printerr(s, ...)					\
 	fprintf(stderr, "%s:%d %s: " s "\n",  __FILE__,		\
-			__LINE__, __func__, ##__VA_ARGS__);	\
+			__LINE__, __func__, ##__VA_ARGS__)
 
 #define printdbg(s, ...)				\
 	do {						\
@@ -59,9 +74,21 @@ enum {
 	CMD_WRITE_TAG,
 	CMD_OTHER_WRITE_TAG,
 	CMD_RUN_TEST,
+	CMD_SERVER,
+	CMD_RING_EVENTS,
+	CMD_BENCH,
+	CMD_PROVISION,
+	CMD_INVENTORY,
+	CMD_GATE,
 };
 
-int cmd;
+static int cmd;
+static int multi_reader;
+static int adaptive;
+static int verify;
+
+/* With -D and -r, -w or -o: looked up for each tag connected */
+static struct tagdb tag_meta;
 
 const struct option lops[] = {
 	{ "verbose", no_argument, &verbose, 1 },
@@ -71,10 +98,33 @@ const struct option lops[] = {
 	{ "write-tag", required_argument, &cmd, CMD_WRITE_TAG },
 	{ "other-write-tag", required_argument, &cmd, CMD_OTHER_WRITE_TAG },
 	{ "protocol", required_argument, NULL, 'p' },
+	{ "multi-reader", no_argument, &multi_reader, 1 },
+	{ "adaptive", no_argument, &adaptive, 1 },
+	{ "verify", no_argument, &verify, 1 },
 	{ "run-test", no_argument, &cmd, CMD_RUN_TEST },
+	{ "server", required_argument, NULL, 'S' },
+	{ "connect", required_argument, NULL, 'c' },
+	{ "ring", required_argument, NULL, 'R' },
+	{ "schedule", required_argument, NULL, 'W' },
+	{ "read-ahead", required_argument, NULL, 'A' },
+	{ "ring-events", required_argument, NULL, 'E' },
+	{ "bench", required_argument, NULL, 'b' },
+	{ "provision", required_argument, NULL, 'P' },
+	{ "record-size", required_argument, NULL, 'F' },
+	{ "status-log", required_argument, NULL, 'L' },
+	{ "inventory", required_argument, NULL, 'I' },
+	{ "log-size", required_argument, NULL, 'Z' },
+	{ "hash", no_argument, NULL, 'H' },
+	{ "tag-db", required_argument, NULL, 'D' },
+	{ "allow", required_argument, NULL, 'G' },
+	{ "deny", required_argument, NULL, 'X' },
 	{ 0, 0, 0, 0 },
 };
 
+#ifndef AUDIO_MODULE_PATH
+#define AUDIO_MODULE_PATH "nfcex-audio.so"
+#endif
+
 const char *sound_files_path = "/home/pcacjr/vol0/devel/nfc-example/sounds/";
 const char *sound_file_suffix = ".mp3";
 
@@ -131,6 +181,9 @@ static int init_and_get_devices(struct nfcctl *ctx, struct nfc_dev *devl)
 	int devl_count;
 	int rc;
 
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->verbose = verbose;
+
 	rc = nfcctl_init(ctx);
 	if (rc) {
 		printdbg("%s", strerror(rc));
@@ -176,29 +229,7 @@ out:
 	return rc;
 }
 
-static int start_poll_all_devices(struct nfcctl *ctx, struct nfc_dev *devl,
-				uint32_t devl_count, uint32_t protocols)
-{
-	int i;
-	int rc;
-
-	for (i = 0; i < devl_count; i++) {
-		rc = nfcctl_start_poll(ctx, &devl[i], protocols);
-		if (rc) {
-			rc = nfcctl_stop_poll(ctx, &devl[i]);
-			if (rc)
-				return rc;
-
-			rc = nfcctl_start_poll(ctx, &devl[i], protocols);
-			if (rc)
-				return rc;
-		}
-	}
-	return 0;
-}
-
 struct print_target_hdl_data {
-	uint32_t dev_idx;
 	uint32_t tgt_count;
 };
 
@@ -208,7 +239,6 @@ static int print_target_handler(void *arg, uint32_t dev_idx,
 	struct print_target_hdl_data *params = arg;
 
 	if (params->tgt_count == 0) {
-		params->dev_idx = dev_idx;
 		printf("Found NFC target(s):\n"
 			"Device Index:\tTarget Index:\tSupported Protocols:\n");
 	}
@@ -219,23 +249,138 @@ static int print_target_handler(void *arg, uint32_t dev_idx,
 	return TARGET_FOUND_SKIP;
 }
 
+static void print_latency(const char *name, const struct poll_latency *lat)
+{
+	if (!lat->count) {
+		fprintf(stderr, "  %s:\tno poll\n", name);
+		return;
+	}
+
+	fprintf(stderr, "  %s:\t%lu polls, avg %.1f ms, max %.1f ms\n",
+			name, lat->count, lat->total_ns / 1e6 / lat->count,
+			lat->max_ns / 1e6);
+}
+
+/* Adaptive mask of one reader, found again by its index */
+struct list_dev {
+	uint32_t idx;
+	struct poll_adapt adapt;
+};
+
+static void print_adapt_report(const struct list_dev *devs,
+							uint8_t devs_count)
+{
+	unsigned i;
+
+	for (i = 0; i < devs_count; i++) {
+		fprintf(stderr, "Device %d: mask 0x%x, %lu narrow polls "
+				"widened after %d ms\n", devs[i].idx,
+				devs[i].adapt.mask, devs[i].adapt.expired,
+				POLL_ADAPT_WIDEN_MS);
+		print_latency("narrow", &devs[i].adapt.narrow);
+		print_latency("full", &devs[i].adapt.wide);
+	}
+
+	fprintf(stderr, "Full polls widened on time are sampled from the "
+			"widening, not from\ntheir narrow START_POLL.\n");
+}
+
+/* The entry of idx, added on first use; NULL once the table is full */
+static struct poll_adapt *list_adapt_get(struct list_dev *devs,
+					uint8_t *devs_count, uint32_t idx,
+					uint32_t protocols)
+{
+	unsigned i;
+
+	for (i = 0; i < *devs_count; i++) {
+		if (devs[i].idx == idx)
+			return &devs[i].adapt;
+	}
+
+	if (*devs_count == NFCCTL_DEVICES_MAX)
+		return NULL;
+
+	devs[i].idx = idx;
+	poll_adapt_init(&devs[i].adapt, protocols,
+				adaptive ? POLL_ADAPT_WIDEN_EVERY : 0);
+	(*devs_count)++;
+
+	return &devs[i].adapt;
+}
+
+/* Poll timeout until the next narrowed poll is due for widening */
+static int list_widen_timeout(struct list_dev *devs, uint8_t devs_count)
+{
+	int timeout = -1;
+	unsigned i;
+	int t;
+
+	for (i = 0; i < devs_count; i++) {
+		t = poll_adapt_timeout(&devs[i].adapt);
+		if (t >= 0 && (timeout < 0 || t < timeout))
+			timeout = t;
+	}
+
+	return timeout;
+}
+
+/*
+ * Restart with the full mask the narrowed polls which found nothing for
+ * POLL_ADAPT_WIDEN_MS, as a tag they miss would never end them.
+ */
+static void list_widen_expired(struct nfcctl *ctx, struct list_dev *devs,
+				uint8_t devs_count, struct nfcctl_arm_set *arm)
+{
+	struct nfc_dev *dev;
+	uint32_t mask;
+	unsigned i;
+
+	for (i = 0; i < devs_count; i++) {
+		if (poll_adapt_timeout(&devs[i].adapt))
+			continue;
+
+		mask = poll_adapt_expired(&devs[i].adapt);
+
+		dev = nfcctl_find_device(ctx, devs[i].idx);
+		if (!dev)
+			continue;
+
+		nfcctl_stop_poll(ctx, dev);
+		if (nfcctl_start_poll(ctx, dev, mask))
+			nfcctl_arm_add(arm, dev->idx);
+	}
+}
+
+/*
+ * Print targets as they are found, on the readers present at start and
+ * those plugged in later. Without -p, -a narrows the poll mask of every
+ * device to the protocols it actually sees (see polladapt.h) and reports
+ * the discovery latency of narrow and full polls.
+ */
 static int list_targets(int protocol)
 {
 	struct nfcctl ctx;
-	struct nfc_dev devl[NFC_DEV_MAX];
-	uint8_t devl_count;
-	uint32_t protocols;
+	struct nfcctl_arm_set arm;
+	struct list_dev devs[NFCCTL_DEVICES_MAX];
+	uint8_t devs_count = 0;
+	struct poll_adapt *pa;
+	uint32_t protocols, mask, found;
 	struct print_target_hdl_data params;
+	uint32_t idx[NFC_TARGETS_MAX];
+	uint32_t protocolsv[NFC_TARGETS_MAX];
+	struct nfc_target_batch batch = {
+		.max = NFC_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	struct nfc_target tgt;
+	struct nfc_dev *dev;
+	struct pollfd fds;
+	unsigned long events = 0;
+	unsigned i;
+	int timeout;
 	int rc;
 
-	rc = init_and_get_devices(&ctx, devl);
-	if (rc < 0)
-		goto error;
-
-	devl_count = rc;
-	if (!devl_count)
-		goto out;
-
 	if (protocol >= 0) {
 		protocols = 1 << protocol;
 	} else {
@@ -244,267 +389,585 @@ static int list_targets(int protocol)
 			NFC_PROTO_NFC_DEP_MASK;
 	}
 
-	rc = start_poll_all_devices(&ctx, devl, devl_count, protocols);
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.verbose = verbose;
+
+	/* Readers are armed as they show up, those present at once too */
+	arm.count = 0;
+	ctx.dev_handler = nfcctl_arm_handler;
+	ctx.dev_param = &arm;
+
+	rc = nfcctl_init(&ctx);
 	if (rc)
 		goto error;
 
 	params.tgt_count = 0;
 
 	for(;;) {
-		rc = nfcctl_targets_found(&ctx, print_target_handler, &params);
-		if (rc)
+		rc = nfcctl_sync_devices(&ctx);
+		if (rc < 0)
+			goto error;
+
+		/* New readers know nothing yet and poll the full mask */
+		for (i = 0; i < arm.count; i++) {
+			pa = list_adapt_get(devs, &devs_count, arm.idx[i],
+								protocols);
+			if (pa)
+				poll_adapt_widen(pa);
+		}
+
+		nfcctl_arm_pending(&ctx, &arm, protocols);
+
+		timeout = list_widen_timeout(devs, devs_count);
+		if (nfcctl_event_pending(&ctx))
+			timeout = 0;
+
+		fds.fd = nfcctl_get_fd(&ctx);
+		fds.events = POLLIN;
+
+		rc = poll(&fds, 1, timeout);
+		if (rc == -1 && errno != EINTR) {
+			rc = -errno;
 			goto error;
+		}
+		if (rc <= 0 && !nfcctl_event_pending(&ctx)) {
+			list_widen_expired(&ctx, devs, devs_count, &arm);
+			continue;
+		}
 
-		rc = nfcctl_start_poll(&ctx, &devl[params.dev_idx], protocols);
+		rc = nfcctl_targets_found_batch(&ctx, &batch);
+		if (rc == -ENOBUFS) {
+			/* Any reader may have stopped unnoticed */
+			for (i = 0; i < ctx.devs_count; i++)
+				nfcctl_arm_add(&arm, ctx.devs[i].idx);
+			continue;
+		}
 		if (rc)
 			goto error;
+
+		if (!batch.count)
+			continue;
+
+		found = 0;
+		for (i = 0; i < batch.count; i++)
+			found |= batch.protocols[i];
+
+		mask = protocols;
+		pa = list_adapt_get(devs, &devs_count, batch.dev_idx,
+								protocols);
+		if (pa) {
+			poll_adapt_found(pa, found);
+			mask = poll_adapt_mask(pa);
+		}
+
+		/* Discovery resumes on the reader before anything is printed */
+		dev = nfcctl_find_device(&ctx, batch.dev_idx);
+		if (dev && nfcctl_start_poll(&ctx, dev, mask))
+			nfcctl_arm_add(&arm, batch.dev_idx);
+
+		for (i = 0; i < batch.count; i++) {
+			tgt.idx = batch.idx[i];
+			tgt.protocols = batch.protocols[i];
+			print_target_handler(&params, batch.dev_idx, &tgt);
+		}
+		fflush(stdout);
+
+		if (adaptive && !(++events % ADAPT_REPORT_EVENTS))
+			print_adapt_report(devs, devs_count);
 	}
 
 error:
-	printerr("%s", strerror(rc));
-out:
+	printerr("%s", strerror(abs(rc)));
 	nfcctl_deinit(&ctx);
 	return rc;
 }
 
-struct save_target_hdl_data {
-	uint32_t desired_protocol;
-	uint32_t dev_idx;
-	uint32_t tgt_idx;
+enum {
+	TAG_OP_READ,
+	TAG_OP_WRITE,
 };
 
-static int save_target_handler(void *arg, uint32_t dev_idx,
-							struct nfc_target *tgt)
+/*
+ * Bring up ctx and wait until targets speaking protocol show up on any
+ * reader, see tag_discover(). Returns the number of sessions stored in
+ * sessv, 0 if there is no reader, or a negative errno. ctx must be
+ * released with nfcctl_deinit() in every case.
+ */
+static int session_open(struct nfcctl *ctx, uint32_t protocol,
+					struct nfc_session **sessv)
 {
-	struct save_target_hdl_data *params = arg;
+	struct nfc_dev devl[NFC_DEV_MAX];
+	int rc;
+
+	rc = init_and_get_devices(ctx, devl);
+	if (rc <= 0)
+		return rc;
+
+	return tag_discover(ctx, 1 << protocol, sessv);
+}
+
+/* Print what tag_meta knows about the tag of sess, if it is open */
+static void print_tag_meta(struct nfc_session *sess)
+{
+	uint8_t uid[TAG_UID_MAX];
+	struct tagdb_entry e;
+	int uid_len, i;
+
+	if (!tag_meta.hdr)
+		return;
+
+	uid_len = tag_uid(sess, uid, sizeof(uid));
+	if (uid_len <= 0)
+		return;
 
-	if (tgt->protocols & (1 << params->desired_protocol)) {
-		params->dev_idx = dev_idx;
-		params->tgt_idx = tgt->idx;
-		return TARGET_FOUND_STOP;
+	printf("Tag ");
+	for (i = 0; i < uid_len; i++)
+		printf("%02x", uid[i]);
+
+	if (tagdb_lookup(&tag_meta, uid, uid_len, &e)) {
+		printf(": unknown\n");
+		return;
 	}
 
-	return TARGET_FOUND_SKIP;
+	printf(": owner %.*s, %u reads, %u writes\n", TAGDB_OWNER_MAX,
+			e.owner[0] ? e.owner : "-", e.reads, e.writes);
+}
+
+/* tag_hold_xfer() with the errors spelled out */
+static int tag_session(struct tag_hold *h, uint32_t protocol, int op,
+						void *buf, size_t len)
+{
+	int rc;
+
+	h->verbose = verbose;
+
+	rc = tag_hold_xfer(h, protocol, op == TAG_OP_WRITE, buf, len);
+	if (rc == -ENOSYS)
+		printerr("Tag support for protocol (%d) not implemented\n",
+								protocol);
+	else if (rc < 0)
+		printerr("%s", strerror(-rc));
+	else if (!rc && len)
+		printf("Info: There isn't any attached NFC device\n");
+
+	return rc;
 }
 
-static int __read_tag(uint32_t protocol, void *buf, size_t len)
+/*
+ * Connect once and read the whole tag iterations times, reporting the
+ * transfer rate and the number of frames each full read takes.
+ */
+static int bench_tag(uint32_t protocol, unsigned iterations)
 {
 	struct nfcctl ctx;
-	struct nfc_dev devl[NFC_DEV_MAX];
-	uint8_t devl_count;
-	struct save_target_hdl_data params;
+	struct nfc_session *sessv[NFCCTL_SESSIONS_MAX];
+	struct nfc_session *sess;
+	uint8_t buf[TAG_DATA_MAX];
+	struct timespec start, end;
+	unsigned long frames;
+	double elapsed;
+	unsigned i;
 	int rc;
 
-	if (protocol != NFC_PROTO_MIFARE) {
-		printerr("Tag read support for protocol (%d) not"
-						" implemented\n", protocol);
+	if (!tag_driver_find(1 << protocol)) {
+		printerr("Tag support for protocol (%d) not implemented\n",
+								protocol);
 		return -ENOSYS;
 	}
 
-	if (len > TAG_MIFARE_MAX_SIZE + 1) {
-		printerr("Length > TAG_MIFARE_MAX_SIZE + 1\n");
-		return -EINVAL;
-	}
-
-	rc = init_and_get_devices(&ctx, devl);
+	rc = session_open(&ctx, protocol, sessv);
 	if (rc < 0)
 		goto error;
-
-	devl_count = rc;
-	if (!devl_count)
+	if (!rc)
 		goto out;
 
-	rc = start_poll_all_devices(&ctx, devl, devl_count, 1 << protocol);
-	if (rc)
-		goto error;
+	sess = sessv[0];
+	frames = ctx.tag_frames;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	params.desired_protocol = protocol;
+	for (i = 0; i < iterations; i++) {
+		rc = tag_read(sess, buf, sess->tag_size);
+		if (rc != sess->tag_size) {
+			rc = -errno;
+			goto error;
+		}
+	}
 
-	rc = nfcctl_targets_found(&ctx, save_target_handler, &params);
-	if (rc)
-		goto error;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	frames = ctx.tag_frames - frames;
 
-	rc = nfcctl_target_init(&ctx, params.dev_idx, params.tgt_idx, protocol);
-	if (rc)
-		goto error;
+	elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
 
-	rc = tag_mifare_read(ctx.target_fd, buf, len);
-	if (rc == -1) {
-		rc = errno;
-		goto error;
-	}
+	printf("Driver:\t\t%s\n"
+		"Tag size:\t%lu bytes\n"
+		"Reads:\t\t%u\n"
+		"Frames/read:\t%.1f\n"
+		"Time/read:\t%.3f ms\n"
+		"Throughput:\t%.0f bytes/s\n",
+		sess->tag_drv->name, sess->tag_size, iterations,
+		(double) frames / iterations, elapsed * 1e3 / iterations,
+		sess->tag_size * iterations / elapsed);
 
 	rc = 0;
 	goto out;
 
 error:
-	printerr("%s", strerror(rc));
+	printerr("%s", strerror(-rc));
 out:
 	nfcctl_deinit(&ctx);
 	return rc;
 }
 
+static int __read_tag(struct tag_hold *h, uint32_t protocol, void *buf,
+								size_t len)
+{
+	int rc;
+
+	rc = tag_session(h, protocol, TAG_OP_READ, buf, len);
+
+	return rc < 0 ? rc : 0;
+}
+
+/*
+ * Read every target found by the same event, with the transfers of all of
+ * them interleaved. A lone tag is printed as is, a stack one line per tag.
+ */
 static int read_tag(uint32_t protocol)
 {
 	struct nfcctl ctx;
-	struct nfc_dev devl[NFC_DEV_MAX];
-	uint8_t devl_count;
-	uint8_t buf[TAG_MIFARE_MAX_SIZE + 1];
-	struct save_target_hdl_data params;
+	struct nfc_session *sessv[NFCCTL_SESSIONS_MAX];
+	static uint8_t bufs[NFCCTL_SESSIONS_MAX][TAG_DATA_MAX + 1];
+	void *bufv[NFCCTL_SESSIONS_MAX];
+	size_t lenv[NFCCTL_SESSIONS_MAX];
+	int rcv[NFCCTL_SESSIONS_MAX];
+	int count, i;
 	int rc;
 
-	if (protocol != NFC_PROTO_MIFARE) {
-		printerr("Tag read support for protocol (%d) not"
-						" implemented\n", protocol);
+	if (!tag_driver_find(1 << protocol)) {
+		printerr("Tag support for protocol (%d) not implemented\n",
+								protocol);
 		return -ENOSYS;
 	}
 
-	rc = init_and_get_devices(&ctx, devl);
+	rc = session_open(&ctx, protocol, sessv);
 	if (rc < 0)
 		goto error;
-
-	devl_count = rc;
-	if (!devl_count)
+	if (!rc)
 		goto out;
 
-	rc = start_poll_all_devices(&ctx, devl, devl_count, 1 << protocol);
-	if (rc)
-		goto error;
+	count = rc;
 
-	params.desired_protocol = protocol;
+	for (i = 0; i < count; i++) {
+		print_tag_meta(sessv[i]);
+		bufv[i] = bufs[i];
+		lenv[i] = sessv[i]->tag_size;
+	}
 
-	rc = nfcctl_targets_found(&ctx, save_target_handler, &params);
-	if (rc)
-		goto error;
+	tag_read_sessions(sessv, count, bufv, lenv, rcv);
 
-	rc = nfcctl_target_init(&ctx, params.dev_idx, params.tgt_idx, protocol);
-	if (rc)
-		goto error;
+	rc = 0;
 
-	rc = tag_mifare_read(ctx.target_fd, buf, TAG_MIFARE_MAX_SIZE);
-	if (rc == -1) {
-		rc = errno;
-		goto error;
-	}
+	for (i = 0; i < count; i++) {
+		if (rcv[i] < 0) {
+			rc = rcv[i];
+			printerr("Target %d: %s", sessv[i]->tgt_idx,
+							strerror(-rc));
+			continue;
+		}
 
-	buf[TAG_MIFARE_MAX_SIZE] = '\0';
+		bufs[i][rcv[i]] = '\0';
 
-	printf("%s\n", (char *) buf);
+		if (count == 1)
+			printf("%s\n", (char *) bufs[i]);
+		else
+			printf("%d\t%d\t%s\n", sessv[i]->dev_idx,
+					sessv[i]->tgt_idx, (char *) bufs[i]);
+	}
 
-	rc = 0;
 	goto out;
 
 error:
-	printerr("%s", strerror(rc));
+	printerr("%s", strerror(-rc));
 out:
 	nfcctl_deinit(&ctx);
 	return rc;
 }
 
-static int __write_tag(uint32_t protocol, const void *buf, size_t len)
+/* With readback, check the data on the tags while still connected */
+static int write_tag(uint32_t protocol, const void *buf, size_t len,
+								int readback)
 {
-	struct nfcctl ctx;
-	struct nfc_dev devl[NFC_DEV_MAX];
-	uint8_t devl_count;
-	struct save_target_hdl_data params;
+	struct tag_hold h = { .count = 0 };
+	uint8_t check[TAG_DATA_MAX];
+	int i;
 	int rc;
 
-	if (protocol != NFC_PROTO_MIFARE) {
-		printerr("Tag write support for protocol (%d) not"
-						" implemented\n", protocol);
-		return -ENOSYS;
-	}
+	rc = tag_session(&h, protocol, TAG_OP_WRITE, (void *) buf, len);
+	if (rc <= 0)
+		goto out;
 
-	rc = init_and_get_devices(&ctx, devl);
-	if (rc < 0)
-		goto error;
+	for (i = 0; i < h.count; i++)
+		print_tag_meta(h.sessv[i]);
 
-	devl_count = rc;
-	if (!devl_count)
+	if (!readback)
 		goto out;
 
-	rc = start_poll_all_devices(&ctx, devl, devl_count, 1 << protocol);
-	if (rc)
-		goto error;
+	for (i = 0; i < h.count; i++) {
+		rc = tag_read(h.sessv[i], check, len);
+		if (rc != len || memcmp(check, buf, len)) {
+			printerr("Target %d: verification failed",
+							h.sessv[i]->tgt_idx);
+			rc = -EIO;
+			goto out;
+		}
+	}
 
-	params.desired_protocol = protocol;
+	printf("%d tag(s) written and verified\n", h.count);
 
-	rc = nfcctl_targets_found(&ctx, save_target_handler, &params);
-	if (rc)
-		goto error;
+out:
+	tag_hold_release(&h);
+	return rc < 0 ? rc : 0;
+}
+
+static int read_tag_op(void *arg, struct nfc_session *sess, uint32_t dev_idx,
+						const struct nfc_target *tgt)
+{
+	uint8_t buf[TAG_DATA_MAX + 1];
+	int rc;
+
+	rc = tag_read(sess, buf, sess->tag_size);
+	if (rc == -1)
+		return -errno;
 
-	rc = nfcctl_target_init(&ctx, params.dev_idx, params.tgt_idx, protocol);
+	buf[rc] = '\0';
+
+	printf("%d\t%d\t%s\n", dev_idx, tgt->idx, (char *) buf);
+	fflush(stdout);
+
+	return 0;
+}
+
+struct write_tag_op_data {
+	const void *buf;
+	size_t len;
+};
+
+static int write_tag_op(void *arg, struct nfc_session *sess, uint32_t dev_idx,
+						const struct nfc_target *tgt)
+{
+	struct write_tag_op_data *params = arg;
+	int rc;
+
+	rc = tag_write(sess, params->buf, params->len);
+	if (rc != params->len)
+		return -errno;
+
+	printf("%d\t%d\twritten\n", dev_idx, tgt->idx);
+	fflush(stdout);
+
+	return 0;
+}
+
+/* Serve tags on every attached reader, one worker thread per reader */
+/* Serve every reader, including those plugged in while running */
+static int run_workers(uint32_t protocol, worker_op_t op, void *op_param)
+{
+	struct nfcctl ctx;
+	int rc;
+
+	if (!tag_driver_find(1 << protocol)) {
+		printerr("Tag support for protocol (%d) not implemented\n",
+								protocol);
+		return -ENOSYS;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.verbose = verbose;
+
+	rc = nfcctl_init(&ctx);
 	if (rc)
 		goto error;
 
-	rc = tag_mifare_write(ctx.target_fd, buf, len + 5);
-	if (rc != len) {
-		rc = errno;
+	rc = nfc_workers_run(&ctx, protocol, op, op_param);
+	if (rc)
 		goto error;
-	}
 
-	rc = 0;
 	goto out;
 
 error:
-	printerr("%s", strerror(rc));
+	printerr("%s", strerror(abs(rc)));
 out:
 	nfcctl_deinit(&ctx);
 	return rc;
 }
 
-static int write_tag(uint32_t protocol, char *string, size_t lenght)
+/* Client side of the control socket, see server.c */
+static int client_list_devices(int fd)
 {
-	struct nfcctl ctx;
+	struct ctl_dev cdevl[NFC_DEV_MAX];
 	struct nfc_dev devl[NFC_DEV_MAX];
-	uint8_t devl_count;
-	struct save_target_hdl_data params;
+	unsigned i, devl_count;
 	int rc;
 
-	if (protocol != NFC_PROTO_MIFARE) {
-		printerr("Tag write support for protocol (%d) not"
-						" implemented\n", protocol);
-		return -ENOSYS;
+	rc = ctl_request(fd, CTL_OP_LIST, 0, NULL, 0, cdevl, sizeof(cdevl));
+	if (rc < 0)
+		return rc;
+
+	devl_count = rc / sizeof(struct ctl_dev);
+	if (!devl_count) {
+		printf("Info: There isn't any attached NFC device\n");
+		return 0;
 	}
 
-	rc = init_and_get_devices(&ctx, devl);
+	for (i = 0; i < devl_count; i++) {
+		devl[i].idx = cdevl[i].idx;
+		memcpy(devl[i].name, cdevl[i].name, sizeof(devl[i].name));
+		devl[i].name[NFCCTL_DEV_NAME_MAX] = '\0';
+		devl[i].protocols = cdevl[i].protocols;
+	}
+
+	print_devices(devl, devl_count);
+
+	return 0;
+}
+
+static int client_list_targets(int fd)
+{
+	struct print_target_hdl_data params;
+	struct ctl_target_event ev;
+	struct nfc_target tgt;
+	struct ctl_hdr hdr;
+	int rc;
+
+	rc = ctl_request(fd, CTL_OP_SUBSCRIBE, 0, NULL, 0, NULL, 0);
 	if (rc < 0)
-		goto error;
+		return rc;
 
-	devl_count = rc;
-	if (!devl_count)
-		goto out;
+	params.tgt_count = 0;
 
-	rc = start_poll_all_devices(&ctx, devl, devl_count, 1 << protocol);
-	if (rc)
-		goto error;
+	for (;;) {
+		rc = ctl_recv(fd, &hdr, &ev, sizeof(ev));
+		if (rc < 0)
+			return rc;
 
-	params.desired_protocol = protocol;
+		if (hdr.op == CTL_OP_UNSPEC)
+			return -ECONNRESET;
 
-	rc = nfcctl_targets_found(&ctx, save_target_handler, &params);
-	if (rc)
-		goto error;
+		if (hdr.op != CTL_OP_EVENT || rc != sizeof(ev))
+			continue;
 
-	rc = nfcctl_target_init(&ctx, params.dev_idx, params.tgt_idx, protocol);
-	if (rc)
-		goto error;
+		tgt.idx = ev.tgt_idx;
+		tgt.protocols = ev.protocols;
 
-	rc = tag_mifare_write(ctx.target_fd, string, lenght);
-	if (rc != lenght) {
-		rc = errno;
-		goto error;
+		print_target_handler(&params, ev.dev_idx, &tgt);
+		fflush(stdout);
 	}
+}
 
-	rc = 0;
-	goto out;
+static int run_client(const char *path, int cmd, uint32_t protocol,
+					const void *buf, size_t len)
+{
+	uint8_t rbuf[TAG_DATA_MAX + 1];
+	int fd;
+	int rc;
 
-error:
-	printerr("%s", strerror(rc));
-out:
-	nfcctl_deinit(&ctx);
+	fd = ctl_connect(path);
+	if (fd < 0) {
+		printerr("%s: %s", path, strerror(-fd));
+		return fd;
+	}
+
+	switch (cmd) {
+	case CMD_LIST_DEVICES:
+		rc = client_list_devices(fd);
+		break;
+	case CMD_LIST_TARGETS:
+		rc = client_list_targets(fd);
+		break;
+	case CMD_READ_TAG:
+		rc = ctl_request(fd, CTL_OP_READ, protocol, NULL, 0, rbuf,
+							TAG_DATA_MAX);
+		if (rc < 0)
+			break;
+
+		rbuf[rc] = '\0';
+		printf("%s\n", (char *) rbuf);
+		rc = 0;
+		break;
+	case CMD_WRITE_TAG:
+	case CMD_OTHER_WRITE_TAG:
+		rc = ctl_request(fd, CTL_OP_WRITE, protocol, buf, len, NULL, 0);
+		break;
+	default:
+		rc = -EOPNOTSUPP;
+	}
+
+	if (rc < 0)
+		printerr("%s", strerror(-rc));
+
+	close(fd);
 	return rc;
 }
 
+/*
+ * Follow the server's shared-memory event ring. Reading the ring costs no
+ * syscall, so an idle consumer just naps between checks.
+ */
+static int ring_events(const char *name)
+{
+	static const char *types[] = {
+		[EVRING_TARGET_FOUND] = "found",
+		[EVRING_TAG_READ] = "read",
+		[EVRING_TAG_WRITE] = "write",
+	};
+	struct evring ring;
+	struct evring_event ev;
+	uint64_t cursor, lost = 0, lost_seen = 0;
+	unsigned i;
+	int rc;
+
+	rc = evring_open(&ring, name);
+	if (rc) {
+		printerr("%s: %s", name, strerror(-rc));
+		return rc;
+	}
+
+	cursor = evring_head(&ring);
+
+	printf("Time:\t\t\tEvent:\tDevice:\tTarget:\tProtocols:\t"
+						"Status:\tData:\n");
+
+	for (;;) {
+		rc = evring_consume(&ring, &cursor, &ev, &lost);
+		if (rc == -EAGAIN) {
+			fflush(stdout);
+			usleep(1000);
+			continue;
+		}
+
+		if (lost != lost_seen) {
+			printf("Info: %llu events lost\n",
+				(unsigned long long) (lost - lost_seen));
+			lost_seen = lost;
+		}
+
+		printf("%llu.%09llu\t%s\t%d\t%d\t0x%x\t\t%d\t",
+			(unsigned long long) ev.time_ns / 1000000000ULL,
+			(unsigned long long) ev.time_ns % 1000000000ULL,
+			ev.type < sizeof(types) / sizeof(types[0]) &&
+				types[ev.type] ? types[ev.type] : "?",
+			ev.dev_idx, ev.tgt_idx, ev.protocols, ev.status);
+
+		for (i = 0; i < ev.len; i++)
+			printf("%02x", ev.data[i]);
+		printf("\n");
+	}
+
+	evring_close(&ring);
+	return 0;
+}
+
 /* Return the sound file name */
 const char *get_sound_file(uint16_t flags)
 {
@@ -545,17 +1008,67 @@ const char *get_sound_file(uint16_t flags)
 	return file;
 }
 
+struct audio_module {
+	void *handle;
+	misc_init_t init;
+	misc_play_sound_file_t play_sound_file;
+};
+
+/*
+ * Load the audio module and initialize GStreamer. The module is only needed
+ * by run-test, so the other commands never pay for GStreamer's load time.
+ * NFCEX_AUDIO_MODULE may be set to override the built-in module path.
+ */
+static int load_audio_module(struct audio_module *mod, int *argc, char ***argv)
+{
+	const char *path;
+	int rc;
+
+	path = getenv("NFCEX_AUDIO_MODULE");
+	if (!path)
+		path = AUDIO_MODULE_PATH;
+
+	mod->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!mod->handle) {
+		printerr("%s", dlerror());
+		return -ENOENT;
+	}
+
+	mod->init = (misc_init_t) dlsym(mod->handle, MISC_INIT_SYM);
+	mod->play_sound_file = (misc_play_sound_file_t) dlsym(mod->handle,
+						MISC_PLAY_SOUND_FILE_SYM);
+	if (!mod->init || !mod->play_sound_file) {
+		printerr("%s", dlerror());
+		rc = -ENOENT;
+		goto close_handle;
+	}
+
+	rc = mod->init(argc, argv, verbose);
+	if (rc)
+		goto close_handle;
+
+	return 0;
+
+close_handle:
+	dlclose(mod->handle);
+	mod->handle = NULL;
+	return rc;
+}
+
 static int run_test(uint32_t protocol, int *argc, char ***argv)
 {
+	struct audio_module mod = { .handle = NULL };
+	struct tag_hold h = { .count = 0 };
 	int err;
 	const char *s;
 	uint16_t flags;
 
-	/* Initialize GStreamer */
-	gst_init(argc, argv);
+	err = load_audio_module(&mod, argc, argv);
+	if (err)
+		goto out;
 
 	for (;;) {
-		err = __read_tag(protocol, &flags, sizeof(flags));
+		err = __read_tag(&h, protocol, &flags, sizeof(flags));
 		if (err)
 			goto out;
 
@@ -563,13 +1076,13 @@ static int run_test(uint32_t protocol, int *argc, char ***argv)
 
 		s = get_sound_file(flags);
 		if (!s) {
-			err = -1;
+			err = -ENOENT;
 			goto out;
 		}
 
 		printdbg("Found sound file: %s", s);
 
-		err = misc_play_sound_file(sound_files_path, s,
+		err = mod.play_sound_file(sound_files_path, s,
 						sound_file_suffix);
 		if (err)
 			goto out;
@@ -578,23 +1091,86 @@ static int run_test(uint32_t protocol, int *argc, char ***argv)
 	return 0;
 
 out:
-	printerr("%s", strerror(err));
+	tag_hold_release(&h);
+	if (mod.handle)
+		dlclose(mod.handle);
+	printerr("%s", strerror(-err));
 	return err;
 }
 
+static const char *protocol_names[NFC_PROTO_MAX] = {
+	[NFC_PROTO_JEWEL] = "jewel",
+	[NFC_PROTO_MIFARE] = "mifare",
+	[NFC_PROTO_FELICA] = "felica",
+	[NFC_PROTO_ISO14443] = "iso14443",
+	[NFC_PROTO_NFC_DEP] = "nfc-dep",
+};
+
+static int parse_protocol(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NFC_PROTO_MAX; i++) {
+		if (!strcasecmp(name, protocol_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
 static void usage(const char *prog)
 {
-	printf("Usage: %s  [-v] [-p PROT] (-d|-t|-r|-w STR|-o STREAM|-s)\n"
+	printf("Usage: %s  [-v] [-m] [-a] [-V] [-c SOCK] [-p PROT] "
+		"(-d|-t|-r|-w STR|-o STREAM|-s|-b N|"
+		"-S SOCK [-R RING] [-W SCHED] [-A N]|-E RING|"
+		"-P FILE [-F N] [-L LOG]|-I LOG [-Z MB] [-H] [-D DB]|"
+		"[-G LIST] [-X LIST])\n"
 		"Option:\t\t\t\tDescription:\n"
 		"-v, --verbose\t\t\tEnable verbosity\n"
 		"-p, --protocol\t\t\tRestrict to PROT protocol\n"
-		"\t\t\t\tPROT = {mifare}\n"
+		"\t\t\t\tPROT = {jewel|mifare|felica|iso14443|"
+		"nfc-dep}\n"
+		"-m, --multi-reader\t\tKeep serving -r/-w on all readers,\n"
+		"\t\t\t\tone thread per reader\n"
+		"-a, --adaptive\t\t\tWith -t, poll only for the protocols\n"
+		"\t\t\t\tseen, widening polls which find nothing,\n"
+		"\t\t\t\tand report discovery latency\n"
 		"-d, --list-devices\t\tList all attached NFC devices\n"
 		"-t, --list-targets\t\tList all found NFC targets\n"
 		"-r, --read-tag\t\t\tRead tag\n"
 		"-w, --write-tag\t\t\tWrite STR to tag\n"
 		"-o, --other-write-tag\t\tWrite byte stream to tag\n"
-		"-s, --run-test\t\t\tRun test\n\n",
+		"-V, --verify\t\t\tWith -w/-o, read the tag back over the\n"
+		"\t\t\t\tsame connection\n"
+		"-s, --run-test\t\t\tRun test\n"
+		"-b, --bench\t\t\tRead a whole tag N times and report\n"
+		"\t\t\t\tthroughput\n"
+		"-S, --server\t\t\tServe requests on control socket SOCK\n"
+		"-R, --ring\t\t\tPublish server events to shared-memory\n"
+		"\t\t\t\tring RING (e.g. /nfcex)\n"
+		"-W, --schedule\t\t\tWith -S, poll only within the windows\n"
+		"\t\t\t\tSCHED = HH:MM-HH:MM[,HH:MM-HH:MM...]\n"
+		"-A, --read-ahead\t\tWith -S, read every new tag of up to N\n"
+		"\t\t\t\tbytes (0 for all) before it is asked for\n"
+		"-E, --ring-events\t\tPrint events published to RING\n"
+		"-P, --provision\t\t\tWrite one payload record of FILE\n"
+		"\t\t\t\t(- for stdin) to each tag presented\n"
+		"-F, --record-size\t\tRecords are N bytes, instead of\n"
+		"\t\t\t\tprefixed by a 16-bit big-endian length\n"
+		"-L, --status-log\t\tAppend one status line per tag to LOG\n"
+		"-I, --inventory\t\t\tScan continuously, appending a record\n"
+		"\t\t\t\tper target to the binary log LOG\n"
+		"-Z, --log-size\t\t\tRotate LOG every MB megabytes\n"
+		"-H, --hash\t\t\tRead every tag and log a payload hash\n"
+		"-D, --tag-db\t\t\tWith -I, keep the metadata of every tag\n"
+		"\t\t\t\tin the database DB, see nfctagdb; with\n"
+		"\t\t\t\t-r, -w or -o, print what DB knows of\n"
+		"\t\t\t\teach tag connected\n"
+		"-G, --allow\t\t\tLet only the tags on LIST through\n"
+		"-X, --deny\t\t\tKeep the tags on LIST out; with -G or\n"
+		"\t\t\t\t-X, decide on every tag, see nfctaglist\n"
+		"-c, --connect\t\t\tSend -d/-t/-r/-w/-o to the server\n"
+		"\t\t\t\tlistening on SOCK\n\n",
 		prog);
 
 	exit(EXIT_FAILURE);
@@ -605,12 +1181,27 @@ int main(int argc, char **argv)
 	int opt, op_idx;
 	int rc;
 	int protocol;
-	size_t write_str_max = TAG_MIFARE_MAX_SIZE;
+	size_t write_str_max = TAG_DATA_MAX;
 	char write_str[write_str_max];
 	size_t write_str_len;
 	uint8_t *buffer = NULL;
 	size_t len;
 	uint64_t val;
+	const char *sock_path = NULL;
+	const char *connect_path = NULL;
+	const char *ring_name = NULL;
+	const char *schedule = NULL;
+	int readahead = -1;
+	unsigned bench_iterations = 0;
+	const char *provision_input = NULL;
+	const char *status_log = NULL;
+	size_t record_size = 0;
+	const char *inventory_path = NULL;
+	size_t log_size = SCANLOG_SIZE_DEFAULT;
+	int hash = 0;
+	const char *tagdb_path = NULL;
+	const char *allow_path = NULL;
+	const char *deny_path = NULL;
 
 	if (argc == 1)
 		usage(*argv);
@@ -618,9 +1209,13 @@ int main(int argc, char **argv)
 	cmd = CMD_UNSPEC;
 	op_idx = 0;
 	protocol = -1;
+	write_str_len = 0;
+	len = 0;
 
 	for (;;) {
-		opt = getopt_long(argc, argv, "vdtsrw:p:o:", lops, &op_idx);
+		opt = getopt_long(argc, argv,
+				"vmaVdtsrw:p:o:S:c:R:W:A:E:b:P:F:L:I:Z:HD:G:X:",
+					lops, &op_idx);
 		if (opt < 0)
 			break;
 
@@ -628,6 +1223,15 @@ int main(int argc, char **argv)
 		case 'v':
 			verbose = 1;
 			break;
+		case 'm':
+			multi_reader = 1;
+			break;
+		case 'V':
+			verify = 1;
+			break;
+		case 'a':
+			adaptive = 1;
+			break;
 		case 'd':
 			cmd = CMD_LIST_DEVICES;
 			break;
@@ -668,9 +1272,8 @@ int main(int argc, char **argv)
 
 			break;
 		case 'p':
-			if (!strcasecmp(optarg, "mifare")) {
-				protocol = NFC_PROTO_MIFARE;
-			} else {
+			protocol = parse_protocol(optarg);
+			if (protocol < 0) {
 				printerr("%s is not a valid argument to -p\n",
 									optarg);
 				usage(*argv);
@@ -679,6 +1282,71 @@ int main(int argc, char **argv)
 		case 's':
 			cmd = CMD_RUN_TEST;
 			break;
+		case 'S':
+			cmd = CMD_SERVER;
+			sock_path = optarg;
+			break;
+		case 'c':
+			connect_path = optarg;
+			break;
+		case 'R':
+			ring_name = optarg;
+			break;
+		case 'W':
+			schedule = optarg;
+			break;
+		case 'A':
+			readahead = atoi(optarg);
+			if (readahead < 0)
+				usage(*argv);
+			if (!readahead || readahead > TAG_DATA_MAX)
+				readahead = TAG_DATA_MAX;
+			break;
+		case 'E':
+			cmd = CMD_RING_EVENTS;
+			ring_name = optarg;
+			break;
+		case 'b':
+			cmd = CMD_BENCH;
+			bench_iterations = atoi(optarg);
+			if (!bench_iterations)
+				usage(*argv);
+			break;
+		case 'P':
+			cmd = CMD_PROVISION;
+			provision_input = optarg;
+			break;
+		case 'F':
+			record_size = atoi(optarg);
+			if (!record_size || record_size > TAG_DATA_MAX)
+				usage(*argv);
+			break;
+		case 'L':
+			status_log = optarg;
+			break;
+		case 'I':
+			cmd = CMD_INVENTORY;
+			inventory_path = optarg;
+			break;
+		case 'Z':
+			log_size = (size_t) atoi(optarg) << 20;
+			if (!log_size)
+				usage(*argv);
+			break;
+		case 'H':
+			hash = 1;
+			break;
+		case 'D':
+			tagdb_path = optarg;
+			break;
+		case 'G':
+			cmd = CMD_GATE;
+			allow_path = optarg;
+			break;
+		case 'X':
+			cmd = CMD_GATE;
+			deny_path = optarg;
+			break;
 		case 0:
 			break;
 		default:
@@ -689,6 +1357,32 @@ int main(int argc, char **argv)
 	if (cmd == CMD_UNSPEC)
 		usage(*argv);
 
+	if (connect_path) {
+		if ((cmd == CMD_READ_TAG || cmd == CMD_WRITE_TAG ||
+			cmd == CMD_OTHER_WRITE_TAG) && protocol == -1) {
+			printerr("command requires protocol choice");
+			usage(*argv);
+		}
+
+		if (cmd == CMD_OTHER_WRITE_TAG)
+			rc = run_client(connect_path, cmd, protocol, buffer,
+									len);
+		else
+			rc = run_client(connect_path, cmd, protocol, write_str,
+							write_str_len);
+
+		return rc < 0 ? -rc : rc;
+	}
+
+	if (tagdb_path && (cmd == CMD_READ_TAG || cmd == CMD_WRITE_TAG ||
+					cmd == CMD_OTHER_WRITE_TAG)) {
+		rc = tagdb_open(&tag_meta, tagdb_path);
+		if (rc) {
+			printerr("%s: %s", tagdb_path, strerror(-rc));
+			return -rc;
+		}
+	}
+
 	switch (cmd) {
 	case CMD_LIST_DEVICES:
 		rc = list_devices();
@@ -701,14 +1395,27 @@ int main(int argc, char **argv)
 			printerr("-r command requires protocol choice");
 			usage(*argv);
 		}
-		rc = read_tag(protocol);
+		if (multi_reader)
+			rc = run_workers(protocol, read_tag_op, NULL);
+		else
+			rc = read_tag(protocol);
 		break;
 	case CMD_WRITE_TAG:
 		if (protocol == -1) {
 			printerr("-w command requires protocol choice");
 			usage(*argv);
 		}
-		rc = write_tag(protocol, write_str, write_str_len);
+		if (multi_reader) {
+			struct write_tag_op_data params = {
+				.buf = write_str,
+				.len = write_str_len,
+			};
+
+			rc = run_workers(protocol, write_tag_op, &params);
+		} else {
+			rc = write_tag(protocol, write_str, write_str_len,
+								verify);
+		}
 		break;
 	case CMD_OTHER_WRITE_TAG:
 		if (!len) {
@@ -721,7 +1428,7 @@ int main(int argc, char **argv)
 			usage(*argv);
 		}
 
-		rc = __write_tag(protocol, buffer, len);
+		rc = write_tag(protocol, buffer, len, verify);
 		break;
 	case CMD_RUN_TEST:
 		if (protocol == -1) {
@@ -731,9 +1438,75 @@ int main(int argc, char **argv)
 
 		rc = run_test(protocol, &argc, &argv);
 		break;
+	case CMD_SERVER: {
+		struct server_opts opts = {
+			.path = sock_path,
+			.ring_name = ring_name,
+			.schedule = schedule,
+			.readahead = readahead < 0 ? 0 : readahead,
+			.verbose = verbose,
+		};
+
+		rc = server_run(&opts);
+		break;
+	}
+	case CMD_RING_EVENTS:
+		rc = ring_events(ring_name);
+		break;
+	case CMD_BENCH:
+		if (protocol == -1) {
+			printerr("-b command requires protocol choice");
+			usage(*argv);
+		}
+
+		rc = bench_tag(protocol, bench_iterations);
+		break;
+	case CMD_PROVISION: {
+		struct provision_opts opts = {
+			.input = provision_input,
+			.record_size = record_size,
+			.log_path = status_log,
+			.verbose = verbose,
+		};
+
+		if (protocol == -1) {
+			printerr("-P command requires protocol choice");
+			usage(*argv);
+		}
+
+		opts.protocol = protocol;
+		rc = provision_run(&opts);
+		break;
+	}
+	case CMD_INVENTORY: {
+		struct inventory_opts opts = {
+			.path = inventory_path,
+			.log_size = log_size,
+			.protocol = protocol,
+			.hash = hash,
+			.tagdb_path = tagdb_path,
+			.verbose = verbose,
+		};
+
+		rc = inventory_run(&opts);
+		break;
+	}
+	case CMD_GATE: {
+		struct gate_opts opts = {
+			.allow_path = allow_path,
+			.deny_path = deny_path,
+			.protocol = protocol,
+			.verbose = verbose,
+		};
+
+		rc = gate_run(&opts);
+		break;
+	}
 	default:
 		usage(*argv);
 	}
 
+	tagdb_close(&tag_meta);
+
 	return rc < 0 ? -rc : rc;
 }
@@ -21,18 +21,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include <gst/gst.h>
 #include <glib.h>
 
 #include "misc.h"
 
-extern int verbose;
+static int verbose;
 
-static GMainLoop *loop;
+/* Initialize GStreamer. Called once, right after the module is loaded */
+int misc_init(int *argc, char ***argv, int _verbose)
+{
+	verbose = _verbose;
+
+	gst_init(argc, argv);
+
+	return 0;
+}
 
 static gboolean bus_call(GstBus *bus, GstMessage *msg, void *data)
 {
+	GMainLoop *loop = data;
+
 	switch (GST_MESSAGE_TYPE(msg)) {
 	case GST_MESSAGE_EOS:
 		g_message("End of stream");
@@ -62,6 +73,7 @@ int misc_play_sound_file(const char *path, const char *file, const char *suffix)
 	size_t len;
 	GstBus *bus;
 	GstElement *pipeline;
+	GMainLoop *loop;
 	char *uri = NULL;
 
 	/* Set up the pipeline */
@@ -102,7 +114,7 @@ int misc_play_sound_file(const char *path, const char *file, const char *suffix)
 	g_object_set(G_OBJECT(pipeline), "uri", uri, NULL);
 
 	bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-	gst_bus_add_watch(bus, bus_call, NULL);
+	gst_bus_add_watch(bus, bus_call, loop);
 	gst_object_unref(bus);
 
 	gst_element_set_state(GST_ELEMENT(pipeline), GST_STATE_PLAYING);
@@ -113,5 +125,7 @@ int misc_play_sound_file(const char *path, const char *file, const char *suffix)
 
 	gst_object_unref(GST_OBJECT(pipeline));
 
+	g_main_loop_unref(loop);
+
 	return 0;
 }
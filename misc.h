@@ -50,6 +50,19 @@ enum {
 	MISC_OBJ_MASK           = 0x1FFF,
 } __attribute__((__packed__));
 
+/*
+ * The functions below live in the audio module (see AUDIO_MODULE in the
+ * Makefile), which is dlopen()ed on demand. The typedefs match the symbols
+ * looked up by the loader.
+ */
+#define MISC_INIT_SYM "misc_init"
+#define MISC_PLAY_SOUND_FILE_SYM "misc_play_sound_file"
+
+typedef int (*misc_init_t) (int *argc, char ***argv, int verbose);
+typedef int (*misc_play_sound_file_t) (const char *path, const char *file,
+				const char *suffix);
+
+int misc_init(int *argc, char ***argv, int verbose);
 int misc_play_sound_file(const char *path, const char *file,
 				const char *suffix);
 
@@ -21,76 +21,59 @@
  * 59 Temple Place - Suite 330, Boston, MA 02111EXIT_FAILURE307, USA.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
-
-#include <netlink/netlink.h>
-#include <netlink/genl/genl.h>
-#include <netlink/genl/ctrl.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #include <linux/nfc.h>
 
 #include "nfcctl.h"
+#include "nfcnl.h"
+#include "tag.h"
+#include "nlparse.h"
+#include "nfclog.h"
 
 #define AF_NFC 39
 
-int verbose;
-
-#define printdbg(s, ...)						\
-	do {								\
-		if (verbose)						\
-			fprintf(stderr, "%s:%d %s: " s "\n",		\
-					__FILE__, __LINE__,		\
-					__func__, ##__VA_ARGS__);	\
-	} while (0)
+/* Targets a callback handler can get from one event */
+#define EVENT_TARGETS_MAX 64
 
-static int nlerr2syserr(int err)
+void nfcctl_log(const struct nfcctl *ctx, const char *fmt, ...)
 {
-	switch (abs(err)) {
-	case NLE_BAD_SOCK:
-		return EBADF;
-	case NLE_EXIST:
-		return EEXIST;
-	case NLE_NOADDR:
-		return EADDRNOTAVAIL;
-	case NLE_OBJ_NOTFOUND:
-		return ENOENT;
-	case NLE_INTR:
-		return EINTR;
-	case NLE_AGAIN:
-		return EAGAIN;
-	case NLE_INVAL:
-		return EINVAL;
-	case NLE_NOACCESS:
-		return EACCES;
-	case NLE_NOMEM:
-		return ENOMEM;
-	case NLE_AF_NOSUPPORT:
-		return EAFNOSUPPORT;
-	case NLE_PROTO_MISMATCH:
-		return EPROTONOSUPPORT;
-	case NLE_OPNOTSUPP:
-		return EOPNOTSUPP;
-	case NLE_PERM:
-		return EPERM;
-	case NLE_BUSY:
-		return EBUSY;
-	case NLE_RANGE:
-		return ERANGE;
-	default:
-		return err;
-	}
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (ctx->log)
+		ctx->log(ctx->log_param, fmt, ap);
+	else
+		vfprintf(stderr, fmt, ap);
+	va_end(ap);
 }
 
+/* Connect a raw socket to a target in a free session slot of ctx */
 int nfcctl_target_init(struct nfcctl *ctx, uint32_t dev_idx, uint32_t tgt_idx,
-							uint32_t protocol)
+				uint32_t protocol, struct nfc_session **sess)
 {
+	struct nfc_session *s = NULL;
 	int fd;
 	struct sockaddr_nfc addr;
+	unsigned i;
 	int rc;
 
-	printdbg("IN");
+	printdbg(ctx, "IN");
+
+	for (i = 0; i < NFCCTL_SESSIONS_MAX; i++) {
+		if (!ctx->sessions[i].ctx) {
+			s = &ctx->sessions[i];
+			break;
+		}
+	}
+	if (!s)
+		return EBUSY;
 
 	fd = socket(AF_NFC, SOCK_SEQPACKET, NFC_SOCKPROTO_RAW);
 	if (fd == -1)
@@ -107,7 +90,13 @@ int nfcctl_target_init(struct nfcctl *ctx, uint32_t dev_idx, uint32_t tgt_idx,
 		goto close_sock;
 	}
 
-	ctx->target_fd = fd;
+	memset(s, 0, sizeof(*s));
+	s->ctx = ctx;
+	s->fd = fd;
+	s->dev_idx = dev_idx;
+	s->tgt_idx = tgt_idx;
+
+	*sess = s;
 	return 0;
 
 close_sock:
@@ -115,483 +104,456 @@ close_sock:
 	return rc;
 }
 
-struct targets_found_hdl_data {
-	tgt_found_handler_t handler;
-	void *hdl_param;
-};
-
-static int targets_found_handler(struct nl_msg *n, void *arg)
+void nfcctl_target_deinit(struct nfc_session *sess)
 {
-	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(n));
-	struct targets_found_hdl_data *hdl_data = arg;
-	struct nlattr *attr[NFC_ATTR_MAX + 1];
-	struct nlattr *attr_nest[NFC_TARGET_ATTR_MAX + 1];
-	struct nlattr *attr_tgt;
-	int rem;
-	uint32_t dev_idx;
-	struct nfc_target tgt;
-	int rc;
+	if (!sess->ctx)
+		return;
 
-	printdbg("IN");
+	printdbg(sess->ctx, "IN");
 
-	if (gnlh->cmd != NFC_EVENT_TARGETS_FOUND) {
-		printdbg("The received message is not NFC_EVENT_TARGETS_FOUND");
-		return NL_SKIP;
-	}
+	if (sess->tag_drv && sess->tag_drv->remove)
+		sess->tag_drv->remove(sess);
+
+	close(sess->fd);
+	memset(sess, 0, sizeof(*sess));
+}
+
+struct nfc_dev *nfcctl_find_device(struct nfcctl *ctx, uint32_t dev_idx)
+{
+	unsigned i;
 
-	nla_parse(attr, NFC_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
-		  genlmsg_attrlen(gnlh, 0), NULL);
-	if (!attr[NFC_ATTR_TARGETS] || !attr[NFC_ATTR_DEVICE_INDEX]) {
-		printdbg("Missing attribute in received message");
-		return NL_SKIP;
+	for (i = 0; i < ctx->devs_count; i++) {
+		if (ctx->devs[i].idx == dev_idx)
+			return &ctx->devs[i];
 	}
 
-	dev_idx = nla_get_u32(attr[NFC_ATTR_DEVICE_INDEX]);
-
-	attr_tgt = nla_data(attr[NFC_ATTR_TARGETS]);
-	rem = nla_len(attr[NFC_ATTR_TARGETS]);
-	nla_for_each_nested(attr_tgt, attr[NFC_ATTR_TARGETS], rem) {
-		nla_parse(attr_nest, NFC_TARGET_ATTR_MAX, nla_data(attr_tgt),
-				nla_len(attr_tgt), NULL);
-		if (!attr_nest[NFC_TARGET_ATTR_TARGET_INDEX] ||
-			!attr_nest[NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS]) {
-			printdbg("Missing nested attribute in received"
-								" message");
-			return NL_SKIP;
-		}
+	return NULL;
+}
+
+static void device_added(struct nfcctl *ctx, const struct nfc_dev *dev)
+{
+	struct nfc_dev *d;
 
-		tgt.idx = nla_get_u32(attr_nest[NFC_TARGET_ATTR_TARGET_INDEX]);
-		tgt.protocols = nla_get_u32(
-				attr_nest[NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS]);
+	d = nfcctl_find_device(ctx, dev->idx);
+	if (d) {
+		*d = *dev;
+		return;
+	}
 
-		rc = hdl_data->handler(hdl_data->hdl_param, dev_idx, &tgt);
-		if (rc == TARGET_FOUND_STOP)
-			return NL_STOP;
+	if (ctx->devs_count == NFCCTL_DEVICES_MAX) {
+		printdbg(ctx, "No room for device %u", dev->idx);
+		return;
 	}
 
-	return NL_SKIP;
+	printdbg(ctx, "Device %u (%s) added", dev->idx, dev->name);
+
+	ctx->devs[ctx->devs_count++] = *dev;
+
+	if (ctx->dev_handler)
+		ctx->dev_handler(ctx->dev_param, NFCCTL_DEV_ADDED, dev);
 }
 
-static int no_seq_check(struct nl_msg *n, void *arg)
+static void device_removed(struct nfcctl *ctx, uint32_t dev_idx)
 {
-	printdbg("IN");
+	struct nfc_dev *d;
+	struct nfc_dev dev;
+
+	d = nfcctl_find_device(ctx, dev_idx);
+	if (!d)
+		return;
+
+	printdbg(ctx, "Device %u (%s) removed", d->idx, d->name);
 
-	return NL_OK;
+	dev = *d;
+	*d = ctx->devs[--ctx->devs_count];
+
+	if (ctx->dev_handler)
+		ctx->dev_handler(ctx->dev_param, NFCCTL_DEV_REMOVED, &dev);
 }
 
-int nfcctl_targets_found(struct nfcctl *ctx, tgt_found_handler_t handler,
-								void *hdl_param)
+static void device_event(struct nfcctl *ctx, uint8_t cmd, const void *attrs,
+								size_t len)
 {
-	struct nl_cb *cb;
-	fd_set rfds;
-	int sockfd;
-	struct targets_found_hdl_data hdl_data;
+	struct nfc_dev dev;
 	int rc;
 
-	printdbg("IN");
-
-	cb = nl_cb_alloc(NL_CB_VERBOSE);
-	if (!cb) {
-		printdbg("Error allocating struct nl_cb");
-		return -ENOMEM;
+	if (cmd == NFC_EVENT_DEVICE_ADDED) {
+		rc = nl_parse_device(attrs, len, &dev);
+		if (!rc)
+			device_added(ctx, &dev);
+	} else {
+		rc = nl_parse_device_index(attrs, len, &dev.idx);
+		if (!rc)
+			device_removed(ctx, dev.idx);
 	}
 
-	hdl_data.handler = handler;
-	hdl_data.hdl_param = hdl_param;
+	if (rc)
+		printdbg(ctx, "Malformed device event %u", cmd);
+}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, targets_found_handler,
-								&hdl_data);
+/* Either handler is called per target or the targets land in batch */
+struct targets_found_hdl_data {
+	struct nfcctl *ctx;
+	tgt_found_handler_t handler;
+	void *hdl_param;
+	struct nfc_target_batch *batch;
+};
 
-	do {
-		FD_ZERO(&rfds);
+static int targets_found_handler(void *arg, uint8_t cmd, const void *attrs,
+								size_t len)
+{
+	struct targets_found_hdl_data *hdl_data = arg;
+	struct nfcctl *ctx = hdl_data->ctx;
+	uint32_t idx[EVENT_TARGETS_MAX];
+	uint32_t protocols[EVENT_TARGETS_MAX];
+	struct nfc_target_batch local = {
+		.max = EVENT_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocols,
+	};
+	struct nfc_target_batch *batch = &local;
+	struct nfc_target tgt;
+	unsigned i;
+	int rc;
 
-		sockfd = nl_socket_get_fd(ctx->nlsk);
-		FD_SET(sockfd, &rfds);
+	printdbg(ctx, "IN");
 
-		rc = select(sockfd + 1, &rfds, NULL, NULL, NULL);
-	} while (rc == -1 && errno == EINTR);
+	if (cmd == NFC_EVENT_DEVICE_ADDED || cmd == NFC_EVENT_DEVICE_REMOVED) {
+		device_event(ctx, cmd, attrs, len);
+		return 0;
+	}
 
-	if (rc) {
-		if (FD_ISSET(sockfd, &rfds)) {
-			rc = nl_recvmsgs(ctx->nlsk, cb);
-			if (rc) {
-				rc = -nlerr2syserr(rc);
-				goto out;
-			}
-		}
+	if (cmd != NFC_EVENT_TARGETS_FOUND) {
+		printdbg(ctx, "The received message is not"
+					" NFC_EVENT_TARGETS_FOUND");
+		return 0;
 	}
 
-	rc = 0;
+	if (hdl_data->batch)
+		batch = hdl_data->batch;
 
-out:
-	nl_cb_put(cb);
-	return rc;
-}
+	rc = nl_parse_targets_found(attrs, len, batch);
+	if (rc < 0) {
+		printdbg(ctx, "Malformed NFC_EVENT_TARGETS_FOUND");
+		return 0;
+	}
 
-static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
-				void *arg)
-{
-	int *ret = arg;
+	if (rc > batch->count)
+		printdbg(ctx, "Event has %d targets, keeping %u", rc,
+								batch->count);
+
+	if (batch == hdl_data->batch)
+		return 1;
 
-	printdbg("IN");
+	for (i = 0; i < batch->count; i++) {
+		tgt.idx = batch->idx[i];
+		tgt.protocols = batch->protocols[i];
 
-	*ret = err->error;
+		rc = hdl_data->handler(hdl_data->hdl_param, batch->dev_idx,
+									&tgt);
+		if (rc == TARGET_FOUND_STOP)
+			return 1;
+	}
 
-	return NL_SKIP;
+	return 0;
 }
 
-static int ack_handler(struct nl_msg *msg, void *arg)
+int nfcctl_targets_found(struct nfcctl *ctx, tgt_found_handler_t handler,
+								void *hdl_param)
 {
-	int *ack = arg;
+	struct targets_found_hdl_data hdl_data;
 
-	printdbg("IN");
+	printdbg(ctx, "IN");
 
-	*ack = 1;
+	hdl_data.ctx = ctx;
+	hdl_data.handler = handler;
+	hdl_data.hdl_param = hdl_param;
+	hdl_data.batch = NULL;
 
-	return NL_STOP;
+	return nfcnl_recv_event(ctx, targets_found_handler, &hdl_data);
 }
 
-static int finish_handler(struct nl_msg *msg, void *arg)
+/*
+ * Wait for the next NFC_EVENT_TARGETS_FOUND and store all of its targets
+ * in batch, up to batch->max. batch->count is 0 when nothing was found.
+ */
+int nfcctl_targets_found_batch(struct nfcctl *ctx,
+					struct nfc_target_batch *batch)
 {
-	int *done = arg;
+	struct targets_found_hdl_data hdl_data;
+
+	printdbg(ctx, "IN");
 
-	printdbg("IN");
+	batch->count = 0;
 
-	*done = 1;
+	hdl_data.ctx = ctx;
+	hdl_data.handler = NULL;
+	hdl_data.hdl_param = NULL;
+	hdl_data.batch = batch;
 
-	return NL_SKIP;
+	return nfcnl_recv_event(ctx, targets_found_handler, &hdl_data);
 }
 
-static int send_and_recv_msgs(struct nfcctl *ctx, struct nl_msg *msg,
-				int (*handler)(struct nl_msg *, void *),
-				void *data)
+/*
+ * Open the transport with the cached family ids when there are some,
+ * saving the resolution round trips, or resolve and cache them.
+ */
+static int open_transport(struct nfcctl *ctx)
 {
-	struct nl_cb *cb;
-	int err, done, rc;
+	struct nfcnl_ids ids;
+	int rc;
 
-	printdbg("IN");
+	ctx->nlcached = !nfcnl_cache_get(&ids);
+	if (!ctx->nlcached)
+		memset(&ids, 0, sizeof(ids));
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (!cb) {
-		printdbg("Error allocating struct nl_cb");
-		return -ENOMEM;
-	}
+	rc = nfcnl_open(ctx, &ids);
+	if (!rc && !ctx->nlcached)
+		nfcnl_cache_put(&ids);
 
-	rc = nl_send_auto_complete(ctx->nlsk, msg);
-	if (rc < 0) {
-		rc = -nlerr2syserr(rc);
-		printdbg("Error sending netlink message: %s", strerror(rc));
-		goto out;
-	}
+	return rc;
+}
 
-	err = done = 0;
+/*
+ * A request to a family id the kernel does not know fails with ENOENT, and
+ * one which reached another family with EOPNOTSUPP. If the ids came from
+ * the cache, the NFC module was reloaded: resolve them again and tell the
+ * caller to retry.
+ */
+static int cache_stale(struct nfcctl *ctx, int *rc)
+{
+	if (!ctx->nlcached || (*rc != -ENOENT && *rc != -EOPNOTSUPP))
+		return 0;
 
-	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &done);
-	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &done);
+	printdbg(ctx, "Cached genl family %d is stale", ctx->nlfamily);
 
-	if (handler)
-		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, handler, data);
+	nfcnl_cache_drop();
+	nfcnl_close(ctx);
 
-	while (!err && !done) {
-		rc = nl_recvmsgs(ctx->nlsk, cb);
-		if (rc) {
-			rc = -nlerr2syserr(rc);
-			printdbg("Error receiving netlink message: %s",
-								strerror(rc));
-			goto out;
-		}
-	}
+	/* Hotplug events sent meanwhile were lost */
+	ctx->devs_valid = 0;
 
-	rc = -err;
-	if (rc)
-		printdbg("Error message received: %s", strerror(rc));
+	*rc = open_transport(ctx);
 
-out:
-	nl_cb_put(cb);
-	return rc;
+	return !*rc;
 }
 
 int nfcctl_stop_poll(struct nfcctl *ctx, struct nfc_dev *dev)
 {
-	struct nl_msg *msg;
-	void *hdr;
 	int rc;
 
-	printdbg("IN");
-
-	msg = nlmsg_alloc();
-	if (!msg) {
-		printdbg("Error allocating struct nl_msg");
-		return -ENOMEM;
-	}
-
-	hdr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, ctx->nlfamily, 0,
-			  NLM_F_REQUEST, NFC_CMD_STOP_POLL, NFC_GENL_VERSION);
-	if (!hdr) {
-		printdbg("Null header on genlmsg_put()");
-		rc = -EINVAL;
-		goto nla_put_failure;
-	}
-
-	NLA_PUT_U32(msg, NFC_ATTR_DEVICE_INDEX, dev->idx);
+	printdbg(ctx, "IN");
 
-	rc = send_and_recv_msgs(ctx, msg, NULL, NULL);
+	do {
+		rc = nfcnl_poll_cmd(ctx, NFC_CMD_STOP_POLL, dev->idx, 0);
+	} while (cache_stale(ctx, &rc));
 
-nla_put_failure:
-	nlmsg_free(msg);
 	return rc;
 }
 
 int nfcctl_start_poll(struct nfcctl *ctx, struct nfc_dev *dev,
 							uint32_t protocols)
 {
-	struct nl_msg *msg;
-	void *hdr;
 	int rc;
 
-	printdbg("IN");
+	printdbg(ctx, "IN");
 
-	msg = nlmsg_alloc();
-	if (!msg) {
-		printdbg("Error allocating struct nl_msg");
-		return -ENOMEM;
-	}
+	do {
+		rc = nfcnl_poll_cmd(ctx, NFC_CMD_START_POLL, dev->idx,
+								protocols);
+	} while (cache_stale(ctx, &rc));
 
-	hdr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, ctx->nlfamily, 0,
-			NLM_F_REQUEST, NFC_CMD_START_POLL, NFC_GENL_VERSION);
-	if (!hdr) {
-		printdbg("Null header on genlmsg_put()");
-		rc = -EINVAL;
-		goto nla_put_failure;
-	}
+	return rc;
+}
+
+/*
+ * Start polling dev again after it reported targets. A device still
+ * polling refuses START_POLL, so it is stopped and started over then.
+ */
+int nfcctl_rearm_poll(struct nfcctl *ctx, struct nfc_dev *dev,
+							uint32_t protocols)
+{
+	int rc;
 
-	NLA_PUT_U32(msg, NFC_ATTR_DEVICE_INDEX, dev->idx);
-	NLA_PUT_U32(msg, NFC_ATTR_PROTOCOLS, protocols);
+	rc = nfcctl_start_poll(ctx, dev, protocols);
+	if (rc) {
+		rc = nfcctl_stop_poll(ctx, dev);
+		if (rc)
+			return rc;
 
-	rc = send_and_recv_msgs(ctx, msg, NULL, NULL);
+		rc = nfcctl_start_poll(ctx, dev, protocols);
+	}
 
-nla_put_failure:
-	nlmsg_free(msg);
 	return rc;
 }
 
-struct get_devices_hdl_data {
-	struct nfc_dev *devl;
-	uint8_t devl_count;
-	uint8_t devl_max;
-};
-
-static int get_devices_handler(struct nl_msg *n, void *arg)
+static int arm_find(const struct nfcctl_arm_set *set, uint32_t dev_idx)
 {
-	struct nlmsghdr *nlh = nlmsg_hdr(n);
-	struct nlattr *attrs[NFC_ATTR_MAX + 1];
-	struct nfc_dev dev;
-	struct get_devices_hdl_data *hdl_data = arg;
-
-	printdbg("IN");
+	int i;
 
-	if (hdl_data->devl_count >= hdl_data->devl_max) {
-		printdbg("There are discarded NFC devices");
-		return NL_STOP;
+	for (i = 0; i < set->count; i++) {
+		if (set->idx[i] == dev_idx)
+			return i;
 	}
 
-	genlmsg_parse(nlh, 0, attrs, NFC_ATTR_MAX, NULL);
+	return -1;
+}
 
-	if (!attrs[NFC_ATTR_DEVICE_INDEX] || !attrs[NFC_ATTR_DEVICE_NAME]) {
-		nl_perror(NLE_MISSING_ATTR, "NFC_CMD_GET_DEVICE");
-		return NL_STOP;
-	}
+void nfcctl_arm_add(struct nfcctl_arm_set *set, uint32_t dev_idx)
+{
+	if (arm_find(set, dev_idx) < 0 && set->count < NFCCTL_DEVICES_MAX)
+		set->idx[set->count++] = dev_idx;
+}
 
-	dev.idx = nla_get_u32(attrs[NFC_ATTR_DEVICE_INDEX]);
-	dev.name = nla_get_string(attrs[NFC_ATTR_DEVICE_NAME]);
-	dev.protocols = nla_get_u32(attrs[NFC_ATTR_PROTOCOLS]);
+void nfcctl_arm_handler(void *dev_param, int event,
+						const struct nfc_dev *dev)
+{
+	struct nfcctl_arm_set *set = dev_param;
+	int i;
 
-	hdl_data->devl[hdl_data->devl_count++] = dev;
+	if (event == NFCCTL_DEV_ADDED) {
+		nfcctl_arm_add(set, dev->idx);
+		return;
+	}
 
-	return NL_SKIP;
+	i = arm_find(set, dev->idx);
+	if (i >= 0)
+		set->idx[i] = set->idx[--set->count];
 }
 
-int nfcctl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
-							uint8_t devl_max)
+void nfcctl_arm_pending(struct nfcctl *ctx, struct nfcctl_arm_set *set,
+							uint32_t protocols)
 {
-	struct nl_msg *msg;
-	void *hdr;
-	struct get_devices_hdl_data hdl_data;
+	struct nfc_dev *dev;
 	int rc;
 
-	printdbg("IN");
-
-	msg = nlmsg_alloc();
-	if (!msg) {
-		printdbg("Error allocating struct nl_msg");
-		return -ENOMEM;
-	}
+	while (set->count) {
+		dev = nfcctl_find_device(ctx, set->idx[--set->count]);
+		if (!dev)
+			continue;
 
-	hdr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, ctx->nlfamily, 0,
-			  NLM_F_DUMP, NFC_CMD_GET_DEVICE, NFC_GENL_VERSION);
-	if (!hdr) {
-		printdbg("Null header on genlmsg_put()");
-		rc = -EINVAL;
-		goto out;
+		rc = nfcctl_rearm_poll(ctx, dev, protocols);
+		if (rc)
+			printdbg(ctx, "Arming device %u: %s", dev->idx,
+							strerror(-rc));
 	}
+}
 
-	hdl_data.devl = devl;
-	hdl_data.devl_count = 0;
-	hdl_data.devl_max = devl_max;
-
-	rc = send_and_recv_msgs(ctx, msg, get_devices_handler, &hdl_data);
-	if (rc)
-		goto out;
+static time_t monotonic_sec(void)
+{
+	struct timespec ts;
 
-	rc = hdl_data.devl_count;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-out:
-	nlmsg_free(msg);
-	return rc;
+	return ts.tv_sec;
 }
 
-struct get_multicast_id_hdl_data {
-	const char *group;
-	int id;
-};
-
-static int get_multicast_id_handler(struct nl_msg *msg, void *arg)
+/* Dump all devices and fold the result into the table */
+static int dump_devices(struct nfcctl *ctx)
 {
-	struct get_multicast_id_hdl_data *hdl_data = arg;
-	struct nlattr *tb[CTRL_ATTR_MAX + 1];
-	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-	struct nlattr *mcgrp;
-	int i;
+	struct nfc_dev devl[NFCCTL_DEVICES_MAX];
+	int devl_count;
+	int i, j;
+	int rc;
 
-	printdbg("IN");
+	do {
+		rc = nfcnl_get_devices(ctx, devl, NFCCTL_DEVICES_MAX);
+	} while (cache_stale(ctx, &rc));
 
-	nla_parse(tb, CTRL_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
-		  genlmsg_attrlen(gnlh, 0), NULL);
+	if (rc < 0)
+		return rc;
 
-	if (!tb[CTRL_ATTR_MCAST_GROUPS])
-		return NL_SKIP;
+	devl_count = rc;
 
-	nla_for_each_nested(mcgrp, tb[CTRL_ATTR_MCAST_GROUPS], i) {
-		struct nlattr *tb2[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	/* Removals whose event was missed; the last entry moves down */
+	for (i = ctx->devs_count - 1; i >= 0; i--) {
+		for (j = 0; j < devl_count; j++) {
+			if (devl[j].idx == ctx->devs[i].idx)
+				break;
+		}
 
-		nla_parse(tb2, CTRL_ATTR_MCAST_GRP_MAX, nla_data(mcgrp),
-			  nla_len(mcgrp), NULL);
-		if (!tb2[CTRL_ATTR_MCAST_GRP_NAME] ||
-		    !tb2[CTRL_ATTR_MCAST_GRP_ID] ||
-		    strncmp(nla_data(tb2[CTRL_ATTR_MCAST_GRP_NAME]),
-			       hdl_data->group,
-			       nla_len(tb2[CTRL_ATTR_MCAST_GRP_NAME])))
-			continue;
+		if (j == devl_count)
+			device_removed(ctx, ctx->devs[i].idx);
+	}
 
-		hdl_data->id = nla_get_u32(tb2[CTRL_ATTR_MCAST_GRP_ID]);
-		break;
-	};
+	for (i = 0; i < devl_count; i++)
+		device_added(ctx, &devl[i]);
 
-	return NL_SKIP;
+	ctx->devs_valid = 1;
+	ctx->devs_time = monotonic_sec();
+
+	return ctx->devs_count;
 }
 
-static int get_multicast_id(struct nfcctl *ctx, const char *family,
-					const char *group)
+/*
+ * Re-dump the devices if the table was never filled or is older than
+ * NFCCTL_DEV_REDUMP_SEC, in case some hotplug event was dropped. Returns
+ * the number of devices.
+ */
+int nfcctl_sync_devices(struct nfcctl *ctx)
 {
-	struct nl_msg *msg;
-	void *hdr;
-	struct get_multicast_id_hdl_data hdl_data;
-	int rc;
+	printdbg(ctx, "IN");
 
-	printdbg("IN");
+	if (ctx->devs_valid &&
+		monotonic_sec() - ctx->devs_time < NFCCTL_DEV_REDUMP_SEC)
+		return ctx->devs_count;
 
-	msg = nlmsg_alloc();
-	if (!msg) {
-		printdbg("Error allocating struct nl_msg");
-		return -ENOMEM;
-	}
+	return dump_devices(ctx);
+}
 
-	hdr = genlmsg_put(msg, 0, 0, genl_ctrl_resolve(ctx->nlsk, "nlctrl"), 0,
-			0, CTRL_CMD_GETFAMILY, 0);
-	if (!hdr) {
-		printdbg("Null header on genlmsg_put()");
-		rc = -EINVAL;
-		goto nla_put_failure;
-	}
+int nfcctl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
+							uint8_t devl_max)
+{
+	int rc;
 
-	NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, family);
+	printdbg(ctx, "IN");
 
-	hdl_data.group = group;
+	rc = nfcctl_sync_devices(ctx);
+	if (rc < 0)
+		return rc;
 
-	rc = send_and_recv_msgs(ctx, msg, get_multicast_id_handler, &hdl_data);
-	if (rc)
-		goto nla_put_failure;
+	if (rc > devl_max)
+		rc = devl_max;
 
-	rc = hdl_data.id;
+	memcpy(devl, ctx->devs, rc * sizeof(*devl));
 
-nla_put_failure:
-	nlmsg_free(msg);
 	return rc;
 }
 
 int nfcctl_init(struct nfcctl *ctx)
 {
-	int id;
-	int rc;
+	printdbg(ctx, "IN");
 
-	printdbg("IN");
+	memset(ctx->sessions, 0, sizeof(ctx->sessions));
+	ctx->devs_count = 0;
+	ctx->devs_valid = 0;
 
-	ctx->nlsk = nl_socket_alloc();
-	if (!ctx->nlsk) {
-		printdbg("Invalid context");
-		return -ENOMEM;
-	}
-
-	rc = genl_connect(ctx->nlsk);
-	if (rc) {
-		rc = -nlerr2syserr(rc);
-		printdbg("Error connecting to generic netlink: %s",
-								strerror(rc));
-		goto free_nlsk;
-	}
-
-	ctx->nlfamily = genl_ctrl_resolve(ctx->nlsk, NFC_GENL_NAME);
-	if (ctx->nlfamily < 0) {
-		rc = -nlerr2syserr(ctx->nlfamily);
-		printdbg("Error resolving genl NFC family: %s", strerror(rc));
-		goto free_nlsk;
-	}
-
-	id = get_multicast_id(ctx, NFC_GENL_NAME,
-					NFC_GENL_MCAST_EVENT_NAME);
-	if (id <= 0) {
-		rc = id;
-		goto free_nlsk;
-	}
+	return open_transport(ctx);
+}
 
-	rc = nl_socket_add_membership(ctx->nlsk, id);
-	if (rc) {
-		printdbg("Error adding nl socket to membership");
-		rc = -nlerr2syserr(rc);
-		goto free_nlsk;
-	}
+void nfcctl_deinit(struct nfcctl *ctx)
+{
+	unsigned i;
 
-	ctx->target_fd = -1;
+	printdbg(ctx, "IN");
 
-	return 0;
+	for (i = 0; i < NFCCTL_SESSIONS_MAX; i++)
+		nfcctl_target_deinit(&ctx->sessions[i]);
 
-free_nlsk:
-	nl_socket_free(ctx->nlsk);
-	return rc;
+	nfcnl_close(ctx);
 }
 
-void nfcctl_deinit(struct nfcctl *ctx)
+/* Netlink socket descriptor, for callers running their own poll() loop */
+int nfcctl_get_fd(struct nfcctl *ctx)
 {
-	printdbg("IN");
-
-	if (ctx->target_fd > -1) {
-		close(ctx->target_fd);
-		ctx->target_fd = -1;
-	}
+	return nfcnl_get_fd(ctx);
+}
 
-	if (ctx->nlsk)
-		nl_socket_free(ctx->nlsk);
-		ctx->nlsk = NULL;
+/*
+ * Events already read from the socket and waiting for the next receive.
+ * Such a loop must not wait on the descriptor while this is non-zero.
+ */
+int nfcctl_event_pending(struct nfcctl *ctx)
+{
+	return nfcnl_event_pending(ctx);
 }
@@ -25,10 +25,15 @@
 #define _NFCCTL_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define NFCCTL_DEV_NAME_MAX 8	/* NFC_DEVICE_NAME_MAXSIZE */
 
 struct nfc_dev {
 	uint32_t idx;
-	const char *name;
+	char name[NFCCTL_DEV_NAME_MAX + 1];
 	uint32_t protocols;
 };
 
@@ -37,20 +42,115 @@ struct nfc_target {
 	uint32_t protocols;
 };
 
+typedef void (*nfcctl_log_t) (void *log_param, const char *fmt, va_list ap);
+
+#define NFCCTL_DEV_ADDED 1
+#define NFCCTL_DEV_REMOVED 0
+typedef void (*nfcctl_dev_handler_t) (void *dev_param, int event,
+						const struct nfc_dev *dev);
+
+struct nfcctl;
+struct tag_driver;
+
+/*
+ * One connected target. A slot whose ctx is NULL is free, so a zeroed
+ * struct nfcctl has no open session.
+ */
+struct nfc_session {
+	struct nfcctl *ctx;
+	int fd;
+	uint32_t dev_idx;
+	uint32_t tgt_idx;
+	const struct tag_driver *tag_drv;	/* set by tag_connect() */
+	void *tag_data;
+	size_t tag_size;		/* user data capacity */
+};
+
+/* Targets a context keeps connected at once, e.g. a stack of tags */
+#define NFCCTL_SESSIONS_MAX 8
+
+/* Devices a context tracks, and how often it re-dumps them anyway */
+#define NFCCTL_DEVICES_MAX 16
+#define NFCCTL_DEV_REDUMP_SEC 60
+
+/* Room for events read while waiting for a reply, built-in transport */
+#define NFCCTL_EVQ_SIZE 8192
+
+/*
+ * All library state lives in struct nfcctl, so a process may drive several
+ * contexts from different threads as long as each context is only used by
+ * one thread at a time.
+ *
+ * verbose, log and log_param are per-context configuration and must be set
+ * before nfcctl_init(). A NULL log writes to stderr.
+ *
+ * The device table is kept up to date from the hotplug events received
+ * along with the target ones, and dev_handler, if set, is told about every
+ * device showing up or going away. It runs while events are received, so
+ * it must not issue requests on the context itself.
+ */
 struct nfcctl {
-	struct nl_sock *nlsk;
+	struct nl_sock *nlsk;		/* libnl transport, requests */
+	struct nl_sock *nlevsk;		/* libnl transport, events */
+	int nlfd;			/* built-in transport */
+	uint32_t nlportid;
+	uint32_t nlseq;
 	int nlfamily;
-	int target_fd;
+	int nlcached;			/* family ids came from the cache */
+	uint8_t nlevq[NFCCTL_EVQ_SIZE] __attribute__((aligned(4)));
+	size_t nlevq_len;		/* queued events, built-in transport */
+	int nlevq_lost;			/* some did not fit */
+	struct nfc_session sessions[NFCCTL_SESSIONS_MAX];
+	unsigned long tag_frames;	/* frames sent, for benchmarks */
+
+	struct nfc_dev devs[NFCCTL_DEVICES_MAX];
+	uint8_t devs_count;
+	int devs_valid;
+	time_t devs_time;		/* of the last dump, monotonic */
+
+	int verbose;
+	nfcctl_log_t log;
+	void *log_param;
+	nfcctl_dev_handler_t dev_handler;
+	void *dev_param;
 };
 
+void nfcctl_log(const struct nfcctl *ctx, const char *fmt, ...)
+				__attribute__((format(printf, 2, 3)));
+
 int nfcctl_init(struct nfcctl *ctx);
 void nfcctl_deinit(struct nfcctl *ctx);
+int nfcctl_get_fd(struct nfcctl *ctx);
+int nfcctl_event_pending(struct nfcctl *ctx);
 
 int nfcctl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
 							uint8_t devl_max);
+int nfcctl_sync_devices(struct nfcctl *ctx);
+struct nfc_dev *nfcctl_find_device(struct nfcctl *ctx, uint32_t dev_idx);
 int nfcctl_start_poll(struct nfcctl *ctx, struct nfc_dev *dev,
 							uint32_t protocols);
 int nfcctl_stop_poll(struct nfcctl *ctx, struct nfc_dev *dev);
+int nfcctl_rearm_poll(struct nfcctl *ctx, struct nfc_dev *dev,
+							uint32_t protocols);
+
+/*
+ * Devices waiting for START_POLL, for loops driving every reader with the
+ * same protocols. With nfcctl_arm_handler() as ctx->dev_handler and the
+ * set as dev_param before the first nfcctl_sync_devices(), every reader
+ * showing up is added to the set; readers which reported targets are put
+ * back with nfcctl_arm_add(). nfcctl_arm_pending() arms them all, and a
+ * reader failing to start, e.g. as it was unplugged, is only logged.
+ */
+struct nfcctl_arm_set {
+	uint32_t idx[NFCCTL_DEVICES_MAX];
+	uint8_t count;
+};
+
+void nfcctl_arm_add(struct nfcctl_arm_set *set, uint32_t dev_idx);
+void nfcctl_arm_handler(void *dev_param, int event,
+						const struct nfc_dev *dev);
+void nfcctl_arm_pending(struct nfcctl *ctx, struct nfcctl_arm_set *set,
+							uint32_t protocols);
 
 #define TARGET_FOUND_SKIP 0
 #define TARGET_FOUND_STOP 1
@@ -59,7 +159,23 @@ typedef int (*tgt_found_handler_t) (void *hdl_param, uint32_t dev_idx,
 int nfcctl_targets_found(struct nfcctl *ctx, tgt_found_handler_t handler,
 							void *hdl_param);
 
+/*
+ * Targets of one event as a structure of arrays, so callers filter them in
+ * a single pass. idx and protocols point to caller buffers of max entries.
+ */
+struct nfc_target_batch {
+	uint32_t dev_idx;
+	uint32_t count;
+	uint32_t max;
+	uint32_t *idx;
+	uint32_t *protocols;
+};
+
+int nfcctl_targets_found_batch(struct nfcctl *ctx,
+					struct nfc_target_batch *batch);
+
 int nfcctl_target_init(struct nfcctl *ctx, uint32_t dev_idx, uint32_t tgt_idx,
-							uint32_t protocol);
+				uint32_t protocol, struct nfc_session **sess);
+void nfcctl_target_deinit(struct nfc_session *sess);
 
 #endif /* _NFCCTL_H_ */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _NFCNL_H_
+#define _NFCNL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nfcctl.h"
+
+/*
+ * Generic netlink transport under nfcctl.c. The Makefile links one of two
+ * implementations: nfcnl_libnl.c on top of libnl-genl, or nfcnl_builtin.c,
+ * a small codec over a raw AF_NETLINK socket which needs no library.
+ *
+ * Unless stated otherwise, these return 0 or a negative errno.
+ */
+
+/* Ids the kernel assigned to the NFC family and its event group */
+struct nfcnl_ids {
+	uint16_t family;
+	uint32_t group;
+};
+
+/*
+ * Open the socket and join the event group. When ids->family is set it is
+ * trusted as is; otherwise both ids are resolved and stored in ids.
+ */
+int nfcnl_open(struct nfcctl *ctx, struct nfcnl_ids *ids);
+void nfcnl_close(struct nfcctl *ctx);
+int nfcnl_get_fd(struct nfcctl *ctx);
+
+/* Returns the number of devices stored in devl */
+int nfcnl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
+							uint8_t devl_max);
+
+/* NFC_CMD_START_POLL or NFC_CMD_STOP_POLL, which ignores protocols */
+int nfcnl_poll_cmd(struct nfcctl *ctx, uint8_t cmd, uint32_t dev_idx,
+							uint32_t protocols);
+
+/*
+ * Wait for the event socket and pass every message one read returns to
+ * handler, with the attributes following its genl header. A non-zero
+ * return from handler stops there; the built-in transport keeps the rest
+ * of the read for the next call.
+ *
+ * Events the built-in transport reads while waiting for a reply are queued
+ * and delivered first, without waiting; nfcnl_event_pending() tells when
+ * there are some. -ENOBUFS reports events lost to a full queue, as it
+ * does for an overrun socket buffer.
+ */
+typedef int (*nfcnl_event_t) (void *arg, uint8_t cmd, const void *attrs,
+								size_t len);
+int nfcnl_recv_event(struct nfcctl *ctx, nfcnl_event_t handler, void *arg);
+int nfcnl_event_pending(struct nfcctl *ctx);
+
+/*
+ * Resolved ids survive the process in a runtime file, tagged with the
+ * kernel boot id, and are kept in memory for further contexts. A stale
+ * entry is only noticed by a request failing, see nfcctl.c.
+ */
+#define NFCNL_CACHE_PATH "/var/run/nfcex.genl"
+
+int nfcnl_cache_get(struct nfcnl_ids *ids);
+void nfcnl_cache_put(const struct nfcnl_ids *ids);
+void nfcnl_cache_drop(void);
+
+#endif /* _NFCNL_H_ */
@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Built-in generic netlink transport: a raw AF_NETLINK socket and the few
+ * message layouts nfcctl needs, laid out as fixed structs. Requests are
+ * filled in on the stack and replies parsed in place from a stack buffer,
+ * so no request touches the heap. Selected with BUILTIN_GENL=1.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "nfcnl.h"
+#include "nlparse.h"
+#include "nfclog.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+/* Large enough for any genl message the kernel sends in one skb */
+#define NL_BUF_SIZE 8192
+
+struct nl_u32_attr {
+	struct nlattr nla;
+	uint32_t val;
+};
+
+/* Message templates; only the ids, sequence and values vary per request */
+struct getfamily_req {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	struct nlattr name_nla;
+	char name[NLA_ALIGN(sizeof(NFC_GENL_NAME))];
+};
+
+struct nfc_req {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	struct nl_u32_attr dev;
+	struct nl_u32_attr protocols;
+};
+
+static const struct getfamily_req getfamily_tmpl = {
+	.nlh = {
+		.nlmsg_len = sizeof(struct getfamily_req),
+		.nlmsg_type = GENL_ID_CTRL,
+		.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
+	},
+	.genl = {
+		.cmd = CTRL_CMD_GETFAMILY,
+		.version = 1,
+	},
+	.name_nla = {
+		.nla_len = NLA_HDRLEN + sizeof(NFC_GENL_NAME),
+		.nla_type = CTRL_ATTR_FAMILY_NAME,
+	},
+	.name = NFC_GENL_NAME,
+};
+
+static const struct nfc_req nfc_tmpl = {
+	.nlh = {
+		.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
+	},
+	.genl = {
+		.version = NFC_GENL_VERSION,
+	},
+	.dev = {
+		.nla = {
+			.nla_len = sizeof(struct nl_u32_attr),
+			.nla_type = NFC_ATTR_DEVICE_INDEX,
+		},
+	},
+	.protocols = {
+		.nla = {
+			.nla_len = sizeof(struct nl_u32_attr),
+			.nla_type = NFC_ATTR_PROTOCOLS,
+		},
+	},
+};
+
+/* Called for every reply message to the current request */
+typedef int (*reply_handler_t) (void *arg, const struct genlmsghdr *genl,
+							size_t len);
+
+static int send_req(struct nfcctl *ctx, struct nlmsghdr *nlh)
+{
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+	ssize_t rc;
+
+	nlh->nlmsg_seq = ++ctx->nlseq;
+	nlh->nlmsg_pid = ctx->nlportid;
+
+	do {
+		rc = sendto(ctx->nlfd, nlh, nlh->nlmsg_len, 0,
+			(struct sockaddr *) &kernel, sizeof(kernel));
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1) {
+		printdbg(ctx, "Error sending netlink message: %s",
+							strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* Keep an event read while waiting for a reply for nfcnl_recv_event() */
+static void queue_event(struct nfcctl *ctx, const struct nlmsghdr *nlh)
+{
+	size_t len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+	if (ctx->nlevq_len + len > sizeof(ctx->nlevq)) {
+		printdbg(ctx, "Event queue full, dropping event");
+		ctx->nlevq_lost = 1;
+		return;
+	}
+
+	memcpy(ctx->nlevq + ctx->nlevq_len, nlh, nlh->nlmsg_len);
+	ctx->nlevq_len += len;
+}
+
+/*
+ * Collect the replies to the request just sent, up to its ACK or, for a
+ * dump, NLMSG_DONE. NFC events arriving meanwhile are queued, since the
+ * kernel has stopped polling the device that reported them; messages of
+ * other requests are dropped.
+ */
+static int recv_reply(struct nfcctl *ctx, reply_handler_t handler, void *arg)
+{
+	uint8_t buf[NL_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	int stop = 0;
+	ssize_t len;
+
+	for (;;) {
+		len = recv(ctx->nlfd, buf, sizeof(buf), 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			printdbg(ctx, "Error receiving netlink message: %s",
+							strerror(errno));
+			return -errno;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+						nlh = NLMSG_NEXT(nlh, len)) {
+			if (!nlh->nlmsg_pid && ctx->nlfamily &&
+					nlh->nlmsg_type == ctx->nlfamily) {
+				queue_event(ctx, nlh);
+				continue;
+			}
+
+			if (nlh->nlmsg_seq != ctx->nlseq ||
+					nlh->nlmsg_pid != ctx->nlportid)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+				if (err->error)
+					printdbg(ctx, "Error message "
+						"received: %s",
+						strerror(-err->error));
+				return err->error;
+			}
+
+			if (stop || !handler ||
+				nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+				continue;
+
+			stop = handler(arg, NLMSG_DATA(nlh),
+				nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+		}
+	}
+}
+
+struct family_hdl_data {
+	uint16_t family;
+	uint32_t group_id;
+	int rc;
+};
+
+static int family_handler(void *arg, const struct genlmsghdr *genl,
+							size_t len)
+{
+	struct family_hdl_data *hdl_data = arg;
+
+	hdl_data->rc = nl_parse_family((const uint8_t *) genl + GENL_HDRLEN,
+				len, NFC_GENL_MCAST_EVENT_NAME,
+				&hdl_data->family, &hdl_data->group_id);
+	return 1;
+}
+
+/* Resolve the NFC family and its event group in a single request */
+static int resolve_family(struct nfcctl *ctx, struct nfcnl_ids *ids)
+{
+	struct getfamily_req req = getfamily_tmpl;
+	struct family_hdl_data hdl_data = { .rc = -ENOENT };
+	int rc;
+
+	rc = send_req(ctx, &req.nlh);
+	if (rc)
+		return rc;
+
+	rc = recv_reply(ctx, family_handler, &hdl_data);
+	if (rc)
+		return rc;
+
+	if (hdl_data.rc)
+		return hdl_data.rc;
+
+	if (!hdl_data.group_id)
+		return -ENOENT;
+
+	ids->family = hdl_data.family;
+	ids->group = hdl_data.group_id;
+
+	return 0;
+}
+
+int nfcnl_open(struct nfcctl *ctx, struct nfcnl_ids *ids)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	socklen_t addr_len = sizeof(addr);
+	int rc;
+
+	ctx->nlfamily = 0;
+	ctx->nlseq = 0;
+	ctx->nlevq_len = 0;
+	ctx->nlevq_lost = 0;
+
+	ctx->nlfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+							NETLINK_GENERIC);
+	if (ctx->nlfd == -1) {
+		rc = -errno;
+		printdbg(ctx, "Error connecting to generic netlink: %s",
+								strerror(-rc));
+		return rc;
+	}
+
+	if (bind(ctx->nlfd, (struct sockaddr *) &addr, sizeof(addr)) ||
+		getsockname(ctx->nlfd, (struct sockaddr *) &addr, &addr_len)) {
+		rc = -errno;
+		printdbg(ctx, "Error connecting to generic netlink: %s",
+								strerror(-rc));
+		goto close_fd;
+	}
+	ctx->nlportid = addr.nl_pid;
+
+	if (!ids->family) {
+		rc = resolve_family(ctx, ids);
+		if (rc) {
+			printdbg(ctx, "Error resolving genl NFC family: %s",
+								strerror(-rc));
+			goto close_fd;
+		}
+	}
+
+	if (setsockopt(ctx->nlfd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+					&ids->group, sizeof(ids->group))) {
+		rc = -errno;
+		printdbg(ctx, "Error adding nl socket to membership");
+		goto close_fd;
+	}
+
+	ctx->nlfamily = ids->family;
+
+	return 0;
+
+close_fd:
+	close(ctx->nlfd);
+	return rc;
+}
+
+void nfcnl_close(struct nfcctl *ctx)
+{
+	if (ctx->nlfamily) {
+		close(ctx->nlfd);
+		ctx->nlfamily = 0;
+	}
+}
+
+int nfcnl_get_fd(struct nfcctl *ctx)
+{
+	return ctx->nlfd;
+}
+
+int nfcnl_poll_cmd(struct nfcctl *ctx, uint8_t cmd, uint32_t dev_idx,
+							uint32_t protocols)
+{
+	struct nfc_req req = nfc_tmpl;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	req.nlh.nlmsg_type = ctx->nlfamily;
+	req.genl.cmd = cmd;
+	req.dev.val = dev_idx;
+	req.protocols.val = protocols;
+
+	/* STOP_POLL carries the device index only */
+	req.nlh.nlmsg_len = cmd == NFC_CMD_START_POLL ? sizeof(req) :
+				offsetof(struct nfc_req, protocols);
+
+	rc = send_req(ctx, &req.nlh);
+	if (rc)
+		return rc;
+
+	return recv_reply(ctx, NULL, NULL);
+}
+
+struct get_devices_hdl_data {
+	struct nfcctl *ctx;
+	struct nfc_dev *devl;
+	uint8_t devl_count;
+	uint8_t devl_max;
+};
+
+static int get_devices_handler(void *arg, const struct genlmsghdr *genl,
+							size_t len)
+{
+	struct get_devices_hdl_data *hdl_data = arg;
+	struct nfcctl *ctx = hdl_data->ctx;
+
+	if (hdl_data->devl_count >= hdl_data->devl_max) {
+		printdbg(ctx, "There are discarded NFC devices");
+		return 1;
+	}
+
+	if (nl_parse_device((const uint8_t *) genl + GENL_HDRLEN, len,
+				&hdl_data->devl[hdl_data->devl_count])) {
+		printdbg(ctx, "Missing attribute in NFC_CMD_GET_DEVICE reply");
+		return 1;
+	}
+
+	hdl_data->devl_count++;
+
+	return 0;
+}
+
+int nfcnl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
+							uint8_t devl_max)
+{
+	struct nfc_req req = nfc_tmpl;
+	struct get_devices_hdl_data hdl_data;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	req.nlh.nlmsg_len = offsetof(struct nfc_req, dev);
+	req.nlh.nlmsg_type = ctx->nlfamily;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.genl.cmd = NFC_CMD_GET_DEVICE;
+
+	hdl_data.ctx = ctx;
+	hdl_data.devl = devl;
+	hdl_data.devl_count = 0;
+	hdl_data.devl_max = devl_max;
+
+	rc = send_req(ctx, &req.nlh);
+	if (rc)
+		return rc;
+
+	rc = recv_reply(ctx, get_devices_handler, &hdl_data);
+	if (rc)
+		return rc;
+
+	return hdl_data.devl_count;
+}
+
+int nfcnl_recv_event(struct nfcctl *ctx, nfcnl_event_t handler, void *arg)
+{
+	uint8_t buf[NL_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct pollfd fds = { .fd = ctx->nlfd, .events = POLLIN };
+	struct nlmsghdr *nlh;
+	const struct genlmsghdr *genl;
+	ssize_t len;
+	int rc;
+
+	if (ctx->nlevq_len) {
+		len = ctx->nlevq_len;
+		memcpy(buf, ctx->nlevq, len);
+		ctx->nlevq_len = 0;
+		goto parse;
+	}
+
+	if (ctx->nlevq_lost) {
+		ctx->nlevq_lost = 0;
+		return -ENOBUFS;
+	}
+
+	do {
+		rc = poll(&fds, 1, -1);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == -1)
+		return -errno;
+
+	len = recv(ctx->nlfd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len == -1)
+		return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+
+parse:
+	for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+		if (nlh->nlmsg_type != ctx->nlfamily ||
+				nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+			continue;
+
+		genl = NLMSG_DATA(nlh);
+
+		if (!handler(arg, genl->cmd,
+				(const uint8_t *) genl + GENL_HDRLEN,
+				nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)))
+			continue;
+
+		/* The queue is empty here, keep what is left for later */
+		nlh = NLMSG_NEXT(nlh, len);
+		if (len > 0) {
+			memcpy(ctx->nlevq, nlh, len);
+			ctx->nlevq_len = len;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+int nfcnl_event_pending(struct nfcctl *ctx)
+{
+	return ctx->nlevq_len || ctx->nlevq_lost;
+}
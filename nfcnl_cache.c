@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+
+#include "nfcnl.h"
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_SIZE 36
+
+/* family << 32 | group, 0 when empty; shared by the contexts of a process */
+static _Atomic uint64_t cached_ids;
+
+static const char *cache_path(void)
+{
+	const char *path = getenv("NFCEX_GENL_CACHE");
+
+	return path ? path : NFCNL_CACHE_PATH;
+}
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -EIO;
+
+	buf[len] = '\0';
+	return len;
+}
+
+static int boot_id(char *id)
+{
+	char buf[BOOT_ID_SIZE + 2];
+
+	if (read_file(BOOT_ID_PATH, buf, sizeof(buf)) < BOOT_ID_SIZE)
+		return -ENOENT;
+
+	memcpy(id, buf, BOOT_ID_SIZE);
+	id[BOOT_ID_SIZE] = '\0';
+	return 0;
+}
+
+/* The file holds one line: "<boot id> <family> <group>" */
+int nfcnl_cache_get(struct nfcnl_ids *ids)
+{
+	uint64_t packed = atomic_load_explicit(&cached_ids,
+						memory_order_relaxed);
+	char id[BOOT_ID_SIZE + 1], file_id[BOOT_ID_SIZE + 1];
+	char buf[128];
+	unsigned family, group;
+
+	if (packed) {
+		ids->family = packed >> 32;
+		ids->group = (uint32_t) packed;
+		return 0;
+	}
+
+	if (boot_id(id) || read_file(cache_path(), buf, sizeof(buf)) < 0)
+		return -ENOENT;
+
+	if (sscanf(buf, "%36s %u %u", file_id, &family, &group) != 3 ||
+			strcmp(id, file_id) || !family || family > 0xffff ||
+			!group)
+		return -ENOENT;
+
+	ids->family = family;
+	ids->group = group;
+
+	atomic_store_explicit(&cached_ids, (uint64_t) family << 32 | group,
+							memory_order_relaxed);
+	return 0;
+}
+
+/* Best effort: without a writable runtime directory, only memory caches */
+void nfcnl_cache_put(const struct nfcnl_ids *ids)
+{
+	const char *path = cache_path();
+	char id[BOOT_ID_SIZE + 1];
+	char tmp[256], buf[128];
+	int fd, len;
+
+	atomic_store_explicit(&cached_ids,
+				(uint64_t) ids->family << 32 | ids->group,
+				memory_order_relaxed);
+
+	if (boot_id(id))
+		return;
+
+	len = snprintf(buf, sizeof(buf), "%s %u %u\n", id, ids->family,
+								ids->group);
+
+	/* Write aside and rename, so readers never see a partial line */
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid()) >=
+								sizeof(tmp))
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return;
+
+	if (write(fd, buf, len) != len) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	if (close(fd) || rename(tmp, path))
+		unlink(tmp);
+}
+
+void nfcnl_cache_drop(void)
+{
+	atomic_store_explicit(&cached_ids, 0, memory_order_relaxed);
+	unlink(cache_path());
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111EXIT_FAILURE307, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "nfcnl.h"
+#include "nlparse.h"
+#include "nfclog.h"
+
+static int nlerr2syserr(int err)
+{
+	switch (abs(err)) {
+	case NLE_BAD_SOCK:
+		return EBADF;
+	case NLE_EXIST:
+		return EEXIST;
+	case NLE_NOADDR:
+		return EADDRNOTAVAIL;
+	case NLE_OBJ_NOTFOUND:
+		return ENOENT;
+	case NLE_INTR:
+		return EINTR;
+	case NLE_AGAIN:
+		return EAGAIN;
+	case NLE_INVAL:
+		return EINVAL;
+	case NLE_NOACCESS:
+		return EACCES;
+	case NLE_NOMEM:
+		return ENOMEM;
+	case NLE_AF_NOSUPPORT:
+		return EAFNOSUPPORT;
+	case NLE_PROTO_MISMATCH:
+		return EPROTONOSUPPORT;
+	case NLE_OPNOTSUPP:
+		return EOPNOTSUPP;
+	case NLE_PERM:
+		return EPERM;
+	case NLE_BUSY:
+		return EBUSY;
+	case NLE_RANGE:
+		return ERANGE;
+	default:
+		return err;
+	}
+}
+
+struct event_hdl_data {
+	nfcnl_event_t handler;
+	void *arg;
+};
+
+static int event_handler(struct nl_msg *n, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(n));
+	struct event_hdl_data *hdl_data = arg;
+
+	if (hdl_data->handler(hdl_data->arg, gnlh->cmd,
+				genlmsg_attrdata(gnlh, 0),
+				genlmsg_attrlen(gnlh, 0)))
+		return NL_STOP;
+
+	return NL_SKIP;
+}
+
+static int no_seq_check(struct nl_msg *n, void *arg)
+{
+	return NL_OK;
+}
+
+int nfcnl_recv_event(struct nfcctl *ctx, nfcnl_event_t handler, void *arg)
+{
+	struct event_hdl_data hdl_data;
+	struct nl_cb *cb;
+	fd_set rfds;
+	int sockfd;
+	int rc;
+
+	cb = nl_cb_alloc(NL_CB_VERBOSE);
+	if (!cb) {
+		printdbg(ctx, "Error allocating struct nl_cb");
+		return -ENOMEM;
+	}
+
+	hdl_data.handler = handler;
+	hdl_data.arg = arg;
+
+	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, event_handler, &hdl_data);
+
+	do {
+		FD_ZERO(&rfds);
+
+		sockfd = nl_socket_get_fd(ctx->nlevsk);
+		FD_SET(sockfd, &rfds);
+
+		rc = select(sockfd + 1, &rfds, NULL, NULL, NULL);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc) {
+		if (FD_ISSET(sockfd, &rfds)) {
+			rc = nl_recvmsgs(ctx->nlevsk, cb);
+			if (rc) {
+				rc = -nlerr2syserr(rc);
+				goto out;
+			}
+		}
+	}
+
+	rc = 0;
+
+out:
+	nl_cb_put(cb);
+	return rc;
+}
+
+static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
+				void *arg)
+{
+	int *ret = arg;
+
+	*ret = err->error;
+
+	return NL_SKIP;
+}
+
+static int ack_handler(struct nl_msg *msg, void *arg)
+{
+	int *ack = arg;
+
+	*ack = 1;
+
+	return NL_STOP;
+}
+
+static int finish_handler(struct nl_msg *msg, void *arg)
+{
+	int *done = arg;
+
+	*done = 1;
+
+	return NL_SKIP;
+}
+
+static int send_and_recv_msgs(struct nfcctl *ctx, struct nl_msg *msg,
+				int (*handler)(struct nl_msg *, void *),
+				void *data)
+{
+	struct nl_cb *cb;
+	int err, done, rc;
+
+	printdbg(ctx, "IN");
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb) {
+		printdbg(ctx, "Error allocating struct nl_cb");
+		return -ENOMEM;
+	}
+
+	rc = nl_send_auto_complete(ctx->nlsk, msg);
+	if (rc < 0) {
+		rc = -nlerr2syserr(rc);
+		printdbg(ctx, "Error sending netlink message: %s",
+								strerror(-rc));
+		goto out;
+	}
+
+	err = done = 0;
+
+	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &done);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &done);
+
+	if (handler)
+		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, handler, data);
+
+	while (!err && !done) {
+		rc = nl_recvmsgs(ctx->nlsk, cb);
+		if (rc) {
+			rc = -nlerr2syserr(rc);
+			printdbg(ctx, "Error receiving netlink message: %s",
+								strerror(-rc));
+			goto out;
+		}
+	}
+
+	rc = -err;
+	if (rc)
+		printdbg(ctx, "Error message received: %s", strerror(-rc));
+
+out:
+	nl_cb_put(cb);
+	return rc;
+}
+
+int nfcnl_poll_cmd(struct nfcctl *ctx, uint8_t cmd, uint32_t dev_idx,
+							uint32_t protocols)
+{
+	struct nl_msg *msg;
+	void *hdr;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		printdbg(ctx, "Error allocating struct nl_msg");
+		return -ENOMEM;
+	}
+
+	hdr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, ctx->nlfamily, 0,
+			NLM_F_REQUEST, cmd, NFC_GENL_VERSION);
+	if (!hdr) {
+		printdbg(ctx, "Null header on genlmsg_put()");
+		rc = -EINVAL;
+		goto nla_put_failure;
+	}
+
+	NLA_PUT_U32(msg, NFC_ATTR_DEVICE_INDEX, dev_idx);
+	if (cmd == NFC_CMD_START_POLL)
+		NLA_PUT_U32(msg, NFC_ATTR_PROTOCOLS, protocols);
+
+	rc = send_and_recv_msgs(ctx, msg, NULL, NULL);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return rc;
+}
+
+struct get_devices_hdl_data {
+	struct nfcctl *ctx;
+	struct nfc_dev *devl;
+	uint8_t devl_count;
+	uint8_t devl_max;
+};
+
+static int get_devices_handler(struct nl_msg *n, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(n));
+	struct get_devices_hdl_data *hdl_data = arg;
+	struct nfcctl *ctx = hdl_data->ctx;
+
+	printdbg(ctx, "IN");
+
+	if (hdl_data->devl_count >= hdl_data->devl_max) {
+		printdbg(ctx, "There are discarded NFC devices");
+		return NL_STOP;
+	}
+
+	if (nl_parse_device(genlmsg_attrdata(gnlh, 0),
+			genlmsg_attrlen(gnlh, 0),
+			&hdl_data->devl[hdl_data->devl_count])) {
+		printdbg(ctx, "Missing attribute in NFC_CMD_GET_DEVICE reply");
+		return NL_STOP;
+	}
+
+	hdl_data->devl_count++;
+
+	return NL_SKIP;
+}
+
+int nfcnl_get_devices(struct nfcctl *ctx, struct nfc_dev *devl,
+							uint8_t devl_max)
+{
+	struct nl_msg *msg;
+	void *hdr;
+	struct get_devices_hdl_data hdl_data;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		printdbg(ctx, "Error allocating struct nl_msg");
+		return -ENOMEM;
+	}
+
+	hdr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, ctx->nlfamily, 0,
+			  NLM_F_DUMP, NFC_CMD_GET_DEVICE, NFC_GENL_VERSION);
+	if (!hdr) {
+		printdbg(ctx, "Null header on genlmsg_put()");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	hdl_data.ctx = ctx;
+	hdl_data.devl = devl;
+	hdl_data.devl_count = 0;
+	hdl_data.devl_max = devl_max;
+
+	rc = send_and_recv_msgs(ctx, msg, get_devices_handler, &hdl_data);
+	if (rc)
+		goto out;
+
+	rc = hdl_data.devl_count;
+
+out:
+	nlmsg_free(msg);
+	return rc;
+}
+
+struct get_multicast_id_hdl_data {
+	struct nfcctl *ctx;
+	const char *group;
+	int id;
+};
+
+static int get_multicast_id_handler(struct nl_msg *msg, void *arg)
+{
+	struct get_multicast_id_hdl_data *hdl_data = arg;
+	struct nfcctl *ctx = hdl_data->ctx;
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *mcgrp;
+	int i;
+
+	printdbg(ctx, "IN");
+
+	nla_parse(tb, CTRL_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return NL_SKIP;
+
+	nla_for_each_nested(mcgrp, tb[CTRL_ATTR_MCAST_GROUPS], i) {
+		struct nlattr *tb2[CTRL_ATTR_MCAST_GRP_MAX + 1];
+
+		nla_parse(tb2, CTRL_ATTR_MCAST_GRP_MAX, nla_data(mcgrp),
+			  nla_len(mcgrp), NULL);
+		if (!tb2[CTRL_ATTR_MCAST_GRP_NAME] ||
+		    !tb2[CTRL_ATTR_MCAST_GRP_ID] ||
+		    strncmp(nla_data(tb2[CTRL_ATTR_MCAST_GRP_NAME]),
+			       hdl_data->group,
+			       nla_len(tb2[CTRL_ATTR_MCAST_GRP_NAME])))
+			continue;
+
+		hdl_data->id = nla_get_u32(tb2[CTRL_ATTR_MCAST_GRP_ID]);
+		break;
+	};
+
+	return NL_SKIP;
+}
+
+static int get_multicast_id(struct nfcctl *ctx, const char *family,
+					const char *group)
+{
+	struct nl_msg *msg;
+	void *hdr;
+	struct get_multicast_id_hdl_data hdl_data;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		printdbg(ctx, "Error allocating struct nl_msg");
+		return -ENOMEM;
+	}
+
+	hdr = genlmsg_put(msg, 0, 0, genl_ctrl_resolve(ctx->nlsk, "nlctrl"), 0,
+			0, CTRL_CMD_GETFAMILY, 0);
+	if (!hdr) {
+		printdbg(ctx, "Null header on genlmsg_put()");
+		rc = -EINVAL;
+		goto nla_put_failure;
+	}
+
+	NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, family);
+
+	hdl_data.ctx = ctx;
+	hdl_data.group = group;
+	hdl_data.id = 0;
+
+	rc = send_and_recv_msgs(ctx, msg, get_multicast_id_handler, &hdl_data);
+	if (rc)
+		goto nla_put_failure;
+
+	rc = hdl_data.id;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return rc;
+}
+
+int nfcnl_open(struct nfcctl *ctx, struct nfcnl_ids *ids)
+{
+	int id;
+	int rc;
+
+	ctx->nlsk = nl_socket_alloc();
+	if (!ctx->nlsk) {
+		printdbg(ctx, "Invalid context");
+		return -ENOMEM;
+	}
+
+	rc = genl_connect(ctx->nlsk);
+	if (rc) {
+		rc = -nlerr2syserr(rc);
+		printdbg(ctx, "Error connecting to generic netlink: %s",
+								strerror(-rc));
+		goto free_nlsk;
+	}
+
+	if (ids->family) {
+		ctx->nlfamily = ids->family;
+		goto join;
+	}
+
+	ctx->nlfamily = genl_ctrl_resolve(ctx->nlsk, NFC_GENL_NAME);
+	if (ctx->nlfamily < 0) {
+		rc = -nlerr2syserr(ctx->nlfamily);
+		printdbg(ctx, "Error resolving genl NFC family: %s",
+								strerror(-rc));
+		goto free_nlsk;
+	}
+
+	id = get_multicast_id(ctx, NFC_GENL_NAME,
+					NFC_GENL_MCAST_EVENT_NAME);
+	if (id <= 0) {
+		rc = id ? id : -ENOENT;
+		goto free_nlsk;
+	}
+
+	ids->family = ctx->nlfamily;
+	ids->group = id;
+
+join:
+	/*
+	 * Events get a socket of their own: on the request one, an event
+	 * arriving while a reply is awaited would fail the sequence check
+	 * and be consumed with the reply.
+	 */
+	ctx->nlevsk = nl_socket_alloc();
+	if (!ctx->nlevsk) {
+		rc = -ENOMEM;
+		goto free_nlsk;
+	}
+
+	nl_socket_disable_seq_check(ctx->nlevsk);
+
+	rc = genl_connect(ctx->nlevsk);
+	if (rc) {
+		rc = -nlerr2syserr(rc);
+		printdbg(ctx, "Error connecting to generic netlink: %s",
+								strerror(-rc));
+		goto free_nlevsk;
+	}
+
+	rc = nl_socket_add_membership(ctx->nlevsk, ids->group);
+	if (rc) {
+		printdbg(ctx, "Error adding nl socket to membership");
+		rc = -nlerr2syserr(rc);
+		goto free_nlevsk;
+	}
+
+	return 0;
+
+free_nlevsk:
+	nl_socket_free(ctx->nlevsk);
+	ctx->nlevsk = NULL;
+free_nlsk:
+	nl_socket_free(ctx->nlsk);
+	ctx->nlsk = NULL;
+	return rc;
+}
+
+void nfcnl_close(struct nfcctl *ctx)
+{
+	if (ctx->nlsk) {
+		nl_socket_free(ctx->nlevsk);
+		nl_socket_free(ctx->nlsk);
+		ctx->nlevsk = NULL;
+		ctx->nlsk = NULL;
+	}
+}
+
+int nfcnl_get_fd(struct nfcctl *ctx)
+{
+	return nl_socket_get_fd(ctx->nlevsk);
+}
+
+/* Events wait in their own socket, nothing is queued */
+int nfcnl_event_pending(struct nfcctl *ctx)
+{
+	return 0;
+}
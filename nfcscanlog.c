@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "scanlog.h"
+#include "nfclog.h"
+
+/*
+ * Companion tool of the inventory mode: prints or summarizes scan logs.
+ * Files are mapped and walked in place, so millions of records go by at
+ * memory speed.
+ */
+
+#define PROTO_COUNT 5
+
+struct filter {
+	int dev_idx;			/* -1 for any */
+	uint8_t uid[SCANLOG_UID_MAX];
+	size_t uid_len;			/* 0 for any */
+	uint64_t since_ns;
+};
+
+/* Open addressing set of UID hashes, for counting distinct tags */
+struct uid_set {
+	uint64_t *slots;		/* 0 is an empty slot */
+	size_t size;			/* power of two */
+	size_t count;
+};
+
+struct summary {
+	uint64_t records;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint64_t no_uid;
+	uint64_t proto[PROTO_COUNT];
+	struct uid_set uids;
+};
+
+static int uid_set_insert(struct uid_set *set, uint64_t h);
+
+static int uid_set_grow(struct uid_set *set)
+{
+	struct uid_set old = *set;
+	size_t i;
+
+	set->size = old.size ? old.size * 2 : 1024;
+	set->count = 0;
+	set->slots = calloc(set->size, sizeof(*set->slots));
+	if (!set->slots) {
+		*set = old;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < old.size; i++) {
+		if (old.slots[i])
+			uid_set_insert(set, old.slots[i]);
+	}
+
+	free(old.slots);
+	return 0;
+}
+
+static int uid_set_insert(struct uid_set *set, uint64_t h)
+{
+	size_t i;
+
+	if (!h)
+		h = 1;
+
+	if (2 * (set->count + 1) > set->size && uid_set_grow(set))
+		return -ENOMEM;
+
+	for (i = h & (set->size - 1); set->slots[i];
+					i = (i + 1) & (set->size - 1)) {
+		if (set->slots[i] == h)
+			return 0;
+	}
+
+	set->slots[i] = h;
+	set->count++;
+	return 0;
+}
+
+static int match(const struct filter *f, const struct scanlog_rec *rec)
+{
+	if (f->dev_idx >= 0 && rec->dev_idx != f->dev_idx)
+		return 0;
+
+	if (f->uid_len && (rec->uid_len != f->uid_len ||
+				memcmp(rec->uid, f->uid, f->uid_len)))
+		return 0;
+
+	return rec->time_ns >= f->since_ns;
+}
+
+static void print_rec(const struct scanlog_rec *rec)
+{
+	unsigned i;
+
+	printf("%llu.%09llu\t%u\t%u\t0x%x\t",
+		(unsigned long long) rec->time_ns / 1000000000ULL,
+		(unsigned long long) rec->time_ns % 1000000000ULL,
+		rec->dev_idx, rec->tgt_idx, rec->protocols);
+
+	for (i = 0; i < rec->uid_len && i < SCANLOG_UID_MAX; i++)
+		printf("%02x", rec->uid[i]);
+	if (!rec->uid_len)
+		printf("-");
+
+	if (rec->flags & SCANLOG_REC_HASH)
+		printf("\t%u\t%016llx\n", rec->payload_len,
+				(unsigned long long) rec->hash);
+	else
+		printf("\t-\t-\n");
+}
+
+static void account(struct summary *sum, const struct scanlog_rec *rec)
+{
+	unsigned i;
+
+	if (!sum->records || rec->time_ns < sum->first_ns)
+		sum->first_ns = rec->time_ns;
+	if (rec->time_ns > sum->last_ns)
+		sum->last_ns = rec->time_ns;
+
+	sum->records++;
+
+	for (i = 0; i < PROTO_COUNT; i++) {
+		if (rec->protocols & (1 << i))
+			sum->proto[i]++;
+	}
+
+	if (rec->uid_len)
+		uid_set_insert(&sum->uids, scanlog_hash(rec->uid,
+							rec->uid_len));
+	else
+		sum->no_uid++;
+}
+
+static int scan_file(const char *path, const struct filter *f,
+						struct summary *sum)
+{
+	struct scanlog log;
+	uint64_t i, count;
+	int rc;
+
+	rc = scanlog_open(&log, path);
+	if (rc) {
+		printerr("%s: %s", path, strerror(-rc));
+		return rc;
+	}
+
+	count = scanlog_count(&log);
+
+	for (i = 0; i < count; i++) {
+		const struct scanlog_rec *rec = &log.recs[i];
+
+		if (!match(f, rec))
+			continue;
+
+		if (sum)
+			account(sum, rec);
+		else
+			print_rec(rec);
+	}
+
+	scanlog_close(&log);
+	return 0;
+}
+
+static void print_summary(const struct summary *sum)
+{
+	static const char *names[PROTO_COUNT] = {
+		"jewel", "mifare", "felica", "iso14443", "nfc-dep",
+	};
+	double span = (sum->last_ns - sum->first_ns) / 1e9;
+	unsigned i;
+
+	printf("Records:\t%llu\n"
+		"Distinct UIDs:\t%zu\n"
+		"Without UID:\t%llu\n"
+		"Time span:\t%.3f s\n",
+		(unsigned long long) sum->records, sum->uids.count,
+		(unsigned long long) sum->no_uid, sum->records ? span : 0);
+
+	for (i = 0; i < PROTO_COUNT; i++) {
+		if (sum->proto[i])
+			printf("%s:\t%s%llu\n", names[i],
+				strlen(names[i]) < 7 ? "\t" : "",
+				(unsigned long long) sum->proto[i]);
+	}
+}
+
+static int parse_uid(const char *hex, struct filter *f)
+{
+	size_t len = strlen(hex);
+	unsigned i, byte;
+
+	if (!len || len % 2 || len / 2 > SCANLOG_UID_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+			return -EINVAL;
+		f->uid[i] = byte;
+	}
+
+	f->uid_len = len / 2;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-s] [-d DEV] [-u UID] [-t SECONDS] FILE...\n"
+		"Option:\t\t\tDescription:\n"
+		"-s, --summary\t\tCount records instead of printing them\n"
+		"-d, --device\t\tOnly records of device DEV\n"
+		"-u, --uid\t\tOnly records of UID, in hex\n"
+		"-t, --since\t\tOnly records from SECONDS since the epoch\n\n"
+		"Records print as time, device, target, protocols, UID,\n"
+		"payload length and payload hash, tab separated.\n",
+		prog);
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option lops[] = {
+		{ "summary", no_argument, NULL, 's' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "uid", required_argument, NULL, 'u' },
+		{ "since", required_argument, NULL, 't' },
+		{ 0, 0, 0, 0 },
+	};
+	struct filter f = { .dev_idx = -1 };
+	struct summary sum;
+	int summary = 0;
+	int opt, i;
+	int rc = 0;
+
+	for (;;) {
+		opt = getopt_long(argc, argv, "sd:u:t:", lops, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 's':
+			summary = 1;
+			break;
+		case 'd':
+			f.dev_idx = atoi(optarg);
+			break;
+		case 'u':
+			if (parse_uid(optarg, &f))
+				usage(*argv);
+			break;
+		case 't':
+			f.since_ns = strtoull(optarg, NULL, 0) * 1000000000ULL;
+			break;
+		default:
+			usage(*argv);
+		}
+	}
+
+	if (optind == argc)
+		usage(*argv);
+
+	memset(&sum, 0, sizeof(sum));
+
+	for (i = optind; i < argc; i++) {
+		if (scan_file(argv[i], &f, summary ? &sum : NULL))
+			rc = EXIT_FAILURE;
+	}
+
+	if (summary)
+		print_summary(&sum);
+
+	free(sum.uids.slots);
+	return rc;
+}
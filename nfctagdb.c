@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "tagdb.h"
+#include "nfclog.h"
+
+/*
+ * Companion tool of the tag database: creates one, prints its entries or
+ * one of them, and sets the owner of a tag. Setting an owner makes this
+ * tool the writer, so it fails while an inventory feeds the same
+ * database.
+ */
+
+static void print_time(uint64_t ns)
+{
+	printf("%llu.%09llu\t", (unsigned long long) ns / 1000000000ULL,
+				(unsigned long long) ns % 1000000000ULL);
+}
+
+static void print_entry(const struct tagdb_entry *e)
+{
+	unsigned i;
+
+	for (i = 0; i < e->uid_len; i++)
+		printf("%02x", e->uid[i]);
+
+	printf("\t%.*s\t", TAGDB_OWNER_MAX, e->owner[0] ? e->owner : "-");
+	print_time(e->first_seen);
+	print_time(e->last_seen);
+	printf("%u\t%u\t%u\t", e->last_dev, e->reads, e->writes);
+
+	if (e->payload_len)
+		printf("%u\t%016llx\n", e->payload_len,
+				(unsigned long long) e->payload_hash);
+	else
+		printf("-\t-\n");
+}
+
+static int parse_uid(const char *hex, uint8_t *uid, size_t *uid_len)
+{
+	size_t len = strlen(hex);
+	unsigned i, byte;
+
+	if (!len || len % 2 || len / 2 > TAGDB_UID_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+			return -EINVAL;
+		uid[i] = byte;
+	}
+
+	*uid_len = len / 2;
+	return 0;
+}
+
+static int set_owner(const char *path, const uint8_t *uid, size_t uid_len,
+							const char *owner)
+{
+	struct tagdb db;
+	struct tagdb_entry e;
+	int rc;
+
+	rc = tagdb_create(&db, path, TAGDB_ENTRIES_DEFAULT);
+	if (rc)
+		return rc;
+
+	if (tagdb_lookup(&db, uid, uid_len, &e)) {
+		memset(&e, 0, sizeof(e));
+		e.uid_len = uid_len;
+		memcpy(e.uid, uid, uid_len);
+	}
+
+	memset(e.owner, 0, sizeof(e.owner));
+	strncpy(e.owner, owner, sizeof(e.owner));
+
+	rc = tagdb_update(&db, &e);
+
+	tagdb_close(&db);
+	return rc;
+}
+
+static int dump(const char *path, const uint8_t *uid, size_t uid_len)
+{
+	struct tagdb db;
+	struct tagdb_entry e;
+	uint64_t i;
+	int rc;
+
+	rc = tagdb_open(&db, path);
+	if (rc) {
+		printerr("%s: %s", path, strerror(-rc));
+		return rc;
+	}
+
+	if (uid_len) {
+		rc = tagdb_lookup(&db, uid, uid_len, &e);
+		if (rc == -ENOENT)
+			fprintf(stderr, "No such tag in %s\n", path);
+		else if (rc)
+			printerr("%s: %s", path, strerror(-rc));
+		else
+			print_entry(&e);
+		goto close;
+	}
+
+	for (i = 0; i < db.hdr->capacity; i++) {
+		if (!atomic_load_explicit(&db.slots[i].seq,
+							memory_order_acquire))
+			continue;
+
+		/* Same copy as a lookup, the writer may be running */
+		if (!tagdb_lookup(&db, db.slots[i].e.uid,
+						db.slots[i].e.uid_len, &e))
+			print_entry(&e);
+	}
+
+	fprintf(stderr, "%llu of %llu entries in use\n",
+			(unsigned long long) tagdb_count(&db),
+			(unsigned long long) db.hdr->capacity / 4 * 3);
+
+close:
+	tagdb_close(&db);
+	return rc;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-c ENTRIES] [-u UID [-o OWNER]] DB\n"
+		"Option:\t\t\tDescription:\n"
+		"-c, --create\t\tCreate DB for ENTRIES tags\n"
+		"-u, --uid\t\tOnly the tag of UID, in hex\n"
+		"-o, --owner\t\tSet the owner of the tag of UID\n\n"
+		"Entries print as UID, owner, first and last seen, last\n"
+		"device, reads, writes, payload length and payload hash,\n"
+		"tab separated.\n",
+		prog);
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option lops[] = {
+		{ "create", required_argument, NULL, 'c' },
+		{ "uid", required_argument, NULL, 'u' },
+		{ "owner", required_argument, NULL, 'o' },
+		{ 0, 0, 0, 0 },
+	};
+	uint8_t uid[TAGDB_UID_MAX];
+	size_t uid_len = 0;
+	const char *owner = NULL;
+	unsigned long long entries = 0;
+	struct tagdb db;
+	int opt;
+	int rc;
+
+	for (;;) {
+		opt = getopt_long(argc, argv, "c:u:o:", lops, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'c':
+			entries = strtoull(optarg, NULL, 0);
+			if (!entries)
+				usage(*argv);
+			break;
+		case 'u':
+			if (parse_uid(optarg, uid, &uid_len))
+				usage(*argv);
+			break;
+		case 'o':
+			owner = optarg;
+			break;
+		default:
+			usage(*argv);
+		}
+	}
+
+	if (optind != argc - 1 || (owner && !uid_len))
+		usage(*argv);
+
+	if (entries) {
+		rc = tagdb_create(&db, argv[optind], entries);
+		if (!rc)
+			tagdb_close(&db);
+	} else if (owner) {
+		rc = set_owner(argv[optind], uid, uid_len, owner);
+	} else {
+		rc = dump(argv[optind], uid, uid_len);
+	}
+
+	if (rc == -EBUSY)
+		printerr("%s: in use by another writer", argv[optind]);
+	else if (rc && (entries || owner))
+		printerr("%s: %s", argv[optind], strerror(-rc));
+
+	return rc ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "taglist.h"
+#include "nfclog.h"
+
+/*
+ * Companion tool of the gate mode: builds allow/deny lists from UIDs in
+ * hex, one per line, and checks UIDs against a list. Rebuilding a list in
+ * use is safe, the gate switches to the new file on the next tag.
+ */
+
+static int parse_uid(const char *hex, struct taglist_uid *u)
+{
+	size_t len = strlen(hex);
+	unsigned i, byte;
+
+	if (!len || len % 2 || len / 2 > TAGLIST_UID_MAX)
+		return -EINVAL;
+
+	memset(u, 0, sizeof(*u));
+
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+			return -EINVAL;
+		u->uid[i] = byte;
+	}
+
+	u->len = len / 2;
+	return 0;
+}
+
+static int build(const char *path, FILE *in)
+{
+	struct taglist_uid *uids = NULL, *p;
+	size_t count = 0, max = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned long lineno = 0;
+	int rc;
+
+	/* Whole lines, so that a long comment is never read as a UID */
+	while (getline(&line, &line_size, in) != -1) {
+		lineno++;
+		line[strcspn(line, " \t\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		if (count == max) {
+			max = max ? max * 2 : 4096;
+			p = realloc(uids, max * sizeof(*uids));
+			if (!p) {
+				rc = -ENOMEM;
+				goto out;
+			}
+			uids = p;
+		}
+
+		if (parse_uid(line, &uids[count])) {
+			printerr("line %lu: invalid UID %s", lineno, line);
+			rc = -EINVAL;
+			goto out;
+		}
+		count++;
+	}
+
+	if (ferror(in)) {
+		rc = -EIO;
+		goto out;
+	}
+
+	rc = taglist_build(path, uids, count);
+
+out:
+	free(line);
+	free(uids);
+	return rc;
+}
+
+static void print_stats(const struct taglist *list)
+{
+	const struct taglist_hdr *hdr = list->map.hdr;
+
+	printf("UIDs:\t\t%llu\n"
+		"Filter:\t\t%llu bytes\n"
+		"File:\t\t%zu bytes\n",
+		(unsigned long long) hdr->count,
+		(unsigned long long) hdr->blocks *
+					sizeof(struct taglist_block),
+		list->map.map_size);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s -b LIST < UIDS\n"
+		"       %s [-s] LIST [UID...]\n"
+		"Option:\t\t\tDescription:\n"
+		"-b, --build\t\tBuild LIST from UIDs in hex, one per line\n"
+		"-s, --stats\t\tPrint the size of LIST\n\n"
+		"Each UID given prints followed by present or absent.\n",
+		prog, prog);
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option lops[] = {
+		{ "build", no_argument, NULL, 'b' },
+		{ "stats", no_argument, NULL, 's' },
+		{ 0, 0, 0, 0 },
+	};
+	struct taglist list;
+	struct taglist_uid u;
+	int building = 0, stats = 0;
+	int opt, i;
+	int rc;
+
+	for (;;) {
+		opt = getopt_long(argc, argv, "bs", lops, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'b':
+			building = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		default:
+			usage(*argv);
+		}
+	}
+
+	if (optind == argc || (building && optind != argc - 1))
+		usage(*argv);
+
+	if (building) {
+		rc = build(argv[optind], stdin);
+		if (rc)
+			printerr("%s: %s", argv[optind], strerror(-rc));
+		return rc ? EXIT_FAILURE : 0;
+	}
+
+	rc = taglist_open(&list, argv[optind]);
+	if (rc) {
+		printerr("%s: %s", argv[optind], strerror(-rc));
+		return EXIT_FAILURE;
+	}
+
+	if (stats)
+		print_stats(&list);
+
+	for (i = optind + 1; i < argc; i++) {
+		if (parse_uid(argv[i], &u)) {
+			printerr("invalid UID %s", argv[i]);
+			rc = -EINVAL;
+			continue;
+		}
+
+		printf("%s\t%s\n", argv[i],
+			taglist_check(&list, u.uid, u.len) == TAGLIST_PRESENT ?
+							"present" : "absent");
+	}
+
+	taglist_close(&list);
+	return rc ? EXIT_FAILURE : 0;
+}
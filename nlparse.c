@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "nlparse.h"
+
+/* Next attribute in [*pos, end), or NULL once the buffer is exhausted */
+static const struct nlattr *next_attr(const uint8_t **pos, const uint8_t *end,
+							int *err)
+{
+	const struct nlattr *nla = (const struct nlattr *) *pos;
+	size_t rem = end - *pos;
+	size_t step;
+
+	if (rem < NLA_HDRLEN)
+		return NULL;
+
+	if (nla->nla_len < NLA_HDRLEN || nla->nla_len > rem) {
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	/* The last attribute may lack its padding */
+	step = NLA_ALIGN(nla->nla_len);
+	*pos = step < rem ? *pos + step : end;
+
+	return nla;
+}
+
+static int get_u32(const struct nlattr *nla, uint32_t *val)
+{
+	if (nla->nla_len < NLA_HDRLEN + sizeof(uint32_t))
+		return -EINVAL;
+
+	memcpy(val, (const uint8_t *) nla + NLA_HDRLEN, sizeof(*val));
+	return 0;
+}
+
+static int get_u16(const struct nlattr *nla, uint16_t *val)
+{
+	if (nla->nla_len < NLA_HDRLEN + sizeof(uint16_t))
+		return -EINVAL;
+
+	memcpy(val, (const uint8_t *) nla + NLA_HDRLEN, sizeof(*val));
+	return 0;
+}
+
+/* Copy a string attribute, which need not be NUL terminated, into buf */
+static void get_string(const struct nlattr *nla, char *buf, size_t size)
+{
+	size_t len = nla->nla_len - NLA_HDRLEN;
+
+	if (len > size - 1)
+		len = size - 1;
+
+	memcpy(buf, (const uint8_t *) nla + NLA_HDRLEN, len);
+	buf[len] = '\0';
+}
+
+/* One nested target: both of its attributes are mandatory */
+static int parse_target(const struct nlattr *tgt, uint32_t *idx,
+							uint32_t *protocols)
+{
+	const uint8_t *pos = (const uint8_t *) tgt + NLA_HDRLEN;
+	const uint8_t *end = (const uint8_t *) tgt + tgt->nla_len;
+	const struct nlattr *nla;
+	unsigned seen = 0;
+	int err = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NFC_TARGET_ATTR_TARGET_INDEX:
+			err = get_u32(nla, idx);
+			seen |= 1;
+			break;
+		case NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS:
+			err = get_u32(nla, protocols);
+			seen |= 2;
+			break;
+		}
+		if (err)
+			return err;
+	}
+
+	if (err || seen != 3)
+		return -EINVAL;
+
+	return 0;
+}
+
+int nl_parse_device_index(const void *attrs, size_t len, uint32_t *dev_idx)
+{
+	const uint8_t *pos = attrs;
+	const uint8_t *end = pos + len;
+	const struct nlattr *nla;
+	int err = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		if ((nla->nla_type & NLA_TYPE_MASK) == NFC_ATTR_DEVICE_INDEX)
+			return get_u32(nla, dev_idx);
+	}
+
+	return -EINVAL;
+}
+
+int nl_parse_targets_found(const void *attrs, size_t len,
+					struct nfc_target_batch *batch)
+{
+	const uint8_t *pos = attrs;
+	const uint8_t *end = pos + len;
+	const struct nlattr *nla, *tgt;
+	const uint8_t *tpos, *tend;
+	uint32_t idx, protocols;
+	int have_dev = 0, have_targets = 0;
+	int total = 0;
+	int err = 0;
+
+	batch->count = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NFC_ATTR_DEVICE_INDEX:
+			err = get_u32(nla, &batch->dev_idx);
+			have_dev = 1;
+			break;
+		case NFC_ATTR_TARGETS:
+			have_targets = 1;
+			tpos = (const uint8_t *) nla + NLA_HDRLEN;
+			tend = (const uint8_t *) nla + nla->nla_len;
+
+			while (!err && (tgt = next_attr(&tpos, tend, &err))) {
+				err = parse_target(tgt, &idx, &protocols);
+				if (err)
+					break;
+
+				total++;
+				if (batch->count == batch->max)
+					continue;
+
+				batch->idx[batch->count] = idx;
+				batch->protocols[batch->count] = protocols;
+				batch->count++;
+			}
+			break;
+		}
+		if (err)
+			break;
+	}
+
+	if (err || !have_dev || !have_targets) {
+		batch->count = 0;
+		return -EINVAL;
+	}
+
+	return total;
+}
+
+int nl_parse_device(const void *attrs, size_t len, struct nfc_dev *dev)
+{
+	const uint8_t *pos = attrs;
+	const uint8_t *end = pos + len;
+	const struct nlattr *nla;
+	unsigned seen = 0;
+	int err = 0;
+
+	dev->protocols = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NFC_ATTR_DEVICE_INDEX:
+			err = get_u32(nla, &dev->idx);
+			seen |= 1;
+			break;
+		case NFC_ATTR_DEVICE_NAME:
+			get_string(nla, dev->name, sizeof(dev->name));
+			seen |= 2;
+			break;
+		case NFC_ATTR_PROTOCOLS:
+			err = get_u32(nla, &dev->protocols);
+			break;
+		}
+		if (err)
+			return err;
+	}
+
+	if (err || seen != 3)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int match_group(const struct nlattr *grp, const char *group,
+							uint32_t *group_id)
+{
+	const uint8_t *pos = (const uint8_t *) grp + NLA_HDRLEN;
+	const uint8_t *end = (const uint8_t *) grp + grp->nla_len;
+	const struct nlattr *nla;
+	char name[GENL_NAMSIZ];
+	uint32_t id = 0;
+	int named = 0;
+	int err = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case CTRL_ATTR_MCAST_GRP_NAME:
+			get_string(nla, name, sizeof(name));
+			named = !strcmp(name, group);
+			break;
+		case CTRL_ATTR_MCAST_GRP_ID:
+			err = get_u32(nla, &id);
+			break;
+		}
+		if (err)
+			return err;
+	}
+
+	if (named && !err)
+		*group_id = id;
+
+	return err;
+}
+
+int nl_parse_family(const void *attrs, size_t len, const char *group,
+					uint16_t *family, uint32_t *group_id)
+{
+	const uint8_t *pos = attrs;
+	const uint8_t *end = pos + len;
+	const struct nlattr *nla, *grp;
+	const uint8_t *gpos, *gend;
+	int have_family = 0;
+	int err = 0;
+
+	*group_id = 0;
+
+	while ((nla = next_attr(&pos, end, &err))) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case CTRL_ATTR_FAMILY_ID:
+			err = get_u16(nla, family);
+			have_family = 1;
+			break;
+		case CTRL_ATTR_MCAST_GROUPS:
+			gpos = (const uint8_t *) nla + NLA_HDRLEN;
+			gend = (const uint8_t *) nla + nla->nla_len;
+
+			while (!err && (grp = next_attr(&gpos, gend, &err)))
+				err = match_group(grp, group, group_id);
+			break;
+		}
+		if (err)
+			return err;
+	}
+
+	if (err || !have_family)
+		return -EINVAL;
+
+	return 0;
+}
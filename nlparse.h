@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _NLPARSE_H_
+#define _NLPARSE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nfcctl.h"
+
+/*
+ * Parser specialized for NFC_EVENT_TARGETS_FOUND. It walks the attributes
+ * of the event once and stores the device index and every target straight
+ * into batch, checking each length against the message instead of filling
+ * generic attribute tables.
+ *
+ * attrs and len cover the attributes following the genl header. Returns
+ * the number of targets in the event, which is more than batch->count when
+ * batch was too small, or -EINVAL for a malformed event.
+ */
+int nl_parse_targets_found(const void *attrs, size_t len,
+					struct nfc_target_batch *batch);
+
+/* One NFC_CMD_GET_DEVICE reply. Returns 0 or -EINVAL */
+int nl_parse_device(const void *attrs, size_t len, struct nfc_dev *dev);
+
+/* NFC_ATTR_DEVICE_INDEX alone, as in NFC_EVENT_DEVICE_REMOVED */
+int nl_parse_device_index(const void *attrs, size_t len, uint32_t *dev_idx);
+
+/*
+ * CTRL_CMD_GETFAMILY reply: the family id and the id of its multicast
+ * group named group, 0 if the family has no such group. Returns 0 or
+ * -EINVAL.
+ */
+int nl_parse_family(const void *attrs, size_t len, const char *group,
+					uint16_t *family, uint32_t *group_id);
+
+#endif /* _NLPARSE_H_ */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Microbenchmark for the NFC_EVENT_TARGETS_FOUND parsers: builds a
+ * synthetic event with many targets and times the specialized parser of
+ * nlparse.c against the generic nla_parse() walk nfcctl used before.
+ *
+ * Usage: parse_bench [TARGETS [ITERATIONS]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <netlink/netlink.h>
+#include <netlink/attr.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "nlparse.h"
+
+#define ATTR_SIZE(payload) NLA_ALIGN(NLA_HDRLEN + (payload))
+#define TARGET_SIZE (ATTR_SIZE(2 * ATTR_SIZE(sizeof(uint32_t))))
+
+static uint8_t *put_attr(uint8_t *pos, uint16_t type, const void *data,
+							uint16_t len)
+{
+	struct nlattr *nla = (struct nlattr *) pos;
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memset(pos + NLA_HDRLEN, 0, NLA_ALIGN(len));
+	memcpy(pos + NLA_HDRLEN, data, len);
+
+	return pos + NLA_ALIGN(nla->nla_len);
+}
+
+static uint8_t *put_u32(uint8_t *pos, uint16_t type, uint32_t val)
+{
+	return put_attr(pos, type, &val, sizeof(val));
+}
+
+/* Lay the event out as the kernel does: device index, then the nest */
+static size_t build_event(uint8_t *buf, unsigned count)
+{
+	struct nlattr *targets, *tgt;
+	uint8_t *pos = buf;
+	unsigned i;
+
+	pos = put_u32(pos, NFC_ATTR_DEVICE_INDEX, 1);
+
+	targets = (struct nlattr *) pos;
+	targets->nla_type = NFC_ATTR_TARGETS;
+	pos += NLA_HDRLEN;
+
+	for (i = 0; i < count; i++) {
+		tgt = (struct nlattr *) pos;
+		tgt->nla_type = i + 1;
+		pos += NLA_HDRLEN;
+
+		pos = put_u32(pos, NFC_TARGET_ATTR_TARGET_INDEX, i);
+		pos = put_u32(pos, NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS,
+					1 << (i % NFC_PROTO_MAX));
+
+		tgt->nla_len = pos - (uint8_t *) tgt;
+	}
+
+	targets->nla_len = pos - (uint8_t *) targets;
+
+	return pos - buf;
+}
+
+/* The generic walk: one attribute table per level, zeroed per target */
+static int parse_generic(void *attrs, int len, struct nfc_target_batch *batch)
+{
+	struct nlattr *attr[NFC_ATTR_MAX + 1];
+	struct nlattr *attr_nest[NFC_TARGET_ATTR_MAX + 1];
+	struct nlattr *attr_tgt;
+	int rem;
+
+	batch->count = 0;
+
+	nla_parse(attr, NFC_ATTR_MAX, attrs, len, NULL);
+	if (!attr[NFC_ATTR_TARGETS] || !attr[NFC_ATTR_DEVICE_INDEX])
+		return -1;
+
+	batch->dev_idx = nla_get_u32(attr[NFC_ATTR_DEVICE_INDEX]);
+
+	nla_for_each_nested(attr_tgt, attr[NFC_ATTR_TARGETS], rem) {
+		nla_parse(attr_nest, NFC_TARGET_ATTR_MAX, nla_data(attr_tgt),
+				nla_len(attr_tgt), NULL);
+		if (!attr_nest[NFC_TARGET_ATTR_TARGET_INDEX] ||
+			!attr_nest[NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS])
+			return -1;
+
+		if (batch->count == batch->max)
+			continue;
+
+		batch->idx[batch->count] = nla_get_u32(
+				attr_nest[NFC_TARGET_ATTR_TARGET_INDEX]);
+		batch->protocols[batch->count] = nla_get_u32(
+				attr_nest[NFC_TARGET_ATTR_SUPPORTED_PROTOCOLS]);
+		batch->count++;
+	}
+
+	return batch->count;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t checksum(const struct nfc_target_batch *batch)
+{
+	uint32_t sum = batch->dev_idx;
+	unsigned i;
+
+	for (i = 0; i < batch->count; i++)
+		sum = sum * 31 + batch->idx[i] + batch->protocols[i];
+
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned count = argc > 1 ? atoi(argv[1]) : 256;
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 100000;
+	struct nfc_target_batch batch;
+	uint32_t sum_generic, sum_special;
+	double t_generic, t_special;
+	uint8_t *buf;
+	size_t len;
+	unsigned i;
+
+	/* The targets nest must fit the 16-bit attribute length */
+	if (!count || !iterations ||
+			count > (UINT16_MAX - NLA_HDRLEN) / TARGET_SIZE) {
+		fprintf(stderr, "Usage: %s [TARGETS [ITERATIONS]]\n", *argv);
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc(ATTR_SIZE(sizeof(uint32_t)) + NLA_HDRLEN +
+						count * TARGET_SIZE);
+	batch.idx = calloc(count, sizeof(uint32_t));
+	batch.protocols = calloc(count, sizeof(uint32_t));
+	if (!buf || !batch.idx || !batch.protocols) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	batch.max = count;
+
+	len = build_event(buf, count);
+
+	t_generic = now();
+	for (i = 0; i < iterations; i++)
+		parse_generic(buf, len, &batch);
+	t_generic = now() - t_generic;
+	sum_generic = checksum(&batch);
+
+	t_special = now();
+	for (i = 0; i < iterations; i++)
+		nl_parse_targets_found(buf, len, &batch);
+	t_special = now() - t_special;
+	sum_special = checksum(&batch);
+
+	if (sum_generic != sum_special || batch.count != count) {
+		fprintf(stderr, "Parsers disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Targets/event:\t%u\n"
+		"Event size:\t%lu bytes\n"
+		"Iterations:\t%u\n"
+		"nla_parse:\t%.1f ns/event, %.2f ns/target\n"
+		"nlparse:\t%.1f ns/event, %.2f ns/target\n"
+		"Speedup:\t%.2fx\n",
+		count, len, iterations,
+		t_generic * 1e9 / iterations,
+		t_generic * 1e9 / iterations / count,
+		t_special * 1e9 / iterations,
+		t_special * 1e9 / iterations / count,
+		t_generic / t_special);
+
+	free(batch.protocols);
+	free(batch.idx);
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include "polladapt.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void poll_adapt_init(struct poll_adapt *pa, uint32_t full,
+						unsigned widen_every)
+{
+	memset(pa, 0, sizeof(*pa));
+	pa->full = full;
+	pa->widen_every = widen_every;
+}
+
+/* Full mask for the next START_POLL, which follows right away */
+uint32_t poll_adapt_widen(struct poll_adapt *pa)
+{
+	unsigned i;
+
+	pa->polls = 0;
+
+	for (i = 0; i < NFC_PROTO_MAX; i++)
+		pa->seen[i] /= 2;
+
+	pa->mask = pa->full;
+	pa->armed_ns = now_ns();
+
+	return pa->full;
+}
+
+/* Mask for the next START_POLL, which is assumed to follow right away */
+uint32_t poll_adapt_mask(struct poll_adapt *pa)
+{
+	uint32_t mask = 0;
+	unsigned i;
+
+	for (i = 0; i < NFC_PROTO_MAX; i++) {
+		if (pa->seen[i])
+			mask |= 1 << i;
+	}
+
+	mask &= pa->full;
+
+	if (!mask || !pa->widen_every || ++pa->polls >= pa->widen_every)
+		return poll_adapt_widen(pa);
+
+	pa->mask = mask;
+	pa->armed_ns = now_ns();
+
+	return mask;
+}
+
+/*
+ * Milliseconds before the current poll is due for widening, 0 if it is
+ * overdue, or -1 if it is wide already or found targets.
+ */
+int poll_adapt_timeout(const struct poll_adapt *pa)
+{
+	uint64_t ms;
+
+	if (!pa->armed_ns || pa->mask == pa->full)
+		return -1;
+
+	ms = (now_ns() - pa->armed_ns) / 1000000;
+
+	return ms < POLL_ADAPT_WIDEN_MS ? POLL_ADAPT_WIDEN_MS - ms : 0;
+}
+
+/* Full mask for the poll replacing a narrow one which found nothing */
+uint32_t poll_adapt_expired(struct poll_adapt *pa)
+{
+	pa->expired++;
+
+	return poll_adapt_widen(pa);
+}
+
+/* The device reported targets speaking protocols */
+void poll_adapt_found(struct poll_adapt *pa, uint32_t protocols)
+{
+	struct poll_latency *lat;
+	uint64_t ns;
+	unsigned i;
+
+	for (i = 0; i < NFC_PROTO_MAX; i++) {
+		if ((protocols & (1 << i)) && pa->seen[i] < POLL_ADAPT_SEEN_MAX)
+			pa->seen[i] += 2;
+	}
+
+	if (!pa->armed_ns)
+		return;
+
+	ns = now_ns() - pa->armed_ns;
+	pa->armed_ns = 0;
+
+	lat = pa->mask == pa->full ? &pa->wide : &pa->narrow;
+	lat->total_ns += ns;
+	lat->count++;
+	if (ns > lat->max_ns)
+		lat->max_ns = ns;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _POLLADAPT_H_
+#define _POLLADAPT_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+/*
+ * Adaptive START_POLL mask of one device.
+ *
+ * Polling for a protocol costs a slot in every poll cycle whether or not
+ * such tags ever show up. The mask is narrowed to the protocols actually
+ * seen on the device, and the full mask is used again so new tag types
+ * get noticed: every widen_every polls, and whenever a narrowed poll went
+ * POLL_ADAPT_WIDEN_MS without finding anything, as a tag the narrow mask
+ * misses never ends such a poll. poll_adapt_timeout() tells when that is
+ * due, and the caller then stops the poll and starts it again with the
+ * mask of poll_adapt_expired(). Each wide poll halves the counts, which
+ * are capped, so a protocol which stops showing up leaves the mask after
+ * a few wide polls.
+ *
+ * The time from START_POLL to NFC_EVENT_TARGETS_FOUND is accounted
+ * separately for narrow and wide polls; the wide ones are what a static
+ * full mask would give, so both averages compare the two strategies. A
+ * poll widened on time is timed from its widening.
+ */
+#define POLL_ADAPT_WIDEN_EVERY 8
+#define POLL_ADAPT_WIDEN_MS 2000
+#define POLL_ADAPT_SEEN_MAX 16
+
+struct poll_latency {
+	uint64_t total_ns;
+	uint64_t max_ns;
+	unsigned long count;
+};
+
+struct poll_adapt {
+	uint32_t full;			/* mask to widen back to */
+	unsigned widen_every;		/* 0 always polls the full mask */
+	uint32_t seen[NFC_PROTO_MAX];
+	unsigned polls;			/* since the last wide one */
+	uint32_t mask;			/* of the current poll */
+	uint64_t armed_ns;		/* 0 once the poll found targets */
+	unsigned long expired;		/* narrow polls widened on time */
+	struct poll_latency narrow;
+	struct poll_latency wide;
+};
+
+void poll_adapt_init(struct poll_adapt *pa, uint32_t full,
+						unsigned widen_every);
+uint32_t poll_adapt_mask(struct poll_adapt *pa);
+uint32_t poll_adapt_widen(struct poll_adapt *pa);
+int poll_adapt_timeout(const struct poll_adapt *pa);
+uint32_t poll_adapt_expired(struct poll_adapt *pa);
+void poll_adapt_found(struct poll_adapt *pa, uint32_t protocols);
+
+#endif /* _POLLADAPT_H_ */
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "provision.h"
+#include "nfclog.h"
+
+#define PROVISION_TARGETS_MAX 8
+
+/*
+ * Production line encoding: one payload record per tag presented to any
+ * reader, all on a single nfcctl context kept open for the whole run.
+ *
+ * Records are either record_size bytes each or, when record_size is 0,
+ * a 16-bit big-endian length followed by that many bytes. A record is only
+ * consumed once a tag took it, so a failed write retries it on the next
+ * tag, except for a record larger than the tag which is logged and dropped.
+ *
+ * Each tag appends one line to the status log:
+ *
+ *   seconds  record  device  target  bytes  status  tags/min
+ *
+ * where status is "ok" or the error, and tags/min is the running rate of
+ * successful writes since the start of the run.
+ *
+ * Polling resumes right after a write, so a tag left on its reader is
+ * found again at once. The last tag written on each reader is skipped
+ * until another one shows up there or it was out of sight for
+ * PROVISION_ABSENT_MS, so one tag does not take every record in turn.
+ * Tags without a UID, such as Type 4 ones, cannot be told apart: after
+ * writing one, the reader writes nothing more to such tags until it went
+ * PROVISION_ABSENT_MS without finding any, that is with an empty field.
+ */
+struct provision_dev {
+	uint32_t idx;
+	struct provision_last last;
+};
+
+struct provision {
+	struct nfcctl ctx;
+	const struct provision_opts *opts;
+	FILE *in;
+	FILE *log;
+	uint8_t rec[TAG_DATA_MAX];
+	size_t rec_len;
+	int rec_valid;
+	unsigned long recno;
+	unsigned long written;
+	unsigned long failed;
+	struct timespec start;
+	struct provision_dev devs[NFCCTL_DEVICES_MAX];
+	uint8_t devs_count;
+	struct nfcctl_arm_set arm;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static struct provision_last *provision_last_get(struct provision *pv,
+							uint32_t idx)
+{
+	unsigned i;
+
+	for (i = 0; i < pv->devs_count; i++) {
+		if (pv->devs[i].idx == idx)
+			return &pv->devs[i].last;
+	}
+
+	if (pv->devs_count == NFCCTL_DEVICES_MAX)
+		return NULL;
+
+	memset(&pv->devs[i], 0, sizeof(pv->devs[i]));
+	pv->devs[i].idx = idx;
+	pv->devs_count++;
+
+	return &pv->devs[i].last;
+}
+
+/*
+ * Returns 1 when uid is the tag last written on the reader and it has
+ * been seen there since, refreshing the sighting. A tag without a uid
+ * (uid_len <= 0) is taken for the last one written if that had none
+ * either. Any other tag ends the skipping.
+ */
+int provision_skip(struct provision_last *last, const uint8_t *uid,
+						int uid_len, uint64_t now)
+{
+	if (uid_len <= 0)
+		uid_len = -1;
+
+	if (uid_len != last->uid_len ||
+			(uid_len > 0 && memcmp(uid, last->uid, uid_len)) ||
+			now - last->seen > PROVISION_ABSENT_MS) {
+		last->uid_len = 0;
+		return 0;
+	}
+
+	last->seen = now;
+
+	return 1;
+}
+
+void provision_written(struct provision_last *last, const uint8_t *uid,
+						int uid_len, uint64_t now)
+{
+	if (uid_len > TAG_UID_MAX) {
+		last->uid_len = 0;
+		return;
+	}
+
+	if (uid_len > 0)
+		memcpy(last->uid, uid, uid_len);
+	else
+		uid_len = -1;
+
+	last->uid_len = uid_len;
+	last->seen = now;
+}
+
+static double elapsed_sec(const struct provision *pv)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - pv->start.tv_sec) +
+			(now.tv_nsec - pv->start.tv_nsec) / 1e9;
+}
+
+static double tags_per_min(const struct provision *pv)
+{
+	double elapsed = elapsed_sec(pv);
+
+	return elapsed > 0 ? pv->written * 60 / elapsed : 0;
+}
+
+/* Returns 1 with the next record in pv->rec, 0 at the end, or -errno */
+static int next_record(struct provision *pv)
+{
+	uint8_t hdr[2];
+	size_t len;
+
+	if (pv->rec_valid)
+		return 1;
+
+	if (pv->opts->record_size) {
+		len = fread(pv->rec, 1, pv->opts->record_size, pv->in);
+		if (!len)
+			return ferror(pv->in) ? -EIO : 0;
+		if (len != pv->opts->record_size)
+			return -EINVAL;
+	} else {
+		len = fread(hdr, 1, sizeof(hdr), pv->in);
+		if (!len)
+			return ferror(pv->in) ? -EIO : 0;
+		if (len != sizeof(hdr))
+			return -EINVAL;
+
+		len = hdr[0] << 8 | hdr[1];
+		if (len > sizeof(pv->rec))
+			return -EINVAL;
+
+		if (fread(pv->rec, 1, len, pv->in) != len)
+			return -EINVAL;
+	}
+
+	pv->rec_len = len;
+	pv->rec_valid = 1;
+	pv->recno++;
+
+	return 1;
+}
+
+static void log_status(struct provision *pv, uint32_t dev_idx,
+						uint32_t tgt_idx, int rc)
+{
+	if (rc)
+		pv->failed++;
+	else
+		pv->written++;
+
+	fprintf(pv->log, "%.3f\t%lu\t%u\t%u\t%zu\t%s\t%.1f\n",
+			elapsed_sec(pv), pv->recno, dev_idx, tgt_idx,
+			pv->rec_len, rc ? strerror(-rc) : "ok",
+			tags_per_min(pv));
+	fflush(pv->log);
+}
+
+/*
+ * Write the current record to one target. With a driver splitting its
+ * writes, polling is started again right after the commands are queued,
+ * so the netlink round trip overlaps the tag programming its blocks.
+ * Drivers which refuse to poll while a target is connected get their
+ * device re-armed by the loop once the session is closed.
+ */
+static void provision_target(struct provision *pv, struct nfc_dev *dev,
+							uint32_t tgt_idx)
+{
+	struct nfcctl *ctx = &pv->ctx;
+	uint32_t protocols = 1 << pv->opts->protocol;
+	struct provision_last *last;
+	const struct tag_driver *drv;
+	struct nfc_session *sess;
+	uint8_t uid[TAG_UID_MAX];
+	int uid_len;
+	int armed = 0;
+	int rc;
+
+	rc = tag_connect(ctx, dev->idx, tgt_idx, protocols, &sess);
+	if (rc) {
+		log_status(pv, dev->idx, tgt_idx, rc);
+		goto rearm;
+	}
+
+	last = provision_last_get(pv, dev->idx);
+	uid_len = tag_uid(sess, uid, sizeof(uid));
+
+	if (last && provision_skip(last, uid, uid_len, now_ms())) {
+		printdbg(ctx, "Tag on device %u already written", dev->idx);
+		goto deinit;
+	}
+
+	if (pv->rec_len > sess->tag_size) {
+		log_status(pv, dev->idx, tgt_idx, -EFBIG);
+		pv->rec_valid = 0;
+		goto deinit;
+	}
+
+	drv = sess->tag_drv;
+
+	if (drv->write_submit) {
+		rc = drv->write_submit(sess, pv->rec, pv->rec_len);
+		if (!rc) {
+			armed = !nfcctl_start_poll(ctx, dev, protocols);
+			rc = drv->write_complete(sess, pv->rec_len);
+		}
+	} else {
+		rc = tag_write(sess, pv->rec, pv->rec_len);
+	}
+
+	rc = rc == pv->rec_len ? 0 : -errno;
+	if (!rc) {
+		pv->rec_valid = 0;
+		if (last)
+			provision_written(last, uid, uid_len, now_ms());
+	}
+
+	log_status(pv, dev->idx, tgt_idx, rc);
+
+deinit:
+	nfcctl_target_deinit(sess);
+rearm:
+	if (!armed)
+		nfcctl_arm_add(&pv->arm, dev->idx);
+}
+
+static int provision_loop(struct provision *pv)
+{
+	struct nfcctl *ctx = &pv->ctx;
+	uint32_t protocols = 1 << pv->opts->protocol;
+	uint32_t idx[PROVISION_TARGETS_MAX];
+	uint32_t protocolsv[PROVISION_TARGETS_MAX];
+	struct nfc_target_batch batch = {
+		.max = PROVISION_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	struct nfc_dev *dev;
+	unsigned i;
+	int rc;
+
+	for (;;) {
+		rc = next_record(pv);
+		if (rc <= 0)
+			return rc;
+
+		rc = nfcctl_sync_devices(ctx);
+		if (rc < 0)
+			return rc;
+
+		nfcctl_arm_pending(ctx, &pv->arm, protocols);
+
+		rc = nfcctl_targets_found_batch(ctx, &batch);
+		if (rc == -ENOBUFS) {
+			/* Any reader may have stopped unnoticed */
+			for (i = 0; i < ctx->devs_count; i++)
+				nfcctl_arm_add(&pv->arm, ctx->devs[i].idx);
+			continue;
+		}
+		if (rc)
+			return rc;
+
+		if (!batch.count)
+			continue;
+
+		dev = nfcctl_find_device(ctx, batch.dev_idx);
+		if (!dev)
+			continue;
+
+		/* One record per event: a stack gets one tag written */
+		for (i = 0; i < batch.count; i++) {
+			if (batch.protocols[i] & protocols)
+				break;
+		}
+
+		if (i == batch.count) {
+			nfcctl_arm_add(&pv->arm, dev->idx);
+			continue;
+		}
+
+		provision_target(pv, dev, batch.idx[i]);
+	}
+}
+
+/* Encode tags from a stream of payload records until it runs out */
+int provision_run(const struct provision_opts *opts)
+{
+	struct provision *pv;
+	double elapsed;
+	int rc;
+
+	if (opts->record_size > TAG_DATA_MAX)
+		return -EINVAL;
+
+	pv = calloc(1, sizeof(*pv));
+	if (!pv)
+		return -ENOMEM;
+
+	pv->opts = opts;
+	pv->ctx.verbose = opts->verbose;
+	pv->ctx.dev_handler = nfcctl_arm_handler;
+	pv->ctx.dev_param = &pv->arm;
+
+	if (!strcmp(opts->input, "-")) {
+		pv->in = stdin;
+	} else {
+		pv->in = fopen(opts->input, "r");
+		if (!pv->in) {
+			rc = -errno;
+			printerr("%s: %s", opts->input, strerror(-rc));
+			goto free_pv;
+		}
+	}
+
+	if (opts->log_path) {
+		pv->log = fopen(opts->log_path, "a");
+		if (!pv->log) {
+			rc = -errno;
+			printerr("%s: %s", opts->log_path, strerror(-rc));
+			goto close_in;
+		}
+	} else {
+		pv->log = stdout;
+	}
+
+	rc = nfcctl_init(&pv->ctx);
+	if (rc) {
+		printerr("%s", strerror(abs(rc)));
+		goto close_log;
+	}
+
+	rc = nfcctl_sync_devices(&pv->ctx);
+	if (rc < 0) {
+		printerr("%s", strerror(-rc));
+		goto deinit;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &pv->start);
+
+	rc = provision_loop(pv);
+	if (rc)
+		printerr("%s", strerror(abs(rc)));
+
+	elapsed = elapsed_sec(pv);
+
+	fprintf(stderr, "Tags written:\t%lu\n"
+			"Failures:\t%lu\n"
+			"Time:\t\t%.1f s\n"
+			"Tags/min:\t%.1f\n",
+			pv->written, pv->failed, elapsed, tags_per_min(pv));
+
+deinit:
+	nfcctl_deinit(&pv->ctx);
+close_log:
+	if (pv->log != stdout)
+		fclose(pv->log);
+close_in:
+	if (pv->in != stdin)
+		fclose(pv->in);
+free_pv:
+	free(pv);
+	return rc;
+}
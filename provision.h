@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _PROVISION_H_
+#define _PROVISION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tag.h"
+
+struct provision_opts {
+	const char *input;	/* payload records, "-" for stdin */
+	size_t record_size;	/* fixed-width records, 0 if length-prefixed */
+	const char *log_path;	/* append-only status log, NULL for stdout */
+	uint32_t protocol;	/* NFC_PROTO_* */
+	int verbose;
+};
+
+int provision_run(const struct provision_opts *opts);
+
+/* A tag is taken for gone once it was not seen for that long */
+#define PROVISION_ABSENT_MS 1000
+
+/*
+ * The tag last written on one reader. uid_len is 0 when there is none, -1
+ * when that tag had no UID.
+ */
+struct provision_last {
+	uint8_t uid[TAG_UID_MAX];
+	int uid_len;
+	uint64_t seen;		/* ms, monotonic */
+};
+
+int provision_skip(struct provision_last *last, const uint8_t *uid,
+						int uid_len, uint64_t now);
+void provision_written(struct provision_last *last, const uint8_t *uid,
+						int uid_len, uint64_t now);
+
+#endif /* _PROVISION_H_ */
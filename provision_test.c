@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Re-discovery check for provisioning: a tag resting on its reader after
+ * being written is found again as soon as polling resumes, and must not
+ * take the next record. Replays such sightings through the skip logic of
+ * provision.c and exits with a failure status on the first wrong call.
+ *
+ * Usage: provision_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "provision.h"
+
+static const uint8_t uid_a[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+static const uint8_t uid_b[7] = { 0x04, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc };
+
+static int failures;
+
+static void expect(const char *what, int got, int want)
+{
+	if (got == want)
+		return;
+
+	fprintf(stderr, "%s: got %d, expected %d\n", what, got, want);
+	failures++;
+}
+
+int main(void)
+{
+	struct provision_last last = { .uid_len = 0 };
+	uint64_t t = 5000;
+	int i;
+
+	expect("nothing written yet",
+		provision_skip(&last, uid_a, sizeof(uid_a), t), 0);
+
+	provision_written(&last, uid_a, sizeof(uid_a), t);
+
+	/* Left on the reader: found again on every poll cycle */
+	for (i = 0; i < 100; i++) {
+		t += PROVISION_ABSENT_MS / 4;
+		expect("same tag still in the field",
+			provision_skip(&last, uid_a, sizeof(uid_a), t), 1);
+	}
+
+	/* Replaced by another tag, the first one is writable again */
+	expect("another tag", provision_skip(&last, uid_b, sizeof(uid_b), t),
+									0);
+	expect("first tag back after another",
+		provision_skip(&last, uid_a, sizeof(uid_a), t), 0);
+
+	/* Taken away and presented again after the field was empty */
+	provision_written(&last, uid_a, sizeof(uid_a), t);
+	t += PROVISION_ABSENT_MS + 1;
+	expect("same tag after an empty field",
+		provision_skip(&last, uid_a, sizeof(uid_a), t), 0);
+
+	/* A tag with a uid is never one without */
+	provision_written(&last, uid_a, -1, t);
+	expect("tag with a uid after one without",
+		provision_skip(&last, uid_a, sizeof(uid_a), t), 0);
+	provision_written(&last, uid_a, sizeof(uid_a), t);
+	expect("tag without a uid after one with",
+		provision_skip(&last, NULL, -1, t), 0);
+
+	/* Type 4 tag left on the reader: skipped until the field is empty */
+	provision_written(&last, NULL, -1, t);
+	for (i = 0; i < 100; i++) {
+		t += PROVISION_ABSENT_MS / 4;
+		expect("tag without a uid still in the field",
+			provision_skip(&last, NULL, -1, t), 1);
+	}
+
+	t += PROVISION_ABSENT_MS + 1;
+	expect("tag without a uid after an empty field",
+		provision_skip(&last, NULL, -1, t), 0);
+	expect("no skipping once the field was empty",
+		provision_skip(&last, NULL, -1, t), 0);
+
+	if (failures) {
+		fprintf(stderr, "%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("provision re-discovery: ok\n");
+
+	return EXIT_SUCCESS;
+}
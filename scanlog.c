@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scanlog.h"
+
+static size_t scanlog_size(uint64_t capacity)
+{
+	return sizeof(struct scanlog_hdr) +
+				capacity * sizeof(struct scanlog_rec);
+}
+
+static int scanlog_valid(const struct scanlog_hdr *hdr, size_t map_size)
+{
+	return hdr->magic == SCANLOG_MAGIC &&
+		hdr->version == SCANLOG_VERSION &&
+		hdr->rec_size == sizeof(struct scanlog_rec) &&
+		hdr->capacity && scanlog_size(hdr->capacity) == map_size;
+}
+
+static void scanlog_unmap(struct scanlog *log)
+{
+	if (log->hdr)
+		munmap(log->hdr, log->map_size);
+
+	log->hdr = NULL;
+	log->recs = NULL;
+}
+
+static int scanlog_map(struct scanlog *log, int fd, size_t size, int prot)
+{
+	void *map;
+
+	map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	log->hdr = map;
+	log->recs = (struct scanlog_rec *) (log->hdr + 1);
+	log->map_size = size;
+
+	return 0;
+}
+
+/*
+ * Map path for appending, taking over a valid log left by a previous run
+ * or starting a new one of size bytes. The blocks are allocated up front
+ * so that running out of disk shows here rather than as a SIGBUS on a
+ * store into the mapping.
+ */
+static int scanlog_map_file(struct scanlog *log)
+{
+	size_t size = log->new_size;
+	struct stat st;
+	int fd;
+	int rc;
+
+	fd = open(log->path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	if (st.st_size) {
+		if (st.st_size < sizeof(struct scanlog_hdr)) {
+			rc = -EPROTO;
+			goto close_fd;
+		}
+
+		rc = scanlog_map(log, fd, st.st_size, PROT_READ | PROT_WRITE);
+		if (rc)
+			goto close_fd;
+
+		if (!scanlog_valid(log->hdr, log->map_size)) {
+			scanlog_unmap(log);
+			rc = -EPROTO;
+		}
+
+		goto close_fd;
+	}
+
+	rc = posix_fallocate(fd, 0, size);
+	if (rc) {
+		rc = -rc;
+		goto close_fd;
+	}
+
+	rc = scanlog_map(log, fd, size, PROT_READ | PROT_WRITE);
+	if (rc)
+		goto close_fd;
+
+	log->hdr->version = SCANLOG_VERSION;
+	log->hdr->rec_size = sizeof(struct scanlog_rec);
+	log->hdr->capacity = (size - sizeof(struct scanlog_hdr)) /
+						sizeof(struct scanlog_rec);
+	atomic_store_explicit(&log->hdr->count, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	log->hdr->magic = SCANLOG_MAGIC;
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+/* Open path for appending, rotating to new files of size bytes */
+int scanlog_create(struct scanlog *log, const char *path, size_t size)
+{
+	int rc;
+
+	memset(log, 0, sizeof(*log));
+
+	/* Round down to whole records */
+	if (size < scanlog_size(1))
+		return -EINVAL;
+	size = scanlog_size((size - sizeof(struct scanlog_hdr)) /
+						sizeof(struct scanlog_rec));
+
+	log->path = strdup(path);
+	if (!log->path)
+		return -ENOMEM;
+
+	log->new_size = size;
+
+	rc = scanlog_map_file(log);
+	if (rc) {
+		free(log->path);
+		log->path = NULL;
+	}
+
+	return rc;
+}
+
+/* Map an existing log read-only */
+int scanlog_open(struct scanlog *log, const char *path)
+{
+	struct stat st;
+	int fd;
+	int rc;
+
+	memset(log, 0, sizeof(*log));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	if (st.st_size < sizeof(struct scanlog_hdr)) {
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	rc = scanlog_map(log, fd, st.st_size, PROT_READ);
+	if (rc)
+		goto close_fd;
+
+	if (!scanlog_valid(log->hdr, log->map_size)) {
+		scanlog_unmap(log);
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	madvise(log->hdr, log->map_size, MADV_SEQUENTIAL);
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+void scanlog_close(struct scanlog *log)
+{
+	scanlog_unmap(log);
+
+	free(log->path);
+	log->path = NULL;
+}
+
+/* PATH.n+1 <- PATH.n ... PATH.1 <- PATH, then start a new PATH */
+static int scanlog_rotate(struct scanlog *log)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+	unsigned i;
+
+	scanlog_unmap(log);
+
+	for (i = SCANLOG_KEEP; i > 0; i--) {
+		if (i > 1)
+			snprintf(from, sizeof(from), "%s.%u", log->path, i - 1);
+		else
+			snprintf(from, sizeof(from), "%s", log->path);
+		snprintf(to, sizeof(to), "%s.%u", log->path, i);
+
+		if (rename(from, to) && errno != ENOENT)
+			return -errno;
+	}
+
+	return scanlog_map_file(log);
+}
+
+/* Single writer. Syscalls only happen when the file has to rotate */
+int scanlog_append(struct scanlog *log, const struct scanlog_rec *rec)
+{
+	uint64_t n;
+	int rc;
+
+	if (!log->hdr)
+		return -EBADF;
+
+	n = atomic_load_explicit(&log->hdr->count, memory_order_relaxed);
+	if (n == log->hdr->capacity) {
+		rc = scanlog_rotate(log);
+		if (rc)
+			return rc;
+
+		n = atomic_load_explicit(&log->hdr->count,
+							memory_order_relaxed);
+	}
+
+	memcpy(&log->recs[n], rec, sizeof(*rec));
+
+	atomic_store_explicit(&log->hdr->count, n + 1, memory_order_release);
+
+	return 0;
+}
+
+/* Records a reader may look at */
+uint64_t scanlog_count(const struct scanlog *log)
+{
+	uint64_t n;
+
+	n = atomic_load_explicit(&log->hdr->count, memory_order_acquire);
+
+	return n < log->hdr->capacity ? n : log->hdr->capacity;
+}
+
+/* 64-bit FNV-1a, cheap enough to fingerprint every payload */
+uint64_t scanlog_hash(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
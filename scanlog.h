@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _SCANLOG_H_
+#define _SCANLOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Append-only inventory log of fixed-size binary records.
+ *
+ * The file is preallocated to its full size and mapped, so appending a
+ * record is a memcpy and a store to the header count, with no syscall per
+ * event. When the file is full it is renamed to PATH.1 (PATH.1 becoming
+ * PATH.2 and so on, up to SCANLOG_KEEP old files) and a fresh one is
+ * started. Readers trust only the first count records.
+ */
+#define SCANLOG_MAGIC 0x4e46534c	/* "NFSL" */
+#define SCANLOG_VERSION 1
+#define SCANLOG_KEEP 4
+#define SCANLOG_SIZE_DEFAULT (64 << 20)
+#define SCANLOG_UID_MAX 12
+
+/* struct scanlog_rec flags */
+#define SCANLOG_REC_HASH	0x01	/* hash is valid */
+
+struct scanlog_rec {
+	uint64_t time_ns;		/* CLOCK_REALTIME */
+	uint32_t dev_idx;
+	uint32_t tgt_idx;
+	uint32_t protocols;
+	uint8_t uid_len;		/* 0 if the UID is unknown */
+	uint8_t flags;
+	uint16_t reserved;
+	uint8_t uid[SCANLOG_UID_MAX];
+	uint32_t payload_len;
+	uint64_t hash;			/* FNV-1a of the payload */
+};
+
+struct scanlog_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t reserved;
+	uint64_t capacity;		/* records the file can hold */
+	_Atomic uint64_t count;
+} __attribute__((aligned(64)));
+
+struct scanlog {
+	struct scanlog_hdr *hdr;
+	struct scanlog_rec *recs;
+	size_t map_size;
+	char *path;			/* appending only */
+	size_t new_size;		/* of the files rotation starts */
+};
+
+int scanlog_create(struct scanlog *log, const char *path, size_t size);
+int scanlog_open(struct scanlog *log, const char *path);
+void scanlog_close(struct scanlog *log);
+
+int scanlog_append(struct scanlog *log, const struct scanlog_rec *rec);
+
+uint64_t scanlog_count(const struct scanlog *log);
+uint64_t scanlog_hash(const void *buf, size_t len);
+
+#endif /* _SCANLOG_H_ */
@@ -0,0 +1,972 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "ctlsock.h"
+#include "evring.h"
+#include "server.h"
+#include "nfclog.h"
+
+#define SERVER_DEV_MAX 4
+#define SERVER_CLIENTS_MAX 32
+#define SERVER_TARGETS_MAX 8
+#define SERVER_WINDOWS_MAX 8
+
+/* A reader nobody wants any more keeps polling this long */
+#define SERVER_IDLE_LINGER_MS 5000
+#define SERVER_REPORT_SEC 60
+
+/* Tag images read ahead of requests, and how long they stay valid */
+#define SERVER_IMAGES_MAX 4
+#define SERVER_IMAGE_TTL_MS 2000
+
+#define SERVER_PROTOCOLS (NFC_PROTO_JEWEL_MASK | NFC_PROTO_MIFARE_MASK | \
+			NFC_PROTO_FELICA_MASK | NFC_PROTO_ISO14443_MASK | \
+			NFC_PROTO_NFC_DEP_MASK)
+
+struct server_client {
+	int fd;
+	int subscribed;
+	uint32_t sub_dev;	/* device subscribed to, or CTL_DEV_ANY */
+	int pending;		/* READ or WRITE waiting for a tag */
+	uint64_t seq;		/* arrival order of the pending request */
+	struct ctl_hdr req;
+	uint8_t data[CTL_PAYLOAD_MAX];
+};
+
+/* Polling state of one reader, see update_polling() */
+struct server_dev {
+	uint32_t idx;
+	int polling;
+	uint64_t idle_since;	/* ms, 0 while wanted */
+};
+
+/*
+ * Data of a tag read as soon as it was found, for the next READ of its
+ * protocol to be answered from memory. time is 0 when the slot is free.
+ *
+ * This keeps the "next tag" semantics of READ: a pending READ takes the
+ * next tag of its protocol found on any reader, and an image is such a
+ * tag, only found up to SERVER_IMAGE_TTL_MS before the request. Only
+ * tags read whole are kept, so the answer is the same as a READ of it.
+ */
+struct server_image {
+	uint32_t dev_idx;
+	struct nfc_target tgt;
+	uint32_t protocol;	/* of the driver which read it */
+	uint64_t time;		/* ms */
+	int len;
+	uint8_t data[TAG_DATA_MAX];
+};
+
+/* Minutes since midnight, local time; end < start wraps around */
+struct server_window {
+	unsigned start;
+	unsigned end;
+};
+
+struct server {
+	struct nfcctl ctx;
+	struct evring ring;
+	int ring_enabled;
+	struct server_dev devs[NFCCTL_DEVICES_MAX];
+	unsigned devs_count;
+	struct server_window windows[SERVER_WINDOWS_MAX];
+	unsigned windows_count;
+	unsigned readahead;
+	struct server_image images[SERVER_IMAGES_MAX];
+	unsigned long wakeups;
+	unsigned long images_read;
+	unsigned long images_hit;
+	uint64_t report_time;	/* ms */
+	uint64_t report_cpu;	/* us */
+	int listen_fd;
+	uint64_t seq;
+	struct server_client clients[SERVER_CLIENTS_MAX];
+	uint8_t bufs[NFCCTL_SESSIONS_MAX][TAG_DATA_MAX];
+};
+
+struct server_event {
+	struct nfc_target_batch batch;
+	uint32_t idx[SERVER_TARGETS_MAX];
+	uint32_t protocols[SERVER_TARGETS_MAX];
+};
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+						listen(fd, SOMAXCONN)) {
+		int rc = -errno;
+
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static struct server_dev *server_dev_get(struct server *srv, uint32_t idx)
+{
+	unsigned i;
+
+	for (i = 0; i < srv->devs_count; i++) {
+		if (srv->devs[i].idx == idx)
+			return &srv->devs[i];
+	}
+
+	if (srv->devs_count == NFCCTL_DEVICES_MAX)
+		return NULL;
+
+	memset(&srv->devs[i], 0, sizeof(srv->devs[i]));
+	srv->devs[i].idx = idx;
+	srv->devs_count++;
+
+	return &srv->devs[i];
+}
+
+static int schedule_open(const struct server *srv)
+{
+	struct tm tm;
+	time_t t;
+	unsigned i, m;
+
+	if (!srv->windows_count)
+		return 1;
+
+	t = time(NULL);
+	localtime_r(&t, &tm);
+	m = tm.tm_hour * 60 + tm.tm_min;
+
+	for (i = 0; i < srv->windows_count; i++) {
+		const struct server_window *w = &srv->windows[i];
+
+		if (w->start <= w->end ? m >= w->start && m < w->end :
+						m >= w->start || m < w->end)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A reader is wanted while the event ring is published, while a READ or
+ * WRITE waits for a tag, which any reader may provide, or while a client
+ * subscribed to its events.
+ */
+static int device_wanted(const struct server *srv, uint32_t idx)
+{
+	unsigned i;
+
+	if (srv->ring_enabled)
+		return 1;
+
+	for (i = 0; i < SERVER_CLIENTS_MAX; i++) {
+		const struct server_client *cl = &srv->clients[i];
+
+		if (cl->fd == -1)
+			continue;
+
+		if (cl->pending || (cl->subscribed &&
+			(cl->sub_dev == CTL_DEV_ANY || cl->sub_dev == idx)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void start_device(struct server *srv, struct server_dev *sd,
+						struct nfc_dev *dev)
+{
+	int rc;
+
+	rc = nfcctl_rearm_poll(&srv->ctx, dev, SERVER_PROTOCOLS);
+	if (rc) {
+		printdbg(&srv->ctx, "Arming device %u: %s", dev->idx,
+							strerror(abs(rc)));
+		return;
+	}
+
+	sd->polling = 1;
+	sd->idle_since = 0;
+}
+
+/*
+ * Bring every reader in line with the demand, once per loop iteration so
+ * that all the changes the iteration made are applied in one pass. A
+ * reader nobody wants stops after SERVER_IDLE_LINGER_MS, so a client
+ * reconnecting right away does not cost a STOP_POLL/START_POLL pair; it
+ * stops at once when the schedule closes. Returns the ms until the next
+ * pending stop, or -1.
+ */
+static int update_polling(struct server *srv)
+{
+	struct server_dev *sd;
+	struct nfc_dev *dev;
+	uint64_t now = now_ms();
+	int open = schedule_open(srv);
+	int timeout = -1;
+	unsigned i;
+	int left;
+	int rc;
+
+	/* Forget readers which went away */
+	for (i = 0; i < srv->devs_count; ) {
+		if (nfcctl_find_device(&srv->ctx, srv->devs[i].idx))
+			i++;
+		else
+			srv->devs[i] = srv->devs[--srv->devs_count];
+	}
+
+	for (i = 0; i < srv->ctx.devs_count; i++) {
+		dev = &srv->ctx.devs[i];
+
+		sd = server_dev_get(srv, dev->idx);
+		if (!sd)
+			continue;
+
+		if (open && device_wanted(srv, dev->idx)) {
+			sd->idle_since = 0;
+			if (!sd->polling)
+				start_device(srv, sd, dev);
+			continue;
+		}
+
+		if (!sd->polling)
+			continue;
+
+		if (!sd->idle_since)
+			sd->idle_since = now;
+
+		left = sd->idle_since + SERVER_IDLE_LINGER_MS - now;
+		if (open && left > 0) {
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+			continue;
+		}
+
+		rc = nfcctl_stop_poll(&srv->ctx, dev);
+		if (rc)
+			printdbg(&srv->ctx, "Stopping device %u: %s",
+					dev->idx, strerror(abs(rc)));
+
+		sd->polling = 0;
+		sd->idle_since = 0;
+	}
+
+	return timeout;
+}
+
+/* Wakeups and CPU time of the server since the last report */
+static void report_stats(struct server *srv)
+{
+	struct rusage ru;
+	uint64_t now = now_ms();
+	uint64_t cpu;
+	double secs;
+	unsigned i, polling = 0;
+
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+				ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+
+	secs = (now - srv->report_time) / 1e3;
+
+	for (i = 0; i < srv->devs_count; i++)
+		polling += srv->devs[i].polling;
+
+	if (secs > 0)
+		fprintf(stderr, "Polling %u/%u devices, %.2f wakeups/s, "
+				"CPU %.3f ms/s\n", polling,
+				srv->ctx.devs_count, srv->wakeups / secs,
+				(cpu - srv->report_cpu) / 1e3 / secs);
+
+	if (srv->readahead)
+		fprintf(stderr, "Read ahead %lu tags, %lu served from memory\n",
+				srv->images_read, srv->images_hit);
+
+	srv->wakeups = 0;
+	srv->images_read = 0;
+	srv->images_hit = 0;
+	srv->report_time = now;
+	srv->report_cpu = cpu;
+}
+
+/* "HH:MM-HH:MM[,HH:MM-HH:MM...]" */
+static int parse_schedule(struct server *srv, const char *schedule)
+{
+	unsigned h1, m1, h2, m2;
+	int n;
+
+	while (*schedule) {
+		if (srv->windows_count == SERVER_WINDOWS_MAX)
+			return -EINVAL;
+
+		if (sscanf(schedule, "%u:%u-%u:%u%n", &h1, &m1, &h2, &m2,
+								&n) != 4 ||
+				h1 > 24 || h2 > 24 || m1 > 59 || m2 > 59)
+			return -EINVAL;
+
+		srv->windows[srv->windows_count].start = h1 * 60 + m1;
+		srv->windows[srv->windows_count].end = h2 * 60 + m2;
+		srv->windows_count++;
+
+		schedule += n;
+		if (*schedule == ',')
+			schedule++;
+		else if (*schedule)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Publish to the shared-memory event ring, if one was requested */
+static void publish(struct server *srv, uint32_t type, uint32_t dev_idx,
+			const struct nfc_target *tgt, int32_t status,
+			const void *data, uint16_t len)
+{
+	struct evring_event ev;
+	struct timespec ts;
+
+	if (!srv->ring_enabled)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	ev.time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	ev.type = type;
+	ev.dev_idx = dev_idx;
+	ev.tgt_idx = tgt->idx;
+	ev.protocols = tgt->protocols;
+	ev.status = status;
+	ev.len = len < EVRING_DATA_MAX ? len : EVRING_DATA_MAX;
+	memcpy(ev.data, data, ev.len);
+
+	evring_publish(&srv->ring, &ev);
+}
+
+static struct server_client *oldest_pending(struct server *srv,
+						uint32_t protocols)
+{
+	struct server_client *cl = NULL;
+	unsigned i;
+
+	for (i = 0; i < SERVER_CLIENTS_MAX; i++) {
+		struct server_client *c = &srv->clients[i];
+
+		if (c->fd == -1 || !c->pending ||
+				!(protocols & (1 << c->req.protocol)))
+			continue;
+
+		if (!cl || c->seq < cl->seq)
+			cl = c;
+	}
+
+	return cl;
+}
+
+static void reply(struct server *srv, struct server_client *cl,
+			uint32_t dev_idx, struct nfc_target *tgt, int rc,
+			const void *buf, int len)
+{
+	if (cl->req.op == CTL_OP_READ)
+		publish(srv, EVRING_TAG_READ, dev_idx, tgt, rc, buf, len);
+	else
+		publish(srv, EVRING_TAG_WRITE, dev_idx, tgt, rc, cl->data,
+								cl->req.len);
+
+	ctl_send(cl->fd, cl->req.op, cl->req.protocol, rc, buf, len);
+}
+
+/* Answer a READ with the freshest image of its protocol, if any */
+static int reply_image(struct server *srv, struct server_client *cl)
+{
+	struct server_image *img = NULL;
+	uint64_t now = now_ms();
+	unsigned i;
+
+	for (i = 0; i < SERVER_IMAGES_MAX; i++) {
+		struct server_image *m = &srv->images[i];
+
+		if (!m->time || now - m->time > SERVER_IMAGE_TTL_MS) {
+			m->time = 0;
+			continue;
+		}
+
+		if (m->protocol == cl->req.protocol &&
+					(!img || m->time > img->time))
+			img = m;
+	}
+
+	if (!img)
+		return 0;
+
+	/* Like a tag, an image serves one request */
+	img->time = 0;
+	srv->images_hit++;
+
+	reply(srv, cl, img->dev_idx, &img->tgt, 0, img->data, img->len);
+
+	return 1;
+}
+
+static void client_close(struct server_client *cl)
+{
+	close(cl->fd);
+	memset(cl, 0, sizeof(*cl));
+	cl->fd = -1;
+}
+
+static void client_accept(struct server *srv)
+{
+	unsigned i;
+	int fd;
+
+	fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd == -1) {
+		printdbg(&srv->ctx, "accept: %s", strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < SERVER_CLIENTS_MAX; i++) {
+		if (srv->clients[i].fd == -1) {
+			srv->clients[i].fd = fd;
+			return;
+		}
+	}
+
+	printdbg(&srv->ctx, "Too many clients");
+	close(fd);
+}
+
+static void reply_list(struct server *srv, struct server_client *cl)
+{
+	struct ctl_dev devs[SERVER_DEV_MAX];
+	unsigned i, count;
+
+	memset(devs, 0, sizeof(devs));
+
+	count = srv->ctx.devs_count;
+	if (count > SERVER_DEV_MAX)
+		count = SERVER_DEV_MAX;
+
+	for (i = 0; i < count; i++) {
+		devs[i].idx = srv->ctx.devs[i].idx;
+		devs[i].protocols = srv->ctx.devs[i].protocols;
+		strncpy(devs[i].name, srv->ctx.devs[i].name,
+						NFC_DEVICE_NAME_MAXSIZE);
+	}
+
+	ctl_send(cl->fd, CTL_OP_LIST, 0, 0, devs,
+					count * sizeof(struct ctl_dev));
+}
+
+static void client_request(struct server *srv, struct server_client *cl)
+{
+	const struct tag_driver *drv;
+	int rc;
+
+	rc = ctl_recv(cl->fd, &cl->req, cl->data, sizeof(cl->data));
+	if (rc < 0 || cl->req.op == CTL_OP_UNSPEC) {
+		client_close(cl);
+		return;
+	}
+
+	switch (cl->req.op) {
+	case CTL_OP_LIST:
+		reply_list(srv, cl);
+		break;
+	case CTL_OP_SUBSCRIBE:
+		cl->subscribed = 1;
+		cl->sub_dev = CTL_DEV_ANY;
+		if (cl->req.len >= sizeof(struct ctl_subscribe))
+			memcpy(&cl->sub_dev, cl->data, sizeof(cl->sub_dev));
+		ctl_send(cl->fd, CTL_OP_SUBSCRIBE, 0, 0, NULL, 0);
+		break;
+	case CTL_OP_READ:
+	case CTL_OP_WRITE:
+		if (cl->pending) {
+			rc = -EBUSY;
+		} else if (cl->req.protocol >= NFC_PROTO_MAX) {
+			/* Checked before it is used as a shift count */
+			rc = -EINVAL;
+		} else if (!(drv = tag_driver_find(1 << cl->req.protocol))) {
+			rc = -ENOSYS;
+		} else if (cl->req.len > drv->max_size) {
+			rc = -EINVAL;
+		} else if (cl->req.op == CTL_OP_READ && reply_image(srv, cl)) {
+			break;
+		} else {
+			cl->pending = 1;
+			cl->seq = srv->seq++;
+			break;
+		}
+		ctl_send(cl->fd, cl->req.op, cl->req.protocol, rc, NULL, 0);
+		break;
+	default:
+		ctl_send(cl->fd, cl->req.op, 0, -EOPNOTSUPP, NULL, 0);
+	}
+}
+
+/* Oldest slot, free ones first */
+static struct server_image *image_slot(struct server *srv)
+{
+	struct server_image *img = &srv->images[0];
+	unsigned i;
+
+	for (i = 1; i < SERVER_IMAGES_MAX; i++) {
+		if (srv->images[i].time < img->time)
+			img = &srv->images[i];
+	}
+
+	return img;
+}
+
+static void arm_early(struct server *srv, struct nfc_dev *dev)
+{
+	struct server_dev *sd;
+
+	if (!schedule_open(srv) || !device_wanted(srv, dev->idx))
+		return;
+
+	sd = server_dev_get(srv, dev->idx);
+	if (sd && !sd->polling)
+		start_device(srv, sd, dev);
+}
+
+/*
+ * Read the targets of the event no pending request claimed, unclaimed[i]
+ * being set for those, and keep their data in srv->images. The reads of
+ * all of them are interleaved like the requested ones.
+ */
+static void read_ahead(struct server *srv, struct nfc_target_batch *batch,
+				const int *unclaimed, struct nfc_dev *dev)
+{
+	struct nfc_session *sessv[NFCCTL_SESSIONS_MAX];
+	struct nfc_target tgtv[NFCCTL_SESSIONS_MAX];
+	void *bufv[NFCCTL_SESSIONS_MAX];
+	size_t lenv[NFCCTL_SESSIONS_MAX];
+	int rcv[NFCCTL_SESSIONS_MAX];
+	struct server_image *img;
+	unsigned i, count;
+	int rc;
+
+	count = 0;
+
+	for (i = 0; i < batch->count && count < NFCCTL_SESSIONS_MAX; i++) {
+		if (!unclaimed[i])
+			continue;
+
+		rc = tag_connect(&srv->ctx, batch->dev_idx, batch->idx[i],
+				batch->protocols[i], &sessv[count]);
+		if (rc) {
+			printdbg(&srv->ctx, "Error connecting to target %d: %s",
+						batch->idx[i], strerror(-rc));
+			continue;
+		}
+
+		/* A partial image could not answer a READ */
+		if (sessv[count]->tag_size > srv->readahead) {
+			nfcctl_target_deinit(sessv[count]);
+			continue;
+		}
+
+		tgtv[count].idx = batch->idx[i];
+		tgtv[count].protocols = batch->protocols[i];
+		bufv[count] = srv->bufs[count];
+		lenv[count] = sessv[count]->tag_size;
+		count++;
+	}
+
+	if (dev && count)
+		arm_early(srv, dev);
+
+	tag_read_sessions(sessv, count, bufv, lenv, rcv);
+
+	for (i = 0; i < count; i++) {
+		if (rcv[i] == lenv[i]) {
+			img = image_slot(srv);
+			img->dev_idx = batch->dev_idx;
+			img->tgt = tgtv[i];
+			img->protocol = sessv[i]->tag_drv->protocol;
+			img->time = now_ms();
+			img->len = rcv[i];
+			memcpy(img->data, bufv[i], rcv[i]);
+			srv->images_read++;
+		}
+
+		nfcctl_target_deinit(sessv[i]);
+	}
+}
+
+/*
+ * Serve, on every target of the event, the oldest pending request it can
+ * satisfy. All those targets are connected before any transfer starts, so
+ * the reads of a stack of tags are interleaved by tag_read_sessions().
+ * dev, the reader which found them, is polled again as soon as they are
+ * connected, if it is still wanted, so it discovers the next tags while
+ * these are transferring. With read-ahead, the targets left over are read
+ * afterwards for the requests to come.
+ */
+static void serve_targets(struct server *srv, struct nfc_target_batch *batch,
+							struct nfc_dev *dev)
+{
+	struct nfc_session *sessv[NFCCTL_SESSIONS_MAX];
+	struct server_client *clv[NFCCTL_SESSIONS_MAX];
+	struct nfc_target tgtv[NFCCTL_SESSIONS_MAX];
+	struct nfc_session *rsessv[NFCCTL_SESSIONS_MAX];
+	void *bufv[NFCCTL_SESSIONS_MAX];
+	size_t lenv[NFCCTL_SESSIONS_MAX];
+	int rcv[NFCCTL_SESSIONS_MAX];
+	int unclaimed[SERVER_TARGETS_MAX];
+	unsigned i, count, rcount;
+	int rc;
+
+	count = 0;
+
+	for (i = 0; i < batch->count; i++) {
+		struct server_client *cl;
+
+		unclaimed[i] = 1;
+
+		if (count == NFCCTL_SESSIONS_MAX)
+			continue;
+
+		cl = oldest_pending(srv, batch->protocols[i]);
+		if (!cl)
+			continue;
+
+		rc = tag_connect(&srv->ctx, batch->dev_idx, batch->idx[i],
+					1 << cl->req.protocol, &sessv[count]);
+		if (rc) {
+			printdbg(&srv->ctx, "Error connecting to target %d: %s",
+						batch->idx[i], strerror(-rc));
+			continue;
+		}
+
+		/* Claimed, so the next target picks another request */
+		cl->pending = 0;
+		unclaimed[i] = 0;
+		clv[count] = cl;
+		tgtv[count].idx = batch->idx[i];
+		tgtv[count].protocols = batch->protocols[i];
+		count++;
+	}
+
+	if (dev && count)
+		arm_early(srv, dev);
+
+	rcount = 0;
+
+	for (i = 0; i < count; i++) {
+		if (clv[i]->req.op != CTL_OP_READ)
+			continue;
+
+		rsessv[rcount] = sessv[i];
+		bufv[rcount] = srv->bufs[rcount];
+		lenv[rcount] = sessv[i]->tag_size;
+		rcount++;
+	}
+
+	tag_read_sessions(rsessv, rcount, bufv, lenv, rcv);
+
+	rcount = 0;
+
+	for (i = 0; i < count; i++) {
+		struct server_client *cl = clv[i];
+
+		if (cl->req.op == CTL_OP_READ) {
+			rc = rcv[rcount];
+			if (rc < 0)
+				reply(srv, cl, batch->dev_idx, &tgtv[i], rc,
+								NULL, 0);
+			else
+				reply(srv, cl, batch->dev_idx, &tgtv[i], 0,
+							bufv[rcount], rc);
+			rcount++;
+		} else {
+			rc = tag_write(sessv[i], cl->data, cl->req.len);
+			rc = rc == cl->req.len ? 0 : -errno;
+			reply(srv, cl, batch->dev_idx, &tgtv[i], rc, NULL,
+									0);
+		}
+
+		nfcctl_target_deinit(sessv[i]);
+	}
+
+	if (srv->readahead)
+		read_ahead(srv, batch, unclaimed, dev);
+}
+
+static int handle_targets(struct server *srv)
+{
+	struct server_event ev;
+	struct nfc_target_batch *batch = &ev.batch;
+	struct ctl_target_event tev;
+	struct nfc_target tgt;
+	struct server_dev *sd;
+	struct nfc_dev *dev;
+	unsigned i, j;
+	int rc;
+
+	batch->max = SERVER_TARGETS_MAX;
+	batch->idx = ev.idx;
+	batch->protocols = ev.protocols;
+
+	rc = nfcctl_targets_found_batch(&srv->ctx, batch);
+	if (rc == -ENOBUFS) {
+		/* Some reader stopped unnoticed, update_polling() re-arms */
+		printdbg(&srv->ctx, "Events lost, re-arming readers");
+		for (i = 0; i < srv->devs_count; i++)
+			srv->devs[i].polling = 0;
+		return 0;
+	}
+	if (rc || !batch->count)
+		return rc;
+
+	for (i = 0; i < batch->count; i++) {
+		tgt.idx = batch->idx[i];
+		tgt.protocols = batch->protocols[i];
+
+		tev.dev_idx = batch->dev_idx;
+		tev.tgt_idx = tgt.idx;
+		tev.protocols = tgt.protocols;
+
+		publish(srv, EVRING_TARGET_FOUND, batch->dev_idx, &tgt, 0,
+								NULL, 0);
+
+		for (j = 0; j < SERVER_CLIENTS_MAX; j++) {
+			struct server_client *cl = &srv->clients[j];
+
+			if (cl->fd != -1 && cl->subscribed &&
+					(cl->sub_dev == CTL_DEV_ANY ||
+					cl->sub_dev == batch->dev_idx))
+				ctl_send(cl->fd, CTL_OP_EVENT, 0, 0, &tev,
+								sizeof(tev));
+		}
+	}
+
+	/* Polling stopped there; update_polling() resumes it if needed */
+	sd = server_dev_get(srv, batch->dev_idx);
+	if (sd)
+		sd->polling = 0;
+
+	dev = nfcctl_find_device(&srv->ctx, batch->dev_idx);
+
+	serve_targets(srv, batch, dev);
+
+	return 0;
+}
+
+static int server_loop(struct server *srv)
+{
+	struct pollfd fds[2 + SERVER_CLIENTS_MAX];
+	struct server_client *cls[SERVER_CLIENTS_MAX];
+	unsigned i, nfds;
+	int timeout, report;
+	int rc;
+
+	srv->report_time = now_ms();
+
+	for (;;) {
+		rc = nfcctl_sync_devices(&srv->ctx);
+		if (rc < 0)
+			return rc;
+
+		timeout = update_polling(srv);
+
+		if (now_ms() - srv->report_time >= SERVER_REPORT_SEC * 1000)
+			report_stats(srv);
+
+		/* Wake up for the next stop, report, re-dump or window */
+		report = srv->report_time + SERVER_REPORT_SEC * 1000 -
+								now_ms();
+		if (timeout < 0 || report < timeout)
+			timeout = report;
+		if (timeout > NFCCTL_DEV_REDUMP_SEC * 1000)
+			timeout = NFCCTL_DEV_REDUMP_SEC * 1000;
+		if (srv->windows_count && timeout > 60 * 1000)
+			timeout = 60 * 1000;
+		if (nfcctl_event_pending(&srv->ctx))
+			timeout = 0;
+
+		fds[0].fd = srv->listen_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = nfcctl_get_fd(&srv->ctx);
+		fds[1].events = POLLIN;
+		nfds = 2;
+
+		for (i = 0; i < SERVER_CLIENTS_MAX; i++) {
+			if (srv->clients[i].fd == -1)
+				continue;
+
+			cls[nfds - 2] = &srv->clients[i];
+			fds[nfds].fd = srv->clients[i].fd;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+
+		rc = poll(fds, nfds, timeout);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		srv->wakeups++;
+
+		if ((fds[1].revents & POLLIN) ||
+					nfcctl_event_pending(&srv->ctx)) {
+			rc = handle_targets(srv);
+			if (rc)
+				return rc;
+		}
+
+		for (i = 2; i < nfds; i++) {
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				client_request(srv, cls[i - 2]);
+		}
+
+		if (fds[0].revents & POLLIN)
+			client_accept(srv);
+	}
+}
+
+/* Serve control socket clients on top of one long-lived nfcctl context */
+int server_run(const struct server_opts *opts)
+{
+	const char *path = opts->path;
+	struct server *srv;
+	unsigned i;
+	int rc;
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		return -ENOMEM;
+
+	for (i = 0; i < SERVER_CLIENTS_MAX; i++)
+		srv->clients[i].fd = -1;
+
+	srv->ctx.verbose = opts->verbose;
+	srv->readahead = opts->readahead;
+
+	if (opts->schedule) {
+		rc = parse_schedule(srv, opts->schedule);
+		if (rc) {
+			printerr("%s: %s", opts->schedule, strerror(-rc));
+			goto free_srv;
+		}
+	}
+
+	if (opts->ring_name) {
+		rc = evring_create(&srv->ring, opts->ring_name,
+							EVRING_SLOTS);
+		if (rc) {
+			printerr("%s: %s", opts->ring_name, strerror(-rc));
+			goto free_srv;
+		}
+		srv->ring_enabled = 1;
+	}
+
+	rc = nfcctl_init(&srv->ctx);
+	if (rc) {
+		printerr("%s", strerror(abs(rc)));
+		goto close_ring;
+	}
+
+	rc = nfcctl_sync_devices(&srv->ctx);
+	if (rc < 0) {
+		printerr("%s", strerror(-rc));
+		goto deinit;
+	}
+
+
+	srv->listen_fd = listen_on(path);
+	if (srv->listen_fd < 0) {
+		rc = srv->listen_fd;
+		printerr("%s: %s", path, strerror(-rc));
+		goto deinit;
+	}
+
+	rc = server_loop(srv);
+	if (rc)
+		printerr("%s", strerror(abs(rc)));
+
+	for (i = 0; i < SERVER_CLIENTS_MAX; i++) {
+		if (srv->clients[i].fd != -1)
+			close(srv->clients[i].fd);
+	}
+
+	close(srv->listen_fd);
+	unlink(path);
+deinit:
+	nfcctl_deinit(&srv->ctx);
+close_ring:
+	if (srv->ring_enabled)
+		evring_close(&srv->ring);
+free_srv:
+	free(srv);
+	return rc;
+}
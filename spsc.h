@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _SPSC_H_
+#define _SPSC_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#define SPSC_CACHELINE 64
+
+/*
+ * Lock-free single-producer/single-consumer ring of fixed-size elements.
+ *
+ * tail is only written by the producer and head only by the consumer; they
+ * sit on separate cache lines so the two sides do not bounce a line between
+ * CPUs on every operation. The number of slots must be a power of two.
+ */
+struct spsc_ring {
+	_Atomic uint32_t head __attribute__((aligned(SPSC_CACHELINE)));
+	_Atomic uint32_t tail __attribute__((aligned(SPSC_CACHELINE)));
+	uint32_t mask __attribute__((aligned(SPSC_CACHELINE)));
+	uint32_t elem_size;
+	uint8_t *slots;
+};
+
+static inline int spsc_init(struct spsc_ring *r, uint32_t nslots,
+							uint32_t elem_size)
+{
+	if (!nslots || (nslots & (nslots - 1)))
+		return -EINVAL;
+
+	r->slots = calloc(nslots, elem_size);
+	if (!r->slots)
+		return -ENOMEM;
+
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->mask = nslots - 1;
+	r->elem_size = elem_size;
+
+	return 0;
+}
+
+static inline void spsc_free(struct spsc_ring *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+/* Producer side. Returns -EAGAIN if the ring is full */
+static inline int spsc_push(struct spsc_ring *r, const void *elem)
+{
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if (tail - head > r->mask)
+		return -EAGAIN;
+
+	memcpy(r->slots + (tail & r->mask) * r->elem_size, elem,
+							r->elem_size);
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+
+	return 0;
+}
+
+/* Consumer side. Returns -EAGAIN if the ring is empty */
+static inline int spsc_pop(struct spsc_ring *r, void *elem)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head == tail)
+		return -EAGAIN;
+
+	memcpy(elem, r->slots + (head & r->mask) * r->elem_size,
+							r->elem_size);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+	return 0;
+}
+
+#endif /* _SPSC_H_ */
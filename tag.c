@@ -0,0 +1,656 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "tag_mifare.h"
+#include "tag_felica.h"
+#include "tag_jewel.h"
+#include "tag_t4.h"
+#include "nfclog.h"
+
+/*
+ * Drivers in order of preference, for targets speaking several protocols.
+ * A target reporting both MIFARE and ISO14443 (SAK 0x28 and the like) is
+ * an ISO14443-4 card, not an Ultralight, so the Type 4 driver comes first.
+ */
+static const struct tag_driver *tag_drivers[] = {
+	&tag_t4_driver,
+	&tag_mifare_driver,
+	&tag_felica_driver,
+	&tag_jewel_driver,
+};
+
+#define TAG_DRIVERS_COUNT (sizeof(tag_drivers) / sizeof(tag_drivers[0]))
+
+/* Best driver for a target supporting the given NFC_PROTO_*_MASK bits */
+const struct tag_driver *tag_driver_find(uint32_t protocols)
+{
+	unsigned i;
+
+	for (i = 0; i < TAG_DRIVERS_COUNT; i++) {
+		if (protocols & (1 << tag_drivers[i]->protocol))
+			return tag_drivers[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Connect to a target, choosing its driver once among the protocols both
+ * the target and the caller accept. The session takes one of the free
+ * slots of ctx and is released with nfcctl_target_deinit().
+ */
+int tag_connect(struct nfcctl *ctx, uint32_t dev_idx, uint32_t tgt_idx,
+			uint32_t protocols, struct nfc_session **sess)
+{
+	const struct tag_driver *drv;
+	struct nfc_session *s;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	drv = tag_driver_find(protocols);
+	if (!drv) {
+		printdbg(ctx, "No driver for protocols 0x%x", protocols);
+		return -ENOSYS;
+	}
+
+	rc = nfcctl_target_init(ctx, dev_idx, tgt_idx, drv->protocol, &s);
+	if (rc)
+		return -abs(rc);
+
+	s->tag_drv = drv;
+	s->tag_data = NULL;
+	s->tag_size = drv->max_size;
+
+	if (drv->probe) {
+		rc = drv->probe(s);
+		if (rc) {
+			nfcctl_target_deinit(s);
+			return rc;
+		}
+	}
+
+	printdbg(ctx, "Target %d bound to %s driver, %lu bytes", tgt_idx,
+						drv->name, s->tag_size);
+
+	*sess = s;
+	return 0;
+}
+
+int tag_read(struct nfc_session *sess, void *buf, size_t count)
+{
+	int rc;
+
+	if (!sess->tag_drv || !(sess->tag_drv->caps & TAG_CAP_READ)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	rc = sess->tag_drv->read(sess, buf, count);
+	if (rc >= 0 && rc != count)
+		errno = EIO;
+
+	return rc;
+}
+
+int tag_write(struct nfc_session *sess, const void *buf, size_t count)
+{
+	int rc;
+
+	if (!sess->tag_drv || !(sess->tag_drv->caps & TAG_CAP_WRITE)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	rc = sess->tag_drv->write(sess, buf, count);
+	if (rc >= 0 && rc != count)
+		errno = EIO;
+
+	return rc;
+}
+
+int tag_uid(struct nfc_session *sess, uint8_t *uid, size_t max)
+{
+	if (!sess->tag_drv || !sess->tag_drv->uid) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	return sess->tag_drv->uid(sess, uid, max);
+}
+
+/*
+ * Set x up for a transfer of count bytes on sess. The UID is read now,
+ * while the tag is still there to be asked; a tag without one can still be
+ * transferred to, but not resumed.
+ */
+int tag_xfer_init(struct nfc_session *sess, struct tag_xfer *x, int write,
+						void *buf, size_t count)
+{
+	memset(x, 0, sizeof(*x));
+	x->write = write;
+	x->buf = buf;
+	x->count = count;
+
+	x->uid_len = tag_uid(sess, x->uid, sizeof(x->uid));
+	if (x->uid_len == -1) {
+		if (errno != EOPNOTSUPP)
+			return -errno;
+		x->uid_len = 0;
+	}
+
+	return 0;
+}
+
+/* Transfer what is left of x, or all of it if the driver cannot resume */
+static int xfer_step(struct nfc_session *sess, struct tag_xfer *x)
+{
+	const struct tag_driver *drv = sess->tag_drv;
+	uint8_t *p;
+	size_t left;
+	int rc;
+
+	if (x->write ? !drv->write_at : !drv->read_at)
+		x->done = 0;
+
+	p = (uint8_t *) x->buf + x->done;
+	left = x->count - x->done;
+
+	if (!x->done)
+		rc = x->write ? tag_write(sess, p, left) :
+						tag_read(sess, p, left);
+	else if (x->write)
+		rc = drv->write_at(sess, p, left, x->done);
+	else
+		rc = drv->read_at(sess, p, left, x->done);
+
+	if (rc > 0)
+		x->done += rc;
+
+	if (x->done == x->count)
+		return 0;
+
+	/* A short transfer leaves errno alone */
+	if (rc >= 0)
+		errno = EIO;
+
+	return -1;
+}
+
+static uint64_t xfer_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Wait for the tag of x to be found again by the reader of *sess, which is
+ * released first. On success *sess is a new session on that tag, otherwise
+ * it is NULL. Other readers reporting targets meanwhile are armed again
+ * for the same protocols before returning, as tag_discover() left them.
+ */
+static int xfer_reconnect(struct nfc_session **sess, struct tag_xfer *x)
+{
+	struct nfc_session *s = *sess;
+	struct nfcctl *ctx = s->ctx;
+	uint32_t dev_idx = s->dev_idx;
+	uint32_t protocols = 1 << s->tag_drv->protocol;
+	uint32_t idx[NFCCTL_SESSIONS_MAX];
+	uint32_t protocolsv[NFCCTL_SESSIONS_MAX];
+	struct nfc_target_batch batch = {
+		.max = NFCCTL_SESSIONS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	struct nfcctl_arm_set others = { .count = 0 };
+	uint8_t uid[TAG_UID_MAX];
+	uint64_t deadline;
+	struct nfc_dev *dev;
+	struct pollfd fds;
+	unsigned i;
+	int left;
+	int rc;
+
+	nfcctl_target_deinit(s);
+	*sess = NULL;
+
+	dev = nfcctl_find_device(ctx, dev_idx);
+	if (!dev)
+		return -ENODEV;
+
+	deadline = xfer_now_ms() + TAG_XFER_TIMEOUT_MS;
+
+	for (;;) {
+		rc = nfcctl_rearm_poll(ctx, dev, protocols);
+		if (rc)
+			goto out;
+
+		batch.count = 0;
+
+		do {
+			left = deadline - xfer_now_ms();
+			if (left <= 0) {
+				nfcctl_stop_poll(ctx, dev);
+				rc = -ETIMEDOUT;
+				goto out;
+			}
+
+			fds.fd = nfcctl_get_fd(ctx);
+			fds.events = POLLIN;
+
+			if (nfcctl_event_pending(ctx))
+				left = 0;
+
+			rc = poll(&fds, 1, left);
+			if (rc == -1 && errno != EINTR) {
+				rc = -errno;
+				goto out;
+			}
+			if (rc <= 0 && !nfcctl_event_pending(ctx))
+				continue;
+
+			/* Lost events may include anyone's, arm them again */
+			rc = nfcctl_targets_found_batch(ctx, &batch);
+			if (rc == -ENOBUFS) {
+				for (i = 0; i < ctx->devs_count; i++) {
+					if (ctx->devs[i].idx != dev_idx)
+						nfcctl_arm_add(&others,
+							ctx->devs[i].idx);
+				}
+				break;
+			}
+			if (rc)
+				goto out;
+
+			/* That reader stopped polling on its event */
+			if (batch.dev_idx != dev_idx && batch.count)
+				nfcctl_arm_add(&others, batch.dev_idx);
+		} while (batch.dev_idx != dev_idx || !batch.count);
+
+		for (i = 0; i < batch.count; i++) {
+			if (!(batch.protocols[i] & protocols))
+				continue;
+
+			if (tag_connect(ctx, dev_idx, batch.idx[i], protocols,
+									&s))
+				continue;
+
+			if (tag_uid(s, uid, sizeof(uid)) == x->uid_len &&
+					!memcmp(uid, x->uid, x->uid_len)) {
+				*sess = s;
+				rc = 0;
+				goto out;
+			}
+
+			nfcctl_target_deinit(s);
+		}
+
+		/* Another tag showed up first, look again */
+	}
+
+out:
+	nfcctl_arm_pending(ctx, &others, protocols);
+	return rc;
+}
+
+/*
+ * Run x to completion. When the tag stops answering, *sess is released and
+ * the same tag waited for on the same reader, up to TAG_XFER_RESUMES_MAX
+ * times, and the transfer carries on from the first byte it did not
+ * acknowledge. *sess is updated to the session in use, NULL if the tag was
+ * lost for good. Returns 0 or a negative errno.
+ */
+int tag_xfer_run(struct nfc_session **sess, struct tag_xfer *x)
+{
+	int rc;
+
+	for (;;) {
+		if (!xfer_step(*sess, x))
+			return 0;
+
+		if (errno != EIO || !x->uid_len ||
+				x->resumes == TAG_XFER_RESUMES_MAX)
+			return -errno;
+
+		x->resumes++;
+
+		printdbg((*sess)->ctx, "Lost tag at byte %lu, resuming",
+								x->done);
+
+		rc = xfer_reconnect(sess, x);
+		if (rc)
+			return rc;
+	}
+}
+
+/*
+ * Read lenv[i] bytes from every sessv[i] into bufv[i]. The commands of all
+ * sessions whose driver splits its reads are queued first, then every
+ * reply is collected, so the reader never idles between two tags; other
+ * drivers are read in turn. rcv[i] is set to the byte count, or to a
+ * negative errno.
+ */
+void tag_read_sessions(struct nfc_session **sessv, unsigned count,
+			void **bufv, const size_t *lenv, int *rcv)
+{
+	const struct tag_driver *drv;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		drv = sessv[i]->tag_drv;
+		rcv[i] = 0;
+
+		if (!drv || !(drv->caps & TAG_CAP_READ)) {
+			rcv[i] = -EOPNOTSUPP;
+			continue;
+		}
+
+		if (drv->read_submit && drv->read_submit(sessv[i], lenv[i]))
+			rcv[i] = -errno;
+	}
+
+	for (i = 0; i < count; i++) {
+		int rc;
+
+		if (rcv[i])
+			continue;
+
+		drv = sessv[i]->tag_drv;
+		if (drv->read_complete)
+			rc = drv->read_complete(sessv[i], bufv[i], lenv[i]);
+		else
+			rc = drv->read(sessv[i], bufv[i], lenv[i]);
+
+		if (rc == lenv[i])
+			rcv[i] = rc;
+		else
+			rcv[i] = rc < 0 ? -errno : -EIO;
+	}
+}
+
+/*
+ * Arm every reader of ctx and wait until targets speaking protocols show
+ * up, then bind every one of them found by the same event to its driver.
+ * Returns the number of sessions stored in sessv, 0 if there is no reader,
+ * or a negative errno.
+ */
+int tag_discover(struct nfcctl *ctx, uint32_t protocols,
+						struct nfc_session **sessv)
+{
+	uint32_t idx[TAG_DISCOVER_TARGETS_MAX];
+	uint32_t protocolsv[TAG_DISCOVER_TARGETS_MAX];
+	struct nfc_target_batch batch = {
+		.max = TAG_DISCOVER_TARGETS_MAX,
+		.idx = idx,
+		.protocols = protocolsv,
+	};
+	unsigned i, count, matched;
+	int rc;
+
+	if (!ctx->devs_count)
+		return 0;
+
+	for (;;) {
+		for (i = 0; i < ctx->devs_count; i++) {
+			rc = nfcctl_rearm_poll(ctx, &ctx->devs[i], protocols);
+			if (rc)
+				return rc;
+		}
+
+		rc = nfcctl_targets_found_batch(ctx, &batch);
+		if (rc)
+			return rc;
+
+		count = 0;
+		matched = 0;
+
+		for (i = 0; i < batch.count; i++) {
+			if (!(batch.protocols[i] & protocols))
+				continue;
+
+			if (count == NFCCTL_SESSIONS_MAX)
+				break;
+
+			matched++;
+
+			rc = tag_connect(ctx, batch.dev_idx, batch.idx[i],
+						protocols, &sessv[count]);
+			if (rc)
+				printdbg(ctx, "Target %d: %s", batch.idx[i],
+							strerror(-rc));
+			else
+				count++;
+		}
+
+		if (count)
+			return count;
+
+		/* Targets matched but none of them could be bound */
+		if (matched)
+			return rc;
+	}
+}
+
+void tag_hold_release(struct tag_hold *h)
+{
+	if (h->open)
+		nfcctl_deinit(&h->ctx);
+
+	h->open = 0;
+	h->count = 0;
+}
+
+static int hold_get(struct tag_hold *h, uint32_t protocols)
+{
+	int rc;
+
+	if (h->count)
+		return h->count;
+
+	tag_hold_release(h);
+
+	memset(&h->ctx, 0, sizeof(h->ctx));
+	h->ctx.verbose = h->verbose;
+
+	rc = nfcctl_init(&h->ctx);
+	if (rc)
+		return rc;
+
+	h->open = 1;
+
+	rc = nfcctl_sync_devices(&h->ctx);
+	if (rc <= 0)
+		return rc;
+
+	rc = tag_discover(&h->ctx, protocols, h->sessv);
+	if (rc > 0)
+		h->count = rc;
+
+	return rc;
+}
+
+/*
+ * Transfer on the first count targets held. Sessions found by this very
+ * discovery wait for their tag to come back if it leaves the field; held
+ * ones fail at once, as their tag is most likely gone for good.
+ */
+static int hold_xfer(struct tag_hold *h, int count, int write, void *buf,
+						size_t len, int fresh)
+{
+	struct tag_xfer xfer;
+	int i;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		if (!fresh) {
+			rc = write ? tag_write(h->sessv[i], buf, len) :
+					tag_read(h->sessv[i], buf, len);
+			rc = rc == len ? 0 : -errno;
+		} else {
+			rc = tag_xfer_init(h->sessv[i], &xfer, write, buf,
+									len);
+			if (!rc)
+				rc = tag_xfer_run(&h->sessv[i], &xfer);
+		}
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Run one read or write on the targets held by h, or on the next targets
+ * speaking protocol if it holds none. A write goes to every target of the
+ * event, a read only to the first one and is cut down to the capacity of
+ * the tag. When the held targets are gone, the operation is run again on
+ * the next ones discovered. A failure drops the targets. Returns the
+ * number of bytes transferred, 0 if there is no reader, or a negative
+ * errno.
+ */
+int tag_hold_xfer(struct tag_hold *h, uint32_t protocol, int write,
+						void *buf, size_t len)
+{
+	const struct tag_driver *drv;
+	int count, fresh;
+	int rc;
+
+	if (protocol >= NFC_PROTO_MAX)
+		return -EINVAL;
+
+	drv = tag_driver_find(1 << protocol);
+	if (!drv)
+		return -ENOSYS;
+
+	if (len > drv->max_size)
+		return -EINVAL;
+
+	do {
+		fresh = !h->count;
+
+		rc = hold_get(h, 1 << protocol);
+		if (rc <= 0)
+			break;
+
+		count = rc;
+
+		if (!write) {
+			if (len > h->sessv[0]->tag_size)
+				len = h->sessv[0]->tag_size;
+			count = 1;
+		}
+
+		rc = hold_xfer(h, count, write, buf, len, fresh);
+		if (rc)
+			h->count = 0;
+	} while (rc && !fresh);
+
+	if (rc < 0) {
+		tag_hold_release(h);
+		return rc;
+	}
+
+	return h->count ? len : 0;
+}
+
+int tag_send(struct nfc_session *sess, const void *buf, size_t size)
+{
+	struct nfcctl *ctx = sess->ctx;
+	int fd = sess->fd;
+	struct pollfd fds;
+	int rc;
+
+	fds.fd = fd;
+	fds.events = POLLOUT;
+	fds.revents = 0;
+
+	rc = poll(&fds, 1, -1);
+	printdbg(ctx, "poll(%p, 1, 1) = %d", &fds, rc);
+	if (rc == -1) {
+		printdbg(ctx, "poll error: %s", strerror(errno));
+		return rc;
+	}
+	if (fds.revents != POLLOUT) {
+		printdbg(ctx, "poll error revent=0x%x", fds.revents);
+		errno = EIO;
+		return -1;
+	}
+
+	rc = send(fd, buf, size, 0);
+	printdbg(ctx, "send(%d, %p, %lu, 0) = %d", fd, buf, size, rc);
+	if (rc == -1)
+		printdbg(ctx, "send error: %s", strerror(errno));
+	else
+		ctx->tag_frames++;
+
+	return rc;
+}
+
+/* Receive one reply frame. Returns its length, or -1 with errno set */
+int tag_recv(struct nfc_session *sess, void *buf, size_t size)
+{
+	struct nfcctl *ctx = sess->ctx;
+	int fd = sess->fd;
+	struct pollfd fds;
+	int rc;
+
+	fds.fd = fd;
+	fds.events = POLLIN;
+	fds.revents = 0;
+
+	rc = poll(&fds, 1, -1);
+	printdbg(ctx, "poll(%p, 1, 1) = %d", &fds, rc);
+	if (rc == -1) {
+		printdbg(ctx, "poll error: %s", strerror(errno));
+		return rc;
+	}
+	if (fds.revents != POLLIN) {
+		printdbg(ctx, "poll error revent=0x%x", fds.revents);
+		errno = EIO;
+		return -1;
+	}
+
+	rc = recv(fd, buf, size, 0);
+	printdbg(ctx, "recv(%d, %p, %lu, 0) = %d", fd, buf, size, rc);
+	if (rc == -1)
+		printdbg(ctx, "recv error: %s", strerror(errno));
+
+	return rc;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _TAG_H_
+#define _TAG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nfcctl.h"
+
+/* Driver capabilities */
+#define TAG_CAP_READ		0x01
+#define TAG_CAP_WRITE		0x02
+
+/* Largest max_size of all drivers, for callers sizing their buffers */
+#define TAG_DATA_MAX 8192
+
+/* Longest identifier uid() returns */
+#define TAG_UID_MAX 10
+
+/*
+ * Tag driver, one per NFC_PROTO_* tag type.
+ *
+ * probe() runs right after the raw socket is connected and may keep
+ * per-target state in sess->tag_data, which remove() releases. It may also
+ * lower sess->tag_size, which starts at max_size, to the capacity the tag
+ * reports. read() and write() transfer up to sess->tag_size bytes of user
+ * data starting at offset 0 and, like the socket calls they are built on,
+ * return the byte count or -1 with errno set.
+ *
+ * Drivers which pipeline their reads may also split read() in two:
+ * read_submit() queues every command and read_complete() collects the
+ * replies, so tag_read_sessions() can put the frames of several targets
+ * on the air back to back. write_submit() and write_complete() split
+ * write() the same way, letting the caller do other work, such as re-arming
+ * polling, while the tag is busy programming.
+ *
+ * uid() copies the identifier of the tag, up to max bytes, and returns its
+ * length or -1 with errno set.
+ *
+ * On failure, read() and write() may instead return the bytes the tag
+ * acknowledged before it went silent, with errno set. Drivers which can
+ * start a transfer anywhere provide read_at() and write_at(), so that
+ * tag_xfer_run() picks an interrupted transfer up where it stopped.
+ */
+struct tag_driver {
+	const char *name;
+	uint32_t protocol;
+	uint32_t caps;
+	size_t max_size;
+
+	int (*probe)(struct nfc_session *sess);
+	void (*remove)(struct nfc_session *sess);
+	int (*read)(struct nfc_session *sess, void *buf, size_t count);
+	int (*write)(struct nfc_session *sess, const void *buf, size_t count);
+	int (*read_submit)(struct nfc_session *sess, size_t count);
+	int (*read_complete)(struct nfc_session *sess, void *buf, size_t count);
+	int (*write_submit)(struct nfc_session *sess, const void *buf,
+								size_t count);
+	int (*write_complete)(struct nfc_session *sess, size_t count);
+	int (*uid)(struct nfc_session *sess, uint8_t *uid, size_t max);
+	int (*read_at)(struct nfc_session *sess, void *buf, size_t count,
+							size_t offset);
+	int (*write_at)(struct nfc_session *sess, const void *buf,
+						size_t count, size_t offset);
+};
+
+/*
+ * Resumable transfer of count bytes between buf and the tag. done is the
+ * cursor, the count of bytes the tag acknowledged so far, and uid tells
+ * the tag apart when it comes back after leaving the field.
+ */
+struct tag_xfer {
+	int write;
+	void *buf;
+	size_t count;
+	size_t done;
+	uint8_t uid[TAG_UID_MAX];
+	int uid_len;
+	unsigned resumes;
+};
+
+/* How often, and for how long each time, a lost tag is waited for */
+#define TAG_XFER_RESUMES_MAX 3
+#define TAG_XFER_TIMEOUT_MS 2000
+
+const struct tag_driver *tag_driver_find(uint32_t protocols);
+
+int tag_connect(struct nfcctl *ctx, uint32_t dev_idx, uint32_t tgt_idx,
+			uint32_t protocols, struct nfc_session **sess);
+/* Bytes transferred or -1, with errno set to EIO when short */
+int tag_read(struct nfc_session *sess, void *buf, size_t count);
+int tag_write(struct nfc_session *sess, const void *buf, size_t count);
+int tag_uid(struct nfc_session *sess, uint8_t *uid, size_t max);
+int tag_xfer_init(struct nfc_session *sess, struct tag_xfer *x, int write,
+						void *buf, size_t count);
+int tag_xfer_run(struct nfc_session **sess, struct tag_xfer *x);
+void tag_read_sessions(struct nfc_session **sessv, unsigned count,
+			void **bufv, const size_t *lenv, int *rcv);
+
+/* Targets of one event tag_discover() looks at */
+#define TAG_DISCOVER_TARGETS_MAX 32
+
+int tag_discover(struct nfcctl *ctx, uint32_t protocols,
+						struct nfc_session **sessv);
+
+/*
+ * Targets kept connected across operations, so a sequence of reads and
+ * writes on the same tags pays for discovery and connection once. Zero it
+ * and set verbose before the first operation; ctx is set up by the first
+ * discovery. count is 0 while nothing is connected, and the next
+ * operation discovers. Release with tag_hold_release().
+ */
+struct tag_hold {
+	struct nfcctl ctx;
+	struct nfc_session *sessv[NFCCTL_SESSIONS_MAX];
+	int count;
+	int open;			/* ctx needs nfcctl_deinit() */
+	int verbose;
+};
+
+int tag_hold_xfer(struct tag_hold *h, uint32_t protocol, int write,
+						void *buf, size_t len);
+void tag_hold_release(struct tag_hold *h);
+
+/* Raw socket helpers shared by the drivers */
+int tag_send(struct nfc_session *sess, const void *buf, size_t size);
+int tag_recv(struct nfc_session *sess, void *buf, size_t size);
+
+#endif /* _TAG_H_ */
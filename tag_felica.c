@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "tag_felica.h"
+#include "nfclog.h"
+
+#define CMD_POLLING 0x00
+#define CMD_READ_WO_ENC 0x06
+#define CMD_WRITE_WO_ENC 0x08
+
+/* Type 3 Tag service codes for the user (NDEF) area */
+#define SC_READ 0x000B
+#define SC_WRITE 0x0009
+
+#define IDM_SIZE 8
+#define BLK_SIZE 16
+#define BLK_TO_B(x) ((x) * BLK_SIZE)
+
+/*
+ * Block 0 holds the attribute information; user data starts at block 1.
+ * 2-byte block list elements address blocks up to 255.
+ */
+#define ATTR_BLOCK 0
+#define DATA_BLOCK_START 1
+#define DATA_BLOCK_MAX 255
+
+/* Used when block 0 does not hold valid attribute information */
+#define LITE_S_NMAXB 13
+
+/*
+ * Frame layout: LEN CMD IDm[8] NSVC SC[2] NBLK BLKLIST[2 * NBLK] DATA.
+ * Replies carry LEN RSP IDm[8] SF1 SF2 (NBLK DATA) after the NFC header.
+ */
+#define FRAME_MAX 255
+#define REQ_HDR_SIZE 14
+#define RSP_HDR_SIZE 12
+#define RSP_READ_HDR_SIZE 13
+#define NBR_MAX ((FRAME_MAX - RSP_READ_HDR_SIZE) / BLK_SIZE)
+#define NBW_MAX ((FRAME_MAX - REQ_HDR_SIZE) / (BLK_SIZE + 2))
+
+#define NFC_HEADER_SIZE 1
+
+struct felica_data {
+	uint8_t idm[IDM_SIZE];
+	unsigned nbr;			/* blocks per Read command */
+	unsigned nbw;			/* blocks per Write command */
+	unsigned nmaxb;			/* user data blocks */
+};
+
+/* Build a Read/Write Without Encryption header; returns its length */
+static size_t build_cmd(const struct felica_data *f, uint8_t *frame,
+			uint8_t cmd, uint16_t sc, unsigned blk, unsigned nblk)
+{
+	size_t len = 0;
+	unsigned i;
+
+	frame[len++] = 0;		/* LEN, set by the caller */
+	frame[len++] = cmd;
+	memcpy(frame + len, f->idm, IDM_SIZE);
+	len += IDM_SIZE;
+	frame[len++] = 1;
+	frame[len++] = sc & 0xff;
+	frame[len++] = sc >> 8;
+	frame[len++] = nblk;
+
+	for (i = 0; i < nblk; i++) {
+		frame[len++] = 0x80;
+		frame[len++] = blk + i;
+	}
+
+	return len;
+}
+
+/* Validate a reply to cmd, as received after the NFC header */
+static int check_reply(const uint8_t *rsp, int len, uint8_t cmd,
+						size_t expected)
+{
+	if (len != NFC_HEADER_SIZE + expected || rsp[0] != 0)
+		return -1;
+
+	rsp += NFC_HEADER_SIZE;
+
+	if (rsp[1] != cmd + 1 || rsp[RSP_HDR_SIZE - 2] != 0)
+		return -1;
+
+	return 0;
+}
+
+/* Blocks carried by the Read command starting sent blocks into count */
+static unsigned read_nblk(const struct felica_data *f, unsigned sent,
+							size_t count)
+{
+	if (BLK_TO_B(sent + f->nbr) > count)
+		return (count - BLK_TO_B(sent) + BLK_SIZE - 1) / BLK_SIZE;
+
+	return f->nbr;
+}
+
+/* Send every Read command; the replies are queued on the socket */
+static int felica_send_reads(struct nfc_session *sess, unsigned blk,
+							size_t count)
+{
+	struct felica_data *f = sess->tag_data;
+	uint8_t frame[FRAME_MAX];
+	unsigned nblk, sent;
+	int rc;
+
+	for (sent = 0; BLK_TO_B(sent) < count; sent += nblk) {
+		nblk = read_nblk(f, sent, count);
+
+		frame[0] = build_cmd(f, frame, CMD_READ_WO_ENC, SC_READ,
+							blk + sent, nblk);
+
+		rc = tag_send(sess, frame, frame[0]);
+		if (rc == -1)
+			return rc;
+	}
+
+	return 0;
+}
+
+static int felica_recv_reads(struct nfc_session *sess, void *buf,
+							size_t count)
+{
+	struct felica_data *f = sess->tag_data;
+	uint8_t recv_buf[NFC_HEADER_SIZE + FRAME_MAX];
+	unsigned nblk, sent;
+	size_t bytes_count, rsp_size;
+	int rc;
+
+	bytes_count = 0;
+
+	for (sent = 0; BLK_TO_B(sent) < count; sent += nblk) {
+		size_t bytes_to_read;
+
+		nblk = read_nblk(f, sent, count);
+		rsp_size = RSP_READ_HDR_SIZE + BLK_TO_B(nblk);
+
+		rc = tag_recv(sess, recv_buf, sizeof(recv_buf));
+		if (check_reply(recv_buf, rc, CMD_READ_WO_ENC, rsp_size)) {
+			errno = EIO;
+			return bytes_count;
+		}
+
+		bytes_to_read = BLK_TO_B(nblk);
+		if (bytes_count + bytes_to_read > count)
+			bytes_to_read = count - bytes_count;
+
+		memcpy(buf + bytes_count,
+			recv_buf + NFC_HEADER_SIZE + RSP_READ_HDR_SIZE,
+			bytes_to_read);
+
+		bytes_count += bytes_to_read;
+	}
+
+	return bytes_count;
+}
+
+static int felica_read_blocks(struct nfc_session *sess, unsigned blk,
+						void *buf, size_t count)
+{
+	if (felica_send_reads(sess, blk, count))
+		return -1;
+
+	return felica_recv_reads(sess, buf, count);
+}
+
+static int felica_read_submit(struct nfc_session *sess, size_t count)
+{
+	printdbg(sess->ctx, "IN");
+
+	if (count > sess->tag_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return felica_send_reads(sess, DATA_BLOCK_START, count);
+}
+
+static int felica_read_complete(struct nfc_session *sess, void *buf,
+							size_t count)
+{
+	return felica_recv_reads(sess, buf, count);
+}
+
+int tag_felica_read(struct nfc_session *sess, void *buf, size_t count)
+{
+	if (felica_read_submit(sess, count))
+		return -1;
+
+	return felica_read_complete(sess, buf, count);
+}
+
+int tag_felica_write(struct nfc_session *sess, const void *buf, size_t count)
+{
+	struct felica_data *f = sess->tag_data;
+	uint8_t frame[FRAME_MAX];
+	uint8_t recv_buf[NFC_HEADER_SIZE + FRAME_MAX];
+	unsigned nblk, sent;
+	size_t len, bytes_count;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	if (count > sess->tag_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (sent = 0; BLK_TO_B(sent) < count; sent += nblk) {
+		size_t bytes_to_send;
+
+		nblk = f->nbw;
+		if (BLK_TO_B(sent + nblk) > count)
+			nblk = (count - BLK_TO_B(sent) + BLK_SIZE - 1) /
+								BLK_SIZE;
+
+		len = build_cmd(f, frame, CMD_WRITE_WO_ENC, SC_WRITE,
+					DATA_BLOCK_START + sent, nblk);
+
+		bytes_to_send = BLK_TO_B(nblk);
+		if (BLK_TO_B(sent) + bytes_to_send > count) {
+			bytes_to_send = count - BLK_TO_B(sent);
+			memset(frame + len + bytes_to_send, 0,
+					BLK_TO_B(nblk) - bytes_to_send);
+		}
+		memcpy(frame + len, buf + BLK_TO_B(sent), bytes_to_send);
+
+		frame[0] = len + BLK_TO_B(nblk);
+
+		rc = tag_send(sess, frame, frame[0]);
+		if (rc == -1)
+			return rc;
+	}
+
+	bytes_count = 0;
+
+	for (sent = 0; BLK_TO_B(sent) < count; sent += nblk) {
+		nblk = f->nbw;
+		if (BLK_TO_B(sent + nblk) > count)
+			nblk = (count - BLK_TO_B(sent) + BLK_SIZE - 1) /
+								BLK_SIZE;
+
+		rc = tag_recv(sess, recv_buf, sizeof(recv_buf));
+		if (check_reply(recv_buf, rc, CMD_WRITE_WO_ENC,
+							RSP_HDR_SIZE)) {
+			errno = EIO;
+			return bytes_count;
+		}
+
+		bytes_count += BLK_TO_B(nblk);
+	}
+
+	return count;
+}
+
+static int felica_poll_idm(struct nfc_session *sess, struct felica_data *f)
+{
+	/* Wildcard system code, no request data, single time slot */
+	uint8_t cmd[] = { 6, CMD_POLLING, 0xff, 0xff, 0x00, 0x00 };
+	uint8_t recv_buf[NFC_HEADER_SIZE + FRAME_MAX];
+	int rc;
+
+	rc = tag_send(sess, cmd, sizeof(cmd));
+	if (rc == -1)
+		return -errno;
+
+	rc = tag_recv(sess, recv_buf, sizeof(recv_buf));
+	if (rc < NFC_HEADER_SIZE + 2 + IDM_SIZE || recv_buf[0] != 0 ||
+			recv_buf[NFC_HEADER_SIZE + 1] != CMD_POLLING + 1)
+		return -EIO;
+
+	memcpy(f->idm, recv_buf + NFC_HEADER_SIZE + 2, IDM_SIZE);
+
+	return 0;
+}
+
+/*
+ * Block 0 of a Type 3 Tag advertises how many blocks the card accepts per
+ * Read (Nbr) and Write (Nbw) command and the size of the user area.
+ */
+static void felica_parse_attr(struct felica_data *f, const uint8_t *attr)
+{
+	unsigned sum = 0;
+	unsigned i;
+
+	for (i = 0; i < 14; i++)
+		sum += attr[i];
+
+	if (sum != (attr[14] << 8 | attr[15]) || !attr[1] || !attr[2]) {
+		f->nbr = 1;
+		f->nbw = 1;
+		f->nmaxb = LITE_S_NMAXB;
+		return;
+	}
+
+	f->nbr = attr[1] < NBR_MAX ? attr[1] : NBR_MAX;
+	f->nbw = attr[2] < NBW_MAX ? attr[2] : NBW_MAX;
+	f->nmaxb = attr[3] << 8 | attr[4];
+
+	if (f->nmaxb > DATA_BLOCK_MAX)
+		f->nmaxb = DATA_BLOCK_MAX;
+}
+
+static int felica_probe(struct nfc_session *sess)
+{
+	struct felica_data *f;
+	uint8_t attr[BLK_SIZE];
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return -ENOMEM;
+
+	rc = felica_poll_idm(sess, f);
+	if (rc)
+		goto free_f;
+
+	sess->tag_data = f;
+
+	/* A single block per command until the attributes are known */
+	f->nbr = 1;
+	rc = felica_read_blocks(sess, ATTR_BLOCK, attr, sizeof(attr));
+	if (rc != sizeof(attr)) {
+		rc = -EIO;
+		goto free_f;
+	}
+
+	felica_parse_attr(f, attr);
+
+	sess->tag_size = BLK_TO_B(f->nmaxb);
+
+	printdbg(sess->ctx, "Nbr %u Nbw %u Nmaxb %u", f->nbr, f->nbw, f->nmaxb);
+
+	return 0;
+
+free_f:
+	sess->tag_data = NULL;
+	free(f);
+	return rc;
+}
+
+/* The IDm the probe got from Polling */
+static int felica_uid(struct nfc_session *sess, uint8_t *uid, size_t max)
+{
+	struct felica_data *f = sess->tag_data;
+	size_t len = max < IDM_SIZE ? max : IDM_SIZE;
+
+	memcpy(uid, f->idm, len);
+
+	return len;
+}
+
+static void felica_remove(struct nfc_session *sess)
+{
+	free(sess->tag_data);
+}
+
+const struct tag_driver tag_felica_driver = {
+	.name = "felica",
+	.protocol = NFC_PROTO_FELICA,
+	.caps = TAG_CAP_READ | TAG_CAP_WRITE,
+	.max_size = TAG_FELICA_MAX_SIZE,
+	.probe = felica_probe,
+	.remove = felica_remove,
+	.read = tag_felica_read,
+	.write = tag_felica_write,
+	.read_submit = felica_read_submit,
+	.read_complete = felica_read_complete,
+	.uid = felica_uid,
+};
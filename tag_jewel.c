@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "tag_jewel.h"
+#include "nfclog.h"
+
+#define CMD_RID 0x78
+#define CMD_RALL 0x00
+#define CMD_WRITE_E 0x53
+#define CMD_WRITE_NE 0x1A
+
+/* Commands are CMD ADD DATA UID0..UID3, ADD being block << 3 | byte */
+struct jewel_cmd {
+	uint8_t cmd;
+	uint8_t add;
+	uint8_t data;
+	uint8_t uid[4];
+} __attribute__((packed));
+
+#define HR_SIZE 2
+#define UID_SIZE 4
+#define STATIC_MEM_SIZE 120		/* blocks 0x0 to 0xE */
+
+/* User data lives in blocks 0x1 to 0xC of the static memory */
+#define DATA_ADD_START 0x08
+
+#define RID_RSP_SIZE (HR_SIZE + UID_SIZE)
+#define RALL_RSP_SIZE (HR_SIZE + STATIC_MEM_SIZE)
+#define WRITE_RSP_SIZE 2
+
+#define NFC_HEADER_SIZE 1
+
+/*
+ * Header ROM and UID, needed by every command, plus the last known image of
+ * the static memory, used to pick the cheapest write for each byte.
+ */
+struct jewel_data {
+	uint8_t hr[HR_SIZE];
+	uint8_t uid[UID_SIZE];
+	uint8_t mem[STATIC_MEM_SIZE];
+	int mem_valid;
+};
+
+static int jewel_transceive(struct nfc_session *sess, uint8_t cmd, uint8_t add,
+			uint8_t data, void *rsp, size_t rsp_size)
+{
+	struct jewel_data *j = sess->tag_data;
+	struct jewel_cmd c;
+	uint8_t recv_buf[NFC_HEADER_SIZE + RALL_RSP_SIZE];
+	int rc;
+
+	c.cmd = cmd;
+	c.add = add;
+	c.data = data;
+	memcpy(c.uid, j->uid, UID_SIZE);
+
+	rc = tag_send(sess, &c, sizeof(c));
+	if (rc == -1)
+		return rc;
+
+	rc = tag_recv(sess, recv_buf, NFC_HEADER_SIZE + rsp_size);
+	if (rc != NFC_HEADER_SIZE + rsp_size || recv_buf[0] != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	memcpy(rsp, recv_buf + NFC_HEADER_SIZE, rsp_size);
+
+	return 0;
+}
+
+/* Read the whole static memory with a single RALL command */
+static int jewel_read_all(struct nfc_session *sess)
+{
+	struct jewel_data *j = sess->tag_data;
+	uint8_t rsp[RALL_RSP_SIZE];
+	int rc;
+
+	rc = jewel_transceive(sess, CMD_RALL, 0, 0, rsp, sizeof(rsp));
+	if (rc)
+		return rc;
+
+	memcpy(j->hr, rsp, HR_SIZE);
+	memcpy(j->mem, rsp + HR_SIZE, STATIC_MEM_SIZE);
+	j->mem_valid = 1;
+
+	return 0;
+}
+
+int tag_jewel_read(struct nfc_session *sess, void *buf, size_t count)
+{
+	struct jewel_data *j = sess->tag_data;
+
+	printdbg(sess->ctx, "IN");
+
+	if (count > TAG_JEWEL_MAX_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (jewel_read_all(sess))
+		return -1;
+
+	memcpy(buf, j->mem + DATA_ADD_START, count);
+
+	return count;
+}
+
+/*
+ * WRITE-NE only sets bits, so it is enough (and takes half the time of an
+ * erase-then-write) when no bit goes from 1 to 0. Unchanged bytes are not
+ * written at all.
+ */
+int tag_jewel_write(struct nfc_session *sess, const void *buf, size_t count)
+{
+	struct jewel_data *j = sess->tag_data;
+	const uint8_t *data = buf;
+	struct jewel_cmd c;
+	uint8_t recv_buf[NFC_HEADER_SIZE + WRITE_RSP_SIZE];
+	uint8_t *old;
+	size_t i, sent, bytes_count;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	if (count > TAG_JEWEL_MAX_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!j->mem_valid && jewel_read_all(sess))
+		return -1;
+
+	old = j->mem + DATA_ADD_START;
+	memcpy(c.uid, j->uid, UID_SIZE);
+
+	for (i = 0, sent = 0; i < count; i++) {
+		if (old[i] == data[i])
+			continue;
+
+		c.cmd = (old[i] & ~data[i]) ? CMD_WRITE_E : CMD_WRITE_NE;
+		c.add = DATA_ADD_START + i;
+		c.data = data[i];
+
+		rc = tag_send(sess, &c, sizeof(c));
+		if (rc == -1) {
+			j->mem_valid = 0;
+			return rc;
+		}
+
+		sent++;
+	}
+
+	printdbg(sess->ctx, "%lu of %lu bytes changed", sent, count);
+
+	for (bytes_count = 0; bytes_count < sent; bytes_count++) {
+		rc = tag_recv(sess, recv_buf, sizeof(recv_buf));
+		if (rc != sizeof(recv_buf) || recv_buf[0] != 0) {
+			/* Some writes may have landed; re-read next time */
+			j->mem_valid = 0;
+			errno = EIO;
+			return 0;
+		}
+	}
+
+	memcpy(old, data, count);
+
+	return count;
+}
+
+static int jewel_probe(struct nfc_session *sess)
+{
+	struct jewel_data *j;
+	uint8_t rsp[RID_RSP_SIZE];
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		return -ENOMEM;
+
+	sess->tag_data = j;
+
+	/* RID takes a zeroed UID and returns the header ROM and UID */
+	rc = jewel_transceive(sess, CMD_RID, 0, 0, rsp, sizeof(rsp));
+	if (rc) {
+		rc = -errno;
+		sess->tag_data = NULL;
+		free(j);
+		return rc;
+	}
+
+	memcpy(j->hr, rsp, HR_SIZE);
+	memcpy(j->uid, rsp + HR_SIZE, UID_SIZE);
+
+	printdbg(sess->ctx, "HR0 0x%02x HR1 0x%02x", j->hr[0], j->hr[1]);
+
+	return 0;
+}
+
+/* UID0..UID3 as returned by RID */
+static int jewel_uid(struct nfc_session *sess, uint8_t *uid, size_t max)
+{
+	struct jewel_data *j = sess->tag_data;
+	size_t len = max < UID_SIZE ? max : UID_SIZE;
+
+	memcpy(uid, j->uid, len);
+
+	return len;
+}
+
+static void jewel_remove(struct nfc_session *sess)
+{
+	free(sess->tag_data);
+}
+
+const struct tag_driver tag_jewel_driver = {
+	.name = "jewel",
+	.protocol = NFC_PROTO_JEWEL,
+	.caps = TAG_CAP_READ | TAG_CAP_WRITE,
+	.max_size = TAG_JEWEL_MAX_SIZE,
+	.probe = jewel_probe,
+	.remove = jewel_remove,
+	.read = tag_jewel_read,
+	.write = tag_jewel_write,
+	.uid = jewel_uid,
+};
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Static memory user area: blocks 0x1 to 0xC of a Topaz tag */
+#define TAG_JEWEL_MAX_SIZE 96
+
+struct nfc_session;
+struct tag_driver;
+
+extern const struct tag_driver tag_jewel_driver;
+
+int tag_jewel_read(struct nfc_session *sess, void *buf, size_t count);
+int tag_jewel_write(struct nfc_session *sess, const void *buf, size_t count);
@@ -27,9 +27,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
-#include <poll.h>
 
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
 #include "tag_mifare.h"
+#include "nfclog.h"
 
 struct mifare_cmd {
 	uint8_t cmd;
@@ -46,107 +50,41 @@ struct mifare_cmd {
 #define CMD_READ 0x30
 #define CMD_WRITE_1BLK 0xA2
 
+#define UID_BLOCK 0
+#define UID_SIZE 7
+
 #define CMD_READ_BLK_COUNT 4
 #define CMD_WRITE_1BLK_BLK_COUNT 1
 
 #define NFC_HEADER_SIZE 1
 
-extern int verbose;
-
-#define printdbg(s, ...)						\
-	do {								\
-		if (verbose)						\
-			fprintf(stderr, "%s:%d %s: " s "\n",		\
-					__FILE__, __LINE__,		\
-					__func__, ##__VA_ARGS__);	\
-	} while (0)
-
-static int send_command(int fd, struct mifare_cmd *cmd, size_t cmd_size)
-{
-	struct pollfd fds;
-	int rc;
-
-	fds.fd = fd;
-	fds.events = POLLOUT;
-	fds.revents = 0;
-
-	rc = poll(&fds, 1, -1);
-	printdbg("poll(%p, 1, 1) = %d", &fds, rc);
-	if (rc == -1) {
-		printdbg("poll error: %s", strerror(errno));
-		return rc;
-	}
-	if (fds.revents != POLLOUT) {
-		printdbg("poll error revent=0x%x", fds.revents);
-		errno = EIO;
-		return -1;
-	}
-
-	rc = send(fd, cmd, cmd_size, 0);
-	printdbg("send(%d, %p, %lu, 0) = %d", fd, cmd, cmd_size, rc);
-	if (rc == -1)
-		printdbg("send error: %s", strerror(errno));
-
-	return rc;
-}
-
-static int recv_command_reply(int fd, void *buf, size_t count)
-{
-	struct pollfd fds;
-	int rc;
-
-	fds.fd = fd;
-	fds.events = POLLIN;
-	fds.revents = 0;
-
-	rc = poll(&fds, 1, -1);
-	printdbg("poll(%p, 1, 1) = %d", &fds, rc);
-	if (rc == -1) {
-		printdbg("poll error: %s", strerror(errno));
-		return rc;
-	}
-	if (fds.revents != POLLIN) {
-		printdbg("poll error revent=0x%x", fds.revents);
-		errno = EIO;
-		return -1;
-	}
-
-	rc = recv(fd, buf, count, 0);
-	printdbg("recv(%d, %p, %lu, 0) = %d", fd, buf, count, rc);
-	if (rc == -1)
-		printdbg("recv error: %s", strerror(errno));
-	if (rc != count) {
-		errno = EIO;
-		rc = -1;
-	}
-
-	return rc;
-}
-
-int tag_mifare_read(int fd, void *buf, size_t count)
+/*
+ * Queue the READ commands for count bytes from offset, which must fall on
+ * a block boundary; replies wait on the socket.
+ */
+static int mifare_read_submit_at(struct nfc_session *sess, size_t count,
+							size_t offset)
 {
 	size_t read_size = BLK_TO_B(CMD_READ_BLK_COUNT);
 	struct mifare_cmd cmd;
-	size_t recv_size = NFC_HEADER_SIZE + read_size;
-	uint8_t recv_buf[recv_size];
 	size_t bytes_count;
 	int rc;
 
-	printdbg("IN");
+	printdbg(sess->ctx, "IN");
 
-	if (count > TAG_MIFARE_MAX_SIZE) {
+	if (offset + count > TAG_MIFARE_MAX_SIZE || offset % BLK_SIZE) {
 		errno = EINVAL;
 		return -1;
 	}
 
 	cmd.cmd = CMD_READ;
-	cmd.block = DATA_BLOCK_START;
+	cmd.block = DATA_BLOCK_START + offset / BLK_SIZE;
 
 	bytes_count = 0;
 
 	while (bytes_count < count) {
 
-		rc = send_command(fd, &cmd, sizeof(cmd));
+		rc = tag_send(sess, &cmd, sizeof(cmd));
 		if (rc == -1)
 			return rc;
 
@@ -154,6 +92,23 @@ int tag_mifare_read(int fd, void *buf, size_t count)
 		bytes_count += read_size;
 	}
 
+	return 0;
+}
+
+static int mifare_read_submit(struct nfc_session *sess, size_t count)
+{
+	return mifare_read_submit_at(sess, count, 0);
+}
+
+static int mifare_read_complete(struct nfc_session *sess, void *buf,
+							size_t count)
+{
+	size_t read_size = BLK_TO_B(CMD_READ_BLK_COUNT);
+	size_t recv_size = NFC_HEADER_SIZE + read_size;
+	uint8_t recv_buf[recv_size];
+	size_t bytes_count;
+	int rc;
+
 	bytes_count = 0;
 
 	while (bytes_count < count) {
@@ -162,9 +117,11 @@ int tag_mifare_read(int fd, void *buf, size_t count)
 		if (bytes_count + bytes_to_read > count)
 			bytes_to_read = count - bytes_count;
 
-		rc = recv_command_reply(fd, recv_buf, recv_size);
-		if (rc == -1)
+		rc = tag_recv(sess, recv_buf, recv_size);
+		if (rc != recv_size) {
+			errno = EIO;
 			return bytes_count;
+		}
 
 		if (recv_buf[0] != 0) {
 			errno = EIO;
@@ -180,25 +137,44 @@ int tag_mifare_read(int fd, void *buf, size_t count)
 	return bytes_count;
 }
 
-int tag_mifare_write(int fd, const void *buf, size_t count)
+int tag_mifare_read(struct nfc_session *sess, void *buf, size_t count)
+{
+	if (mifare_read_submit(sess, count))
+		return -1;
+
+	return mifare_read_complete(sess, buf, count);
+}
+
+/* Every reply acknowledges whole blocks, so a short read resumes as is */
+static int mifare_read_at(struct nfc_session *sess, void *buf, size_t count,
+							size_t offset)
+{
+	if (mifare_read_submit_at(sess, count, offset))
+		return -1;
+
+	return mifare_read_complete(sess, buf, count);
+}
+
+/* Queue one WRITE command per block from offset; the acks wait */
+static int mifare_write_submit_at(struct nfc_session *sess, const void *buf,
+						size_t count, size_t offset)
 {
 	size_t write_size = BLK_TO_B(CMD_WRITE_1BLK_BLK_COUNT);
 	size_t send_size = sizeof(struct mifare_cmd) + write_size;
 	uint8_t send_buf[send_size];
 	struct mifare_cmd *cmd = (struct mifare_cmd *) send_buf;
-	uint8_t recv_buf[NFC_HEADER_SIZE];
 	size_t bytes_count;
 	int rc;
 
-	printdbg("IN");
+	printdbg(sess->ctx, "IN");
 
-	if (count > TAG_MIFARE_MAX_SIZE) {
+	if (offset + count > TAG_MIFARE_MAX_SIZE || offset % BLK_SIZE) {
 		errno = EINVAL;
 		return -1;
 	}
 
 	cmd->cmd = CMD_WRITE_1BLK;
-	cmd->block = DATA_BLOCK_START;
+	cmd->block = DATA_BLOCK_START + offset / BLK_SIZE;
 
 	bytes_count = 0;
 
@@ -212,7 +188,7 @@ int tag_mifare_write(int fd, const void *buf, size_t count)
 		}
 		memcpy(cmd->data, buf + bytes_count, bytes_to_send);
 
-		rc = send_command(fd, cmd, send_size);
+		rc = tag_send(sess, cmd, send_size);
 		if (rc == -1)
 			return rc;
 
@@ -220,13 +196,31 @@ int tag_mifare_write(int fd, const void *buf, size_t count)
 		bytes_count += bytes_to_send;
 	}
 
+	return 0;
+}
+
+static int mifare_write_submit(struct nfc_session *sess, const void *buf,
+								size_t count)
+{
+	return mifare_write_submit_at(sess, buf, count, 0);
+}
+
+static int mifare_write_complete(struct nfc_session *sess, size_t count)
+{
+	size_t write_size = BLK_TO_B(CMD_WRITE_1BLK_BLK_COUNT);
+	uint8_t recv_buf[NFC_HEADER_SIZE];
+	size_t bytes_count;
+	int rc;
+
 	bytes_count = 0;
 
 	while (bytes_count < count) {
 
-		rc = recv_command_reply(fd, recv_buf, NFC_HEADER_SIZE);
-		if (rc == -1)
+		rc = tag_recv(sess, recv_buf, NFC_HEADER_SIZE);
+		if (rc != NFC_HEADER_SIZE) {
+			errno = EIO;
 			return bytes_count;
+		}
 
 		if (recv_buf[0] != 0) {
 			errno = EIO;
@@ -238,3 +232,70 @@ int tag_mifare_write(int fd, const void *buf, size_t count)
 
 	return count;
 }
+
+int tag_mifare_write(struct nfc_session *sess, const void *buf, size_t count)
+{
+	if (mifare_write_submit(sess, buf, count))
+		return -1;
+
+	return mifare_write_complete(sess, count);
+}
+
+static int mifare_write_at(struct nfc_session *sess, const void *buf,
+						size_t count, size_t offset)
+{
+	if (mifare_write_submit_at(sess, buf, count, offset))
+		return -1;
+
+	return mifare_write_complete(sess, count);
+}
+
+/*
+ * The 7-byte UID sits in the first two blocks, UID0..UID2 then a check
+ * byte in block 0 and UID3..UID6 in block 1.
+ */
+static int mifare_uid(struct nfc_session *sess, uint8_t *uid, size_t max)
+{
+	struct mifare_cmd cmd = {
+		.cmd = CMD_READ,
+		.block = UID_BLOCK,
+	};
+	uint8_t recv_buf[NFC_HEADER_SIZE + BLK_TO_B(CMD_READ_BLK_COUNT)];
+	uint8_t id[UID_SIZE];
+	size_t len = max < UID_SIZE ? max : UID_SIZE;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	rc = tag_send(sess, &cmd, sizeof(cmd));
+	if (rc == -1)
+		return rc;
+
+	rc = tag_recv(sess, recv_buf, sizeof(recv_buf));
+	if (rc != sizeof(recv_buf) || recv_buf[0] != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	memcpy(id, recv_buf + NFC_HEADER_SIZE, 3);
+	memcpy(id + 3, recv_buf + NFC_HEADER_SIZE + BLK_SIZE, 4);
+	memcpy(uid, id, len);
+
+	return len;
+}
+
+const struct tag_driver tag_mifare_driver = {
+	.name = "mifare",
+	.protocol = NFC_PROTO_MIFARE,
+	.caps = TAG_CAP_READ | TAG_CAP_WRITE,
+	.max_size = TAG_MIFARE_MAX_SIZE,
+	.read = tag_mifare_read,
+	.write = tag_mifare_write,
+	.read_submit = mifare_read_submit,
+	.read_complete = mifare_read_complete,
+	.write_submit = mifare_write_submit,
+	.write_complete = mifare_write_complete,
+	.read_at = mifare_read_at,
+	.write_at = mifare_write_at,
+	.uid = mifare_uid,
+};
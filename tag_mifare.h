@@ -23,5 +23,10 @@
 
 #define TAG_MIFARE_MAX_SIZE 48
 
-int tag_mifare_read(int fd, void *buf, size_t count);
-int tag_mifare_write(int fd, const void *buf, size_t count);
+struct nfc_session;
+struct tag_driver;
+
+extern const struct tag_driver tag_mifare_driver;
+
+int tag_mifare_read(struct nfc_session *sess, void *buf, size_t count);
+int tag_mifare_write(struct nfc_session *sess, const void *buf, size_t count);
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <linux/nfc.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "tag_t4.h"
+#include "nfclog.h"
+
+#define INS_SELECT 0xA4
+#define INS_READ_BINARY 0xB0
+#define INS_UPDATE_BINARY 0xD6
+#define INS_GET_RESPONSE 0xC0
+
+#define SW_OK 0x9000
+#define SW1_MORE_DATA 0x61
+
+#define CC_FILE_ID 0xE103
+#define CC_SIZE 15
+#define CC_TLV_NDEF 0x04
+#define CC_TLV_ENDEF 0x06		/* mapping version 3.0 */
+
+#define APDU_HDR_SIZE 4			/* CLA INS P1 P2 */
+#define APDU_EXT_LEN_SIZE 3		/* 00 LenHi LenLo */
+#define APDU_TX_MAX (APDU_HDR_SIZE + APDU_EXT_LEN_SIZE + TAG_T4_MAX_SIZE)
+#define SW_SIZE 2
+
+#define SHORT_LE_MAX 256
+#define SHORT_LC_MAX 255
+#define EXT_LEN_MAX 65535
+
+#define OFFSET_MAX 0x7FFF
+
+#define NFC_HEADER_SIZE 1
+
+static const uint8_t ndef_aid[] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+
+struct t4_data {
+	size_t read_chunk;		/* bytes per READ BINARY */
+	size_t write_chunk;		/* bytes per UPDATE BINARY */
+	int ext;			/* extended-length APDUs */
+	int read_only;
+	uint8_t tx[APDU_TX_MAX];
+	uint8_t rx[NFC_HEADER_SIZE + TAG_T4_MAX_SIZE + SW_SIZE];
+};
+
+static size_t build_apdu(struct t4_data *t, uint8_t ins, uint16_t p1p2,
+				const void *data, size_t lc, size_t le)
+{
+	uint8_t *apdu = t->tx;
+	size_t len = 0;
+
+	apdu[len++] = 0x00;
+	apdu[len++] = ins;
+	apdu[len++] = p1p2 >> 8;
+	apdu[len++] = p1p2 & 0xff;
+
+	if (lc) {
+		if (lc > SHORT_LC_MAX) {
+			apdu[len++] = 0;
+			apdu[len++] = lc >> 8;
+		}
+		apdu[len++] = lc & 0xff;
+		memcpy(apdu + len, data, lc);
+		len += lc;
+	}
+
+	if (le) {
+		if (le > SHORT_LE_MAX) {
+			/* A single 00 marks the extended Le after Lc */
+			if (!lc)
+				apdu[len++] = 0;
+			apdu[len++] = le >> 8;
+			apdu[len++] = le & 0xff;
+		} else {
+			apdu[len++] = le & 0xff;	/* 256 encodes as 00 */
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Send the APDU in t->tx and collect the response data into rsp, following
+ * 61xx with GET RESPONSE until the card reports 9000. Returns the response
+ * data length, or -1 with errno set.
+ */
+static int t4_transceive(struct nfc_session *sess, size_t apdu_len, void *rsp,
+							size_t rsp_max)
+{
+	struct t4_data *t = sess->tag_data;
+	size_t rsp_len = 0;
+	uint16_t sw;
+	int rc;
+
+	for (;;) {
+		size_t data_len;
+
+		rc = tag_send(sess, t->tx, apdu_len);
+		if (rc == -1)
+			return rc;
+
+		rc = tag_recv(sess, t->rx, sizeof(t->rx));
+		if (rc < NFC_HEADER_SIZE + SW_SIZE || t->rx[0] != 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		data_len = rc - NFC_HEADER_SIZE - SW_SIZE;
+		sw = t->rx[rc - 2] << 8 | t->rx[rc - 1];
+
+		if (rsp_len + data_len > rsp_max) {
+			errno = EOVERFLOW;
+			return -1;
+		}
+
+		memcpy(rsp + rsp_len, t->rx + NFC_HEADER_SIZE, data_len);
+		rsp_len += data_len;
+
+		if (sw >> 8 != SW1_MORE_DATA)
+			break;
+
+		apdu_len = build_apdu(t, INS_GET_RESPONSE, 0, NULL, 0,
+				(sw & 0xff) ? (sw & 0xff) : SHORT_LE_MAX);
+	}
+
+	if (sw != SW_OK) {
+		printdbg(sess->ctx, "SW 0x%04x", sw);
+		errno = EIO;
+		return -1;
+	}
+
+	return rsp_len;
+}
+
+static int t4_select(struct nfc_session *sess, uint16_t p1p2, const void *id,
+							size_t id_len)
+{
+	size_t len;
+
+	len = build_apdu(sess->tag_data, INS_SELECT, p1p2, id, id_len, 0);
+
+	return t4_transceive(sess, len, NULL, 0);
+}
+
+int tag_t4_read(struct nfc_session *sess, void *buf, size_t count)
+{
+	struct t4_data *t = sess->tag_data;
+	size_t bytes_count, chunk, len;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	if (count > sess->tag_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (bytes_count = 0; bytes_count < count; bytes_count += rc) {
+		chunk = count - bytes_count;
+		if (chunk > t->read_chunk)
+			chunk = t->read_chunk;
+
+		len = build_apdu(t, INS_READ_BINARY, bytes_count, NULL, 0,
+									chunk);
+
+		rc = t4_transceive(sess, len, buf + bytes_count, chunk);
+		if (rc <= 0) {
+			errno = rc ? errno : EIO;
+			return bytes_count;
+		}
+	}
+
+	return bytes_count;
+}
+
+int tag_t4_write(struct nfc_session *sess, const void *buf, size_t count)
+{
+	struct t4_data *t = sess->tag_data;
+	size_t bytes_count, chunk, len;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	if (t->read_only) {
+		errno = EACCES;
+		return -1;
+	}
+
+	if (count > sess->tag_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (bytes_count = 0; bytes_count < count; bytes_count += chunk) {
+		chunk = count - bytes_count;
+		if (chunk > t->write_chunk)
+			chunk = t->write_chunk;
+
+		len = build_apdu(t, INS_UPDATE_BINARY, bytes_count,
+					buf + bytes_count, chunk, 0);
+
+		rc = t4_transceive(sess, len, NULL, 0);
+		if (rc == -1)
+			return bytes_count;
+	}
+
+	return count;
+}
+
+/*
+ * The capability container gives the largest R-APDU (MLe) and C-APDU (MLc)
+ * the card accepts and the NDEF file to use. Chunks are sized to the
+ * largest exchange both sides can handle; limits above what a short APDU
+ * can express mean the card takes extended-length APDUs.
+ */
+static int t4_parse_cc(struct nfc_session *sess, struct t4_data *t,
+				const uint8_t *cc, uint8_t *file_id)
+{
+	size_t mle, mlc, file_size;
+
+	mle = cc[3] << 8 | cc[4];
+	mlc = cc[5] << 8 | cc[6];
+
+	if (cc[7] == CC_TLV_NDEF && cc[8] >= 6) {
+		file_size = cc[11] << 8 | cc[12];
+		t->read_only = cc[14] != 0;
+	} else if (cc[7] == CC_TLV_ENDEF && cc[8] >= 8) {
+		/* The access bytes lie past CC_SIZE; the card enforces them */
+		file_size = (size_t) cc[11] << 24 | cc[12] << 16 |
+						cc[13] << 8 | cc[14];
+	} else {
+		return -EPROTO;
+	}
+
+	if (!mle || !mlc)
+		return -EPROTO;
+
+	memcpy(file_id, cc + 9, 2);
+
+	t->ext = mle > SHORT_LE_MAX || mlc > SHORT_LC_MAX;
+
+	t->read_chunk = mle;
+	if (!t->ext && t->read_chunk > SHORT_LE_MAX)
+		t->read_chunk = SHORT_LE_MAX;
+
+	t->write_chunk = mlc;
+	if (!t->ext && t->write_chunk > SHORT_LC_MAX)
+		t->write_chunk = SHORT_LC_MAX;
+
+	if (t->read_chunk > TAG_T4_MAX_SIZE)
+		t->read_chunk = TAG_T4_MAX_SIZE;
+	if (t->write_chunk > TAG_T4_MAX_SIZE)
+		t->write_chunk = TAG_T4_MAX_SIZE;
+
+	if (file_size > OFFSET_MAX + 1)
+		file_size = OFFSET_MAX + 1;
+	if (file_size < sess->tag_size)
+		sess->tag_size = file_size;
+
+	printdbg(sess->ctx, "MLe %lu MLc %lu NDEF file %lu bytes%s%s", mle, mlc,
+			file_size, t->ext ? ", extended APDUs" : "",
+			t->read_only ? ", read-only" : "");
+
+	return 0;
+}
+
+static int t4_probe(struct nfc_session *sess)
+{
+	static const uint8_t cc_id[] = { CC_FILE_ID >> 8, CC_FILE_ID & 0xff };
+	struct t4_data *t;
+	uint8_t cc[CC_SIZE];
+	uint8_t file_id[2];
+	size_t len;
+	int rc;
+
+	printdbg(sess->ctx, "IN");
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	sess->tag_data = t;
+
+	/* SELECT by name, then by file identifier */
+	if (t4_select(sess, 0x0400, ndef_aid, sizeof(ndef_aid)) == -1 ||
+			t4_select(sess, 0x000C, cc_id, sizeof(cc_id)) == -1) {
+		rc = -errno;
+		goto free_t;
+	}
+
+	len = build_apdu(t, INS_READ_BINARY, 0, NULL, 0, CC_SIZE);
+	rc = t4_transceive(sess, len, cc, sizeof(cc));
+	if (rc != CC_SIZE) {
+		rc = rc == -1 ? -errno : -EPROTO;
+		goto free_t;
+	}
+
+	rc = t4_parse_cc(sess, t, cc, file_id);
+	if (rc)
+		goto free_t;
+
+	if (t4_select(sess, 0x000C, file_id, sizeof(file_id)) == -1) {
+		rc = -errno;
+		goto free_t;
+	}
+
+	return 0;
+
+free_t:
+	sess->tag_data = NULL;
+	free(t);
+	return rc;
+}
+
+static void t4_remove(struct nfc_session *sess)
+{
+	free(sess->tag_data);
+}
+
+const struct tag_driver tag_t4_driver = {
+	.name = "iso14443",
+	.protocol = NFC_PROTO_ISO14443,
+	.caps = TAG_CAP_READ | TAG_CAP_WRITE,
+	.max_size = TAG_T4_MAX_SIZE,
+	.probe = t4_probe,
+	.remove = t4_remove,
+	.read = tag_t4_read,
+	.write = tag_t4_write,
+};
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "scanlog.h"
+#include "tagdb.h"
+
+/*
+ * Attempts at copying out a slot which stays odd. The writer holds a slot
+ * odd for one memcpy(), so only a writer which died within it gets here.
+ */
+#define TAGDB_READ_RETRIES 1000
+
+static size_t tagdb_size(uint64_t capacity)
+{
+	return sizeof(struct tagdb_hdr) + capacity * sizeof(struct tagdb_slot);
+}
+
+/* Entries a table may hold, keeping probe sequences short */
+static uint64_t tagdb_max_count(uint64_t capacity)
+{
+	return capacity / 4 * 3;
+}
+
+static int tagdb_valid(const struct tagdb_hdr *hdr, size_t map_size)
+{
+	return hdr->magic == TAGDB_MAGIC &&
+		hdr->version == TAGDB_VERSION &&
+		hdr->slot_size == sizeof(struct tagdb_slot) &&
+		hdr->capacity && !(hdr->capacity & (hdr->capacity - 1)) &&
+		tagdb_size(hdr->capacity) == map_size;
+}
+
+static void tagdb_unmap(struct tagdb *db)
+{
+	if (db->hdr)
+		munmap(db->hdr, db->map_size);
+
+	db->hdr = NULL;
+	db->slots = NULL;
+}
+
+static int tagdb_map(struct tagdb *db, int fd, size_t size, int prot)
+{
+	void *map;
+
+	map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	db->hdr = map;
+	db->slots = (struct tagdb_slot *) (db->hdr + 1);
+	db->map_size = size;
+
+	/* Lookups land anywhere in the table */
+	madvise(map, size, MADV_RANDOM);
+
+	return 0;
+}
+
+static int tagdb_map_file(struct tagdb *db, int fd, int prot)
+{
+	struct stat st;
+	int rc;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	if (st.st_size < sizeof(struct tagdb_hdr))
+		return -EPROTO;
+
+	rc = tagdb_map(db, fd, st.st_size, prot);
+	if (rc)
+		return rc;
+
+	if (!tagdb_valid(db->hdr, db->map_size)) {
+		tagdb_unmap(db);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+/*
+ * A writer which died while creating the table leaves the file allocated
+ * with a zero magic, which it writes last.
+ */
+static int tagdb_blank(int fd)
+{
+	uint32_t magic;
+
+	if (pread(fd, &magic, sizeof(magic),
+		offsetof(struct tagdb_hdr, magic)) != sizeof(magic))
+		return 0;
+
+	return !magic;
+}
+
+/*
+ * A writer which died within slot_write() leaves its slot odd. The entry
+ * may be torn but its slot is in use, and is counted already, so it is
+ * only made readable again. With a single writer, only the slot it wrote
+ * last can be odd, which saves reading the whole table.
+ */
+static void tagdb_repair(struct tagdb *db)
+{
+	struct tagdb_slot *slot;
+	uint32_t s;
+
+	if (db->hdr->last_slot >= db->hdr->capacity)
+		return;
+
+	slot = &db->slots[db->hdr->last_slot];
+
+	s = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	if (s & 1)
+		atomic_store_explicit(&slot->seq, s + 1, memory_order_release);
+}
+
+/*
+ * Open path as the writer, creating a table for entries tags if there is
+ * none yet; an existing table keeps its size and has the slot left odd by
+ * a previous writer repaired. The file is allocated up front, so that
+ * running out of disk shows here rather than as a SIGBUS. Fails with
+ * -EBUSY while another writer has the table open.
+ */
+int tagdb_create(struct tagdb *db, const char *path, uint64_t entries)
+{
+	uint64_t capacity;
+	struct stat st;
+	size_t size;
+	int fd;
+	int rc;
+
+	memset(db, 0, sizeof(*db));
+	db->fd = -1;
+
+	if (!entries)
+		return -EINVAL;
+
+	for (capacity = 64; tagdb_max_count(capacity) < entries;
+							capacity *= 2)
+		;
+	size = tagdb_size(capacity);
+
+	fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	/* Released when fd is closed, by tagdb_close() or on exit */
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		rc = errno == EWOULDBLOCK ? -EBUSY : -errno;
+		goto close_fd;
+	}
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	if (st.st_size && !tagdb_blank(fd)) {
+		rc = tagdb_map_file(db, fd, PROT_READ | PROT_WRITE);
+		if (rc)
+			goto close_fd;
+
+		tagdb_repair(db);
+		goto out;
+	}
+
+	/* Start over, the size of a blank file may not match entries */
+	if (st.st_size && ftruncate(fd, 0)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	rc = posix_fallocate(fd, 0, size);
+	if (rc) {
+		rc = -rc;
+		goto close_fd;
+	}
+
+	rc = tagdb_map(db, fd, size, PROT_READ | PROT_WRITE);
+	if (rc)
+		goto close_fd;
+
+	db->hdr->version = TAGDB_VERSION;
+	db->hdr->slot_size = sizeof(struct tagdb_slot);
+	db->hdr->capacity = capacity;
+	db->hdr->last_slot = capacity;
+	atomic_store_explicit(&db->hdr->count, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	db->hdr->magic = TAGDB_MAGIC;
+
+out:
+	db->fd = fd;
+	return 0;
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+/* Map an existing table read-only */
+int tagdb_open(struct tagdb *db, const char *path)
+{
+	int fd;
+	int rc;
+
+	memset(db, 0, sizeof(*db));
+	db->fd = -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	rc = tagdb_map_file(db, fd, PROT_READ);
+
+	close(fd);
+	return rc;
+}
+
+void tagdb_close(struct tagdb *db)
+{
+	/* A zeroed db was never opened, its fd is no file of ours */
+	if (db->hdr && db->fd != -1)
+		close(db->fd);
+
+	db->fd = -1;
+	tagdb_unmap(db);
+}
+
+static uint64_t tagdb_hash(const uint8_t *uid, size_t uid_len)
+{
+	uint64_t h = scanlog_hash(uid, uid_len);
+
+	/* FNV-1a leaves the low bits, which pick the slot, weakest */
+	return h ^ (h >> 32);
+}
+
+/*
+ * Copy the entry of slot out, consistently with the writer. Returns 1, 0
+ * if the slot is free, or -EAGAIN if it stayed odd, see
+ * TAGDB_READ_RETRIES.
+ */
+static int slot_read(struct tagdb_slot *slot, struct tagdb_entry *e)
+{
+	unsigned retries = 0;
+	uint32_t s1, s2;
+
+	for (;;) {
+		s1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (!s1)
+			return 0;
+		if (s1 & 1) {
+			if (++retries == TAGDB_READ_RETRIES)
+				return -EAGAIN;
+			continue;
+		}
+
+		memcpy(e, &slot->e, sizeof(*e));
+
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+		if (s1 == s2)
+			return 1;
+	}
+}
+
+static void slot_write(struct tagdb *db, struct tagdb_slot *slot,
+						const struct tagdb_entry *e)
+{
+	uint32_t s = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+	/* For tagdb_repair(), should the writer die in here */
+	db->hdr->last_slot = slot - db->slots;
+
+	atomic_store_explicit(&slot->seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(&slot->e, e, sizeof(*e));
+
+	atomic_store_explicit(&slot->seq, s + 2, memory_order_release);
+}
+
+/*
+ * Lock-free. Returns 0 with the entry of uid in e, -ENOENT, or -EAGAIN
+ * when uid was not found but a slot on its way could not be read.
+ */
+int tagdb_lookup(const struct tagdb *db, const uint8_t *uid, size_t uid_len,
+						struct tagdb_entry *e)
+{
+	uint64_t mask = db->hdr->capacity - 1;
+	uint64_t i, n;
+	int rc = -ENOENT;
+	int found;
+
+	i = tagdb_hash(uid, uid_len) & mask;
+
+	for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+		found = slot_read(&db->slots[i], e);
+		if (!found)
+			break;
+
+		/* In use all the same, the probe goes on past it */
+		if (found < 0) {
+			rc = found;
+			continue;
+		}
+
+		if (e->uid_len == uid_len && !memcmp(e->uid, uid, uid_len))
+			return 0;
+	}
+
+	return rc;
+}
+
+/*
+ * Writer side: the slot holding uid, or the free slot it would go to.
+ * Only the writer changes slots, so it can look at them directly.
+ */
+static struct tagdb_slot *tagdb_find(struct tagdb *db, const uint8_t *uid,
+							size_t uid_len)
+{
+	uint64_t mask = db->hdr->capacity - 1;
+	struct tagdb_slot *slot;
+	uint64_t i;
+
+	i = tagdb_hash(uid, uid_len) & mask;
+
+	for (;;) {
+		slot = &db->slots[i];
+
+		if (!atomic_load_explicit(&slot->seq, memory_order_relaxed))
+			return slot;
+
+		if (slot->e.uid_len == uid_len &&
+				!memcmp(slot->e.uid, uid, uid_len))
+			return slot;
+
+		i = (i + 1) & mask;
+	}
+}
+
+/* Insert e, or replace the entry of the same UID. Single writer */
+int tagdb_update(struct tagdb *db, const struct tagdb_entry *e)
+{
+	struct tagdb_slot *slot;
+	uint64_t count;
+
+	if (!e->uid_len || e->uid_len > TAGDB_UID_MAX)
+		return -EINVAL;
+
+	slot = tagdb_find(db, e->uid, e->uid_len);
+
+	if (!atomic_load_explicit(&slot->seq, memory_order_relaxed)) {
+		count = atomic_load_explicit(&db->hdr->count,
+							memory_order_relaxed);
+		if (count == tagdb_max_count(db->hdr->capacity))
+			return -ENOSPC;
+
+		atomic_store_explicit(&db->hdr->count, count + 1,
+							memory_order_relaxed);
+	}
+
+	slot_write(db, slot, e);
+
+	return 0;
+}
+
+/*
+ * Record that uid was seen by dev_idx, and for TAGDB_READ or TAGDB_WRITE
+ * that payload went from or to it, adding the tag if it is new.
+ */
+int tagdb_seen(struct tagdb *db, const uint8_t *uid, size_t uid_len,
+		uint32_t dev_idx, int op, const void *payload, size_t len)
+{
+	struct tagdb_slot *slot;
+	struct tagdb_entry e;
+	struct timespec ts;
+	uint64_t now;
+
+	if (!uid_len || uid_len > TAGDB_UID_MAX)
+		return -EINVAL;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	slot = tagdb_find(db, uid, uid_len);
+
+	if (atomic_load_explicit(&slot->seq, memory_order_relaxed)) {
+		memcpy(&e, &slot->e, sizeof(e));
+	} else {
+		memset(&e, 0, sizeof(e));
+		e.uid_len = uid_len;
+		memcpy(e.uid, uid, uid_len);
+		e.first_seen = now;
+	}
+
+	e.last_seen = now;
+	e.last_dev = dev_idx;
+
+	if (op == TAGDB_READ)
+		e.reads++;
+	else if (op == TAGDB_WRITE)
+		e.writes++;
+
+	if (op != TAGDB_SEEN && payload) {
+		e.payload_len = len;
+		e.payload_hash = scanlog_hash(payload, len);
+		memset(e.payload, 0, sizeof(e.payload));
+		memcpy(e.payload, payload, len < TAGDB_PAYLOAD_MAX ? len :
+							TAGDB_PAYLOAD_MAX);
+	}
+
+	return tagdb_update(db, &e);
+}
+
+uint64_t tagdb_count(const struct tagdb *db)
+{
+	return atomic_load_explicit(&db->hdr->count, memory_order_acquire);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _TAGDB_H_
+#define _TAGDB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Persistent tag database: metadata of every tag seen, keyed by its UID.
+ *
+ * The file is an open addressing hash table with linear probing, mapped
+ * as is, so opening a database of millions of tags costs one mmap() and a
+ * lookup a few cache misses. Entries are never removed, which keeps the
+ * probe sequences valid without tombstones.
+ *
+ * There is a single writer, holding an exclusive flock() on the file.
+ * Readers, in the same process or not, take no lock: every slot carries a
+ * sequence count, odd while the writer is changing it, and a reader
+ * retries a slot whose count moved while it was copying the entry out.
+ */
+#define TAGDB_MAGIC 0x4e465444		/* "NFTD" */
+#define TAGDB_VERSION 1
+#define TAGDB_ENTRIES_DEFAULT (1 << 20)
+#define TAGDB_UID_MAX 16
+#define TAGDB_OWNER_MAX 24
+#define TAGDB_PAYLOAD_MAX 32
+
+struct tagdb_entry {
+	uint8_t uid_len;
+	uint8_t reserved[3];
+	uint32_t last_dev;		/* device which last saw the tag */
+	uint8_t uid[TAGDB_UID_MAX];
+	uint64_t first_seen;		/* CLOCK_REALTIME, ns */
+	uint64_t last_seen;
+	uint32_t reads;
+	uint32_t writes;
+	uint64_t payload_hash;		/* FNV-1a of the last payload */
+	uint32_t payload_len;
+	uint32_t reserved2;
+	char owner[TAGDB_OWNER_MAX];	/* NUL padded */
+	uint8_t payload[TAGDB_PAYLOAD_MAX];	/* its first bytes */
+};
+
+struct tagdb_slot {
+	_Atomic uint32_t seq;		/* 0 for a free slot */
+	uint32_t reserved;
+	struct tagdb_entry e;
+} __attribute__((aligned(64)));
+
+struct tagdb_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t reserved;
+	uint64_t capacity;		/* slots, a power of two */
+	_Atomic uint64_t count;		/* entries in use */
+	uint64_t last_slot;		/* the only one which may be odd */
+} __attribute__((aligned(64)));
+
+struct tagdb {
+	struct tagdb_hdr *hdr;
+	struct tagdb_slot *slots;
+	size_t map_size;
+	int fd;				/* the writer's, holding the lock */
+};
+
+/* Transfers tagdb_seen() accounts for */
+#define TAGDB_SEEN	0
+#define TAGDB_READ	1
+#define TAGDB_WRITE	2
+
+int tagdb_create(struct tagdb *db, const char *path, uint64_t entries);
+int tagdb_open(struct tagdb *db, const char *path);
+void tagdb_close(struct tagdb *db);
+
+int tagdb_lookup(const struct tagdb *db, const uint8_t *uid, size_t uid_len,
+						struct tagdb_entry *e);
+int tagdb_update(struct tagdb *db, const struct tagdb_entry *e);
+int tagdb_seen(struct tagdb *db, const uint8_t *uid, size_t uid_len,
+		uint32_t dev_idx, int op, const void *payload, size_t len);
+
+uint64_t tagdb_count(const struct tagdb *db);
+
+#endif /* _TAGDB_H_ */
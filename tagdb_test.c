@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Crash checks for the tag database: a writer dying while creating the
+ * file, or within an update, must not leave it unusable, and a second
+ * writer must be turned away. Works on a scratch file and exits with a
+ * failure status on the first wrong result.
+ *
+ * Usage: tagdb_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tagdb.h"
+
+static const uint8_t uid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+
+static int failures;
+
+static void expect(const char *what, int got, int want)
+{
+	if (got == want)
+		return;
+
+	fprintf(stderr, "%s: got %d, expected %d\n", what, got, want);
+	failures++;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/tagdb_test.XXXXXX";
+	struct tagdb db, other, rd;
+	struct tagdb_entry e;
+	struct tagdb_slot *slot;
+	int fd;
+
+	/* Allocated by a writer which died before writing the magic */
+	fd = mkstemp(path);
+	if (fd == -1 || posix_fallocate(fd, 0, 3 * 4096)) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	expect("blank file taken over", tagdb_create(&db, path, 100), 0);
+
+	expect("second writer", tagdb_create(&other, path, 100), -EBUSY);
+	tagdb_close(&other);
+
+	memset(&e, 0, sizeof(e));
+	e.uid_len = sizeof(uid);
+	memcpy(e.uid, uid, sizeof(uid));
+	expect("update", tagdb_update(&db, &e), 0);
+
+	expect("reader open", tagdb_open(&rd, path), 0);
+	expect("lookup", tagdb_lookup(&rd, uid, sizeof(uid), &e), 0);
+
+	/* The writer dies within slot_write(), leaving its slot odd */
+	slot = &db.slots[db.hdr->last_slot];
+	expect("last slot in use", slot->seq != 0, 1);
+	slot->seq++;
+	expect("lookup of an odd slot",
+		tagdb_lookup(&rd, uid, sizeof(uid), &e), -EAGAIN);
+	tagdb_close(&db);
+
+	expect("next writer", tagdb_create(&db, path, 100), 0);
+	expect("lookup after repair",
+		tagdb_lookup(&rd, uid, sizeof(uid), &e), 0);
+	expect("entries", tagdb_count(&rd), 1);
+
+	tagdb_close(&db);
+	tagdb_close(&rd);
+	unlink(path);
+
+	if (failures) {
+		fprintf(stderr, "%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("tagdb crash recovery: ok\n");
+
+	return EXIT_SUCCESS;
+}
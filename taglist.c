@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scanlog.h"
+#include "taglist.h"
+
+/* Odd multipliers spreading one hash over the eight words of a block */
+static const uint32_t taglist_salt[TAGLIST_BLOCK_WORDS] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+static size_t taglist_size(uint64_t blocks, uint64_t count)
+{
+	return sizeof(struct taglist_hdr) +
+		blocks * sizeof(struct taglist_block) +
+		count * sizeof(struct taglist_uid);
+}
+
+/* FNV-1a, then the murmur3 finalizer so that every bit counts */
+static uint64_t taglist_hash(const struct taglist_uid *u)
+{
+	uint64_t h = scanlog_hash(u, sizeof(*u));
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static struct taglist_block *taglist_block(struct taglist_block *blocks,
+					uint64_t nblocks, uint64_t h)
+{
+	return &blocks[(h >> 32) & (nblocks - 1)];
+}
+
+static void block_set(struct taglist_block *b, uint32_t h)
+{
+	unsigned i;
+
+	for (i = 0; i < TAGLIST_BLOCK_WORDS; i++)
+		b->w[i] |= 1U << ((h * taglist_salt[i]) >> 27);
+}
+
+/* No early exit, so that the loop vectorizes */
+static int block_test(const struct taglist_block *b, uint32_t h)
+{
+	uint32_t miss = 0;
+	unsigned i;
+
+	for (i = 0; i < TAGLIST_BLOCK_WORDS; i++)
+		miss |= ~b->w[i] & (1U << ((h * taglist_salt[i]) >> 27));
+
+	return !miss;
+}
+
+int taglist_uid_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct taglist_uid));
+}
+
+static void taglist_unmap(struct taglist_map *map)
+{
+	if (map->hdr)
+		munmap(map->hdr, map->map_size);
+
+	memset(map, 0, sizeof(*map));
+}
+
+static int taglist_map(struct taglist_map *map, const char *path)
+{
+	struct taglist_hdr *hdr;
+	struct stat st;
+	void *p;
+	int fd;
+	int rc;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	if (st.st_size < sizeof(struct taglist_hdr)) {
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		rc = -errno;
+		goto close_fd;
+	}
+
+	hdr = p;
+	if (hdr->magic != TAGLIST_MAGIC || hdr->version != TAGLIST_VERSION ||
+			!hdr->blocks || (hdr->blocks & (hdr->blocks - 1)) ||
+			taglist_size(hdr->blocks, hdr->count) != st.st_size) {
+		munmap(p, st.st_size);
+		rc = -EPROTO;
+		goto close_fd;
+	}
+
+	madvise(p, st.st_size, MADV_RANDOM);
+
+	map->hdr = hdr;
+	map->blocks = (struct taglist_block *) (hdr + 1);
+	map->uids = (struct taglist_uid *) (map->blocks + hdr->blocks);
+	map->map_size = st.st_size;
+	map->dev = st.st_dev;
+	map->ino = st.st_ino;
+	rc = 0;
+
+close_fd:
+	close(fd);
+	return rc;
+}
+
+int taglist_open(struct taglist *list, const char *path)
+{
+	memset(list, 0, sizeof(*list));
+	list->path = path;
+
+	return taglist_map(&list->map, path);
+}
+
+void taglist_close(struct taglist *list)
+{
+	taglist_unmap(&list->map);
+}
+
+/*
+ * Switch to the file now at the list path if it was replaced. Costs a
+ * stat() when it was not. The old mapping is only released once the new
+ * one is valid, so a failure leaves the list answering as before.
+ */
+int taglist_refresh(struct taglist *list)
+{
+	struct taglist_map map;
+	struct stat st;
+	int rc;
+
+	if (stat(list->path, &st))
+		return -errno;
+
+	if (st.st_dev == list->map.dev && st.st_ino == list->map.ino)
+		return 0;
+
+	memset(&map, 0, sizeof(map));
+
+	rc = taglist_map(&map, list->path);
+	if (rc)
+		return rc;
+
+	taglist_unmap(&list->map);
+	list->map = map;
+
+	return 0;
+}
+
+/* Returns TAGLIST_PRESENT, TAGLIST_ABSENT, or a negative errno */
+int taglist_check(struct taglist *list, const uint8_t *uid, size_t len)
+{
+	const struct taglist_map *map = &list->map;
+	struct taglist_uid key;
+	uint64_t h;
+
+	if (!map->hdr)
+		return -EBADF;
+
+	if (!len || len > TAGLIST_UID_MAX)
+		return -EINVAL;
+
+	memset(&key, 0, sizeof(key));
+	key.len = len;
+	memcpy(key.uid, uid, len);
+
+	h = taglist_hash(&key);
+
+	if (!block_test(taglist_block(map->blocks, map->hdr->blocks, h), h))
+		return TAGLIST_ABSENT;
+
+	list->filter_hits++;
+
+	if (bsearch(&key, map->uids, map->hdr->count, sizeof(key),
+						taglist_uid_cmp))
+		return TAGLIST_PRESENT;
+
+	list->false_hits++;
+
+	return TAGLIST_ABSENT;
+}
+
+/*
+ * Write the list of uids, which are sorted in place, to a temporary file
+ * renamed over path once complete, so that users of the list only ever
+ * see a whole file.
+ */
+int taglist_build(const char *path, struct taglist_uid *uids, size_t count)
+{
+	struct taglist_hdr *hdr;
+	struct taglist_block *blocks;
+	char tmp[PATH_MAX];
+	uint64_t nblocks;
+	size_t i, n, size;
+	void *p;
+	int fd;
+	int rc;
+
+	qsort(uids, count, sizeof(*uids), taglist_uid_cmp);
+
+	/* Drop duplicates */
+	for (i = 0, n = 0; i < count; i++) {
+		if (!n || taglist_uid_cmp(&uids[n - 1], &uids[i]))
+			uids[n++] = uids[i];
+	}
+	count = n;
+
+	for (nblocks = 1; nblocks * sizeof(struct taglist_block) * 8 <
+				count * TAGLIST_BITS_PER_UID; nblocks *= 2)
+		;
+
+	size = taglist_size(nblocks, count);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fd = open(tmp, O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	rc = posix_fallocate(fd, 0, size);
+	if (rc) {
+		rc = -rc;
+		goto unlink_tmp;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		rc = -errno;
+		goto unlink_tmp;
+	}
+
+	hdr = p;
+	blocks = (struct taglist_block *) (hdr + 1);
+
+	for (i = 0; i < count; i++) {
+		uint64_t h = taglist_hash(&uids[i]);
+
+		block_set(taglist_block(blocks, nblocks, h), h);
+	}
+
+	memcpy(blocks + nblocks, uids, count * sizeof(*uids));
+
+	hdr->version = TAGLIST_VERSION;
+	hdr->blocks = nblocks;
+	hdr->count = count;
+	hdr->magic = TAGLIST_MAGIC;
+
+	rc = msync(p, size, MS_SYNC) ? -errno : 0;
+	munmap(p, size);
+	if (rc)
+		goto unlink_tmp;
+
+	if (rename(tmp, path)) {
+		rc = -errno;
+		goto unlink_tmp;
+	}
+
+	close(fd);
+	return 0;
+
+unlink_tmp:
+	unlink(tmp);
+	close(fd);
+	return rc;
+}
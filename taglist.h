@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _TAGLIST_H_
+#define _TAGLIST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * UID list for access decisions, built offline by nfctaglist.
+ *
+ * The file holds a blocked Bloom filter followed by the sorted UIDs. A
+ * UID touches a single 32-byte block of the filter, one bit in each of its
+ * eight words, so a negative answer costs one cache miss and a loop the
+ * compiler turns into a few vector instructions. Only filter positives go
+ * on to the binary search of the exact set, which weeds out the false
+ * ones.
+ *
+ * A list is replaced by renaming a rebuilt file over it. taglist_refresh()
+ * notices and maps the new file, so the checking loop never waits for a
+ * rebuild, and keeps answering from the old mapping if the new file is
+ * bad.
+ */
+#define TAGLIST_MAGIC 0x4e46424c	/* "NFBL" */
+#define TAGLIST_VERSION 1
+#define TAGLIST_UID_MAX 15
+#define TAGLIST_BLOCK_WORDS 8
+#define TAGLIST_BITS_PER_UID 16
+
+struct taglist_block {
+	uint32_t w[TAGLIST_BLOCK_WORDS];
+} __attribute__((aligned(32)));
+
+/* Zero padded, so that UIDs compare with one memcmp() */
+struct taglist_uid {
+	uint8_t len;
+	uint8_t uid[TAGLIST_UID_MAX];
+};
+
+struct taglist_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t blocks;		/* a power of two */
+	uint64_t count;			/* UIDs */
+	uint8_t reserved[40];
+} __attribute__((aligned(64)));
+
+/* One mapped file */
+struct taglist_map {
+	struct taglist_hdr *hdr;
+	struct taglist_block *blocks;
+	struct taglist_uid *uids;
+	size_t map_size;
+	dev_t dev;
+	ino_t ino;
+};
+
+struct taglist {
+	const char *path;
+	struct taglist_map map;
+	unsigned long filter_hits;	/* positives of the filter */
+	unsigned long false_hits;	/* of which not in the list */
+};
+
+/* taglist_check() results */
+#define TAGLIST_ABSENT 0
+#define TAGLIST_PRESENT 1
+
+int taglist_open(struct taglist *list, const char *path);
+void taglist_close(struct taglist *list);
+int taglist_refresh(struct taglist *list);
+int taglist_check(struct taglist *list, const uint8_t *uid, size_t len);
+
+int taglist_build(const char *path, struct taglist_uid *uids, size_t count);
+int taglist_uid_cmp(const void *a, const void *b);
+
+#endif /* _TAGLIST_H_ */
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "nfcctl.h"
+#include "tag.h"
+#include "workers.h"
+#include "spsc.h"
+#include "nfclog.h"
+
+#define WORKER_QUEUE_SIZE 16
+
+/* Each event yields two done entries, see struct worker_done */
+#define WORKER_INFLIGHT_MAX (WORKER_QUEUE_SIZE / 2)
+
+struct worker_event {
+	uint32_t quit;
+	uint32_t dev_idx;
+	struct nfc_target tgt;
+};
+
+/*
+ * A worker reports each event twice: once the target is connected, so the
+ * dispatcher may start polling the reader again while the transfer runs,
+ * and once the op is over.
+ */
+struct worker_done {
+	uint32_t dev_idx;
+	uint32_t captured;
+	int rc;
+};
+
+struct nfc_worker {
+	struct spsc_ring events;	/* dispatcher -> worker */
+	struct spsc_ring done;		/* worker -> dispatcher */
+	struct nfcctl ctx;
+	struct nfc_dev dev;
+	uint32_t protocol;
+	worker_op_t op;
+	void *op_param;
+	int wake_fd;
+	int done_fd;
+	unsigned inflight;		/* only used by the dispatcher */
+	int armed;			/* likewise */
+	int reported;			/* likewise, per received message */
+	pthread_t thread;
+};
+
+static void notify(int fd)
+{
+	uint64_t val = 1;
+
+	while (write(fd, &val, sizeof(val)) == -1 && errno == EINTR)
+		;
+}
+
+static void wait_notify(int fd)
+{
+	uint64_t val;
+
+	while (read(fd, &val, sizeof(val)) == -1 && errno == EINTR)
+		;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct nfc_worker *w = arg;
+	struct worker_event ev;
+	struct worker_done done;
+	struct nfc_session *sess;
+	int rc;
+
+	for (;;) {
+		wait_notify(w->wake_fd);
+
+		while (!spsc_pop(&w->events, &ev)) {
+			if (ev.quit)
+				return NULL;
+
+			done.dev_idx = ev.dev_idx;
+
+			/*
+			 * At most WORKER_INFLIGHT_MAX events are in flight,
+			 * so the done queue can not be full here.
+			 */
+			rc = tag_connect(&w->ctx, ev.dev_idx, ev.tgt.idx,
+						1 << w->protocol, &sess);
+			if (rc) {
+				printdbg(&w->ctx, "Error connecting to target"
+					" %d: %s", ev.tgt.idx, strerror(-rc));
+			} else {
+				done.captured = 1;
+				done.rc = 0;
+				spsc_push(&w->done, &done);
+				notify(w->done_fd);
+
+				rc = w->op(w->op_param, sess, ev.dev_idx,
+								&ev.tgt);
+				nfcctl_target_deinit(sess);
+			}
+
+			done.captured = 0;
+			done.rc = rc;
+			spsc_push(&w->done, &done);
+			notify(w->done_fd);
+		}
+	}
+}
+
+static int worker_init(struct nfc_worker *w, struct nfcctl *ctx,
+				struct nfc_dev *dev, uint32_t protocol,
+				worker_op_t op, void *op_param, int done_fd)
+{
+	int rc;
+
+	memset(w, 0, sizeof(*w));
+
+	w->ctx.verbose = ctx->verbose;
+	w->ctx.log = ctx->log;
+	w->ctx.log_param = ctx->log_param;
+
+	w->dev = *dev;
+	w->protocol = protocol;
+	w->op = op;
+	w->op_param = op_param;
+	w->done_fd = done_fd;
+
+	rc = spsc_init(&w->events, WORKER_QUEUE_SIZE,
+					sizeof(struct worker_event));
+	if (rc)
+		return rc;
+
+	rc = spsc_init(&w->done, WORKER_QUEUE_SIZE,
+					sizeof(struct worker_done));
+	if (rc)
+		goto free_events;
+
+	w->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (w->wake_fd == -1) {
+		rc = -errno;
+		goto free_done;
+	}
+
+	rc = pthread_create(&w->thread, NULL, worker_thread, w);
+	if (rc) {
+		rc = -rc;
+		goto close_wake_fd;
+	}
+
+	return 0;
+
+close_wake_fd:
+	close(w->wake_fd);
+free_done:
+	spsc_free(&w->done);
+free_events:
+	spsc_free(&w->events);
+	return rc;
+}
+
+static void worker_deinit(struct nfc_worker *w)
+{
+	struct worker_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.quit = 1;
+
+	while (spsc_push(&w->events, &ev))
+		sched_yield();
+	notify(w->wake_fd);
+
+	pthread_join(w->thread, NULL);
+
+	close(w->wake_fd);
+	spsc_free(&w->done);
+	spsc_free(&w->events);
+}
+
+static struct nfc_worker *find_worker(struct nfc_worker *workers,
+					uint8_t count, uint32_t dev_idx)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		if (workers[i].dev.idx == dev_idx)
+			return &workers[i];
+	}
+
+	return NULL;
+}
+
+struct dispatch_hdl_data {
+	struct nfc_worker *workers;
+	uint8_t count;
+	struct nfcctl_arm_set added;	/* devices which may need a worker */
+	uint32_t protocol;
+	worker_op_t op;
+	void *op_param;
+	int done_fd;
+};
+
+/*
+ * Polling stops on a device as soon as it reports targets. The first
+ * target of the protocol is handed to the worker of the device, even if
+ * it is still busy with an earlier one, and every other target of the
+ * message is skipped.
+ */
+static int dispatch_handler(void *arg, uint32_t dev_idx,
+						struct nfc_target *tgt)
+{
+	struct dispatch_hdl_data *params = arg;
+	struct nfc_worker *w;
+	struct worker_event ev;
+
+	w = find_worker(params->workers, params->count, dev_idx);
+	if (!w)
+		return TARGET_FOUND_SKIP;
+
+	w->armed = 0;
+
+	if (w->reported || w->inflight == WORKER_INFLIGHT_MAX ||
+				!(tgt->protocols & (1 << w->protocol)))
+		return TARGET_FOUND_SKIP;
+
+	ev.quit = 0;
+	ev.dev_idx = dev_idx;
+	ev.tgt = *tgt;
+
+	if (spsc_push(&w->events, &ev))
+		return TARGET_FOUND_SKIP;
+
+	w->inflight++;
+	w->reported = 1;
+	notify(w->wake_fd);
+
+	return TARGET_FOUND_SKIP;
+}
+
+/*
+ * A target was connected: discovery on its reader may resume while the
+ * transfer runs. Not every driver can poll with a target connected, and
+ * those are re-armed by arm_idle() once the transfer is over.
+ */
+static void arm_early(struct nfcctl *ctx, struct nfc_worker *w)
+{
+	if (!w->armed && !nfcctl_rearm_poll(ctx, &w->dev, 1 << w->protocol))
+		w->armed = 1;
+}
+
+/*
+ * Arm a device again once no event of it is left in flight. The worker of
+ * an unplugged device stays idle, and is armed again if it comes back.
+ */
+static void arm_idle(struct nfcctl *ctx, struct nfc_worker *w)
+{
+	int rc;
+
+	if (w->armed || w->inflight || !nfcctl_find_device(ctx, w->dev.idx))
+		return;
+
+	rc = nfcctl_rearm_poll(ctx, &w->dev, 1 << w->protocol);
+	if (rc)
+		printdbg(ctx, "Arming device %u: %s", w->dev.idx,
+							strerror(-rc));
+	else
+		w->armed = 1;
+}
+
+/* Give each device added a worker, unless it has one, and arm it */
+static void start_added(struct nfcctl *ctx, struct dispatch_hdl_data *d)
+{
+	struct nfc_worker *w;
+	struct nfc_dev *dev;
+	int rc;
+
+	while (d->added.count) {
+		dev = nfcctl_find_device(ctx, d->added.idx[--d->added.count]);
+		if (!dev)
+			continue;
+
+		w = find_worker(d->workers, d->count, dev->idx);
+		if (!w) {
+			if (d->count == NFCCTL_DEVICES_MAX) {
+				printdbg(ctx, "No worker left for device %u",
+								dev->idx);
+				continue;
+			}
+
+			w = &d->workers[d->count];
+			rc = worker_init(w, ctx, dev, d->protocol, d->op,
+						d->op_param, d->done_fd);
+			if (rc) {
+				printdbg(ctx, "Device %u: %s", dev->idx,
+							strerror(-rc));
+				continue;
+			}
+			d->count++;
+		}
+
+		w->armed = 0;
+		arm_idle(ctx, w);
+	}
+}
+
+int nfc_workers_run(struct nfcctl *ctx, uint32_t protocol, worker_op_t op,
+							void *op_param)
+{
+	nfcctl_dev_handler_t dev_handler = ctx->dev_handler;
+	void *dev_param = ctx->dev_param;
+	struct dispatch_hdl_data params;
+	struct worker_done done;
+	struct pollfd fds[2];
+	unsigned i;
+	int rc;
+
+	printdbg(ctx, "IN");
+
+	memset(&params, 0, sizeof(params));
+	params.protocol = protocol;
+	params.op = op;
+	params.op_param = op_param;
+
+	params.workers = calloc(NFCCTL_DEVICES_MAX, sizeof(*params.workers));
+	if (!params.workers)
+		return -ENOMEM;
+
+	params.done_fd = eventfd(0, EFD_CLOEXEC);
+	if (params.done_fd == -1) {
+		rc = -errno;
+		goto free_workers;
+	}
+
+	/* Devices known already, then every one plugged in */
+	for (i = 0; i < ctx->devs_count; i++)
+		nfcctl_arm_add(&params.added, ctx->devs[i].idx);
+
+	ctx->dev_handler = nfcctl_arm_handler;
+	ctx->dev_param = &params.added;
+
+	fds[0].fd = nfcctl_get_fd(ctx);
+	fds[0].events = POLLIN;
+	fds[1].fd = params.done_fd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		rc = nfcctl_sync_devices(ctx);
+		if (rc < 0)
+			break;
+
+		start_added(ctx, &params);
+
+		rc = poll(fds, 2, nfcctl_event_pending(ctx) ? 0 : -1);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			rc = -errno;
+			break;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			wait_notify(params.done_fd);
+
+			for (i = 0; i < params.count; i++) {
+				struct nfc_worker *w = &params.workers[i];
+
+				while (!spsc_pop(&w->done, &done)) {
+					if (done.captured) {
+						arm_early(ctx, w);
+						continue;
+					}
+
+					if (done.rc)
+						printdbg(ctx, "Device %d: %s",
+							done.dev_idx,
+							strerror(-done.rc));
+
+					w->inflight--;
+					arm_idle(ctx, w);
+				}
+			}
+		}
+
+		if ((fds[0].revents & POLLIN) || nfcctl_event_pending(ctx)) {
+			for (i = 0; i < params.count; i++)
+				params.workers[i].reported = 0;
+
+			rc = nfcctl_targets_found(ctx, dispatch_handler,
+								&params);
+			if (rc == -ENOBUFS) {
+				/* Any device may have stopped unnoticed */
+				printdbg(ctx, "Events lost, re-arming devices");
+				for (i = 0; i < params.count; i++)
+					params.workers[i].armed = 0;
+			} else if (rc) {
+				break;
+			}
+
+			/* Devices whose targets were all skipped */
+			for (i = 0; i < params.count; i++)
+				arm_idle(ctx, &params.workers[i]);
+		}
+	}
+
+	for (i = 0; i < params.count; i++)
+		worker_deinit(&params.workers[i]);
+	close(params.done_fd);
+
+	ctx->dev_handler = dev_handler;
+	ctx->dev_param = dev_param;
+free_workers:
+	free(params.workers);
+	return rc;
+}
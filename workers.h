@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2011 Instituto Nokia de Tecnologia
+ *
+ * Author:
+ *     Paulo Alcantara <paulo.alcantara@openbossa.org>
+ *     Aloisio Almeida Jr <aloisio.almeida@openbossa.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _WORKERS_H_
+#define _WORKERS_H_
+
+#include <stdint.h>
+
+#include "nfcctl.h"
+
+/*
+ * Thread-per-reader model: the calling thread owns the netlink socket and
+ * hands every target found on a device to that device's worker thread. Each
+ * worker has a private struct nfcctl (without netlink socket) holding the
+ * connected target, so tag transfers on different readers run in parallel.
+ * A reader is polled again as soon as its target is connected, so it can
+ * find the next tag while the current one is being served. Readers known
+ * to ctx and those plugged in later each get a worker, up to
+ * NFCCTL_DEVICES_MAX; ctx->dev_handler is taken over meanwhile.
+ *
+ * The op is called from the worker thread with the target already connected
+ * through tag_connect() in a session of the worker's context. A negative
+ * return value is reported but does not stop the other workers.
+ */
+typedef int (*worker_op_t) (void *op_param, struct nfc_session *sess,
+				uint32_t dev_idx, const struct nfc_target *tgt);
+
+int nfc_workers_run(struct nfcctl *ctx, uint32_t protocol, worker_op_t op,
+							void *op_param);
+
+#endif /* _WORKERS_H_ */